@@ -0,0 +1,66 @@
+#ifndef LLVM_ABI_H
+#define LLVM_ABI_H
+
+#include "ast.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// The C entry point of an ahead of time compiled shader. Uniforms, inputs,
+// outputs and gl_Position are the fields of a context struct, in source
+// order, whether the shader uses them or not. A field is the scalar or an
+// array of the lanes, matrices column-major and bools as int32_t:
+//
+//   struct <entry>_context { float aPos[3]; float gl_Position[4]; };
+//   void <entry>(struct <entry>_context *context);
+//   extern const uint64_t <entry>_context_size;
+//
+// With a prologue, what main computes from the uniforms alone is done once
+// per draw rather than once per invocation. The prologue reads only the
+// uniforms of its context and fills the draw buffer, every invocation of
+// the draw then takes them from there. The buffer is aligned like malloc
+// and the uniforms of all contexts of the draw must be the same:
+//
+//   void <entry>_prologue(struct <entry>_context *context, void *draw);
+//   void <entry>(struct <entry>_context *context, const void *draw);
+//   extern const uint64_t <entry>_draw_size;
+//
+// With a tile kernel, one call shades the width by height pixels at x, y
+// of the framebuffer, a context for each, row by row. An input named when
+// compiling is the window coordinate, the tile sets its first two lanes to
+// the center of the pixel and does not read them. What depends on them is
+// worked out once per row or column instead of once per pixel, so the
+// uniforms of the contexts of a tile must be the same. draw is there with
+// a prologue:
+//
+//   void <entry>_tile(struct <entry>_context *contexts, const void *draw,
+//                     uint32_t x, uint32_t y, uint32_t width,
+//                     uint32_t height);
+
+// add the entry point to `module`. It sets the globals to their initial
+// values, loads the uniforms and inputs, runs main and stores the outputs.
+// The rest of the module becomes internal and the globals thread local, so
+// shaders can share a library and be called from several threads. False if
+// there is no main. Without `internalize` the linkage is left alone and
+// main may be defined by another module, as when the functions of a
+// reloaded shader are linked one by one. With `prologue` the prologue is
+// added empty, see hoistUniformWork in prologue.h for what fills it
+bool emitEntryPoint(const ast::TopLevelAST &program, Module &module,
+                    const std::string &entry, bool internalize = true,
+                    bool prologue = false);
+
+// the C declarations of the entry point, for the code loading the shader
+void printEntryPointHeader(const ast::TopLevelAST &program,
+                           const std::string &entry, raw_ostream &os,
+                           bool prologue = false, bool tile = false);
+
+// the fields of the context that are uniforms
+std::vector<unsigned> getUniformFields(const ast::TopLevelAST &program);
+// the field of the context holding input `name`, -1 if there is none
+int getInputField(const ast::TopLevelAST &program, const std::string &name);
+
+#endif // LLVM_ABI_H
@@ -2,7 +2,9 @@
 
 #include <utility>
 
+#include "flat_ast.h"
 #include "global.h"
+#include "matrix.h"
 #include "scope.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/IR/BasicBlock.h"
@@ -17,7 +19,7 @@
 
 using namespace llvm;
 
-extern std::shared_ptr<Scope> currentScope;
+extern thread_local std::shared_ptr<Scope> currentScope;
 
 namespace ast {
 
@@ -27,6 +29,13 @@ public:
 
   virtual Value *codegen() = 0;
   virtual std::string toString() const = 0;
+
+  // direct children in evaluation order, absent optional children are skipped
+  virtual void getChildren(std::vector<const AST *> &) const {}
+  // append this node to `flat`, `childIds` are the flat ids of getChildren()
+  virtual uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const = 0;
+  // remember that this node is `id` in `flat`, see TopLevelAST::index()
+  virtual void setFlatId(const FlatAST &, uint32_t) const {}
 };
 
 class FunctionArgumentAST {
@@ -60,6 +69,7 @@ public:
     return args;
   }
   std::string toString() const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 };
 
 class SentenceAST : public AST {
@@ -77,6 +87,7 @@ public:
 
   Value *codegen() override;
   std::string toString() const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
   bool isReturn() const override { return false; }
 };
 
@@ -89,6 +100,8 @@ public:
 
   Value *codegen() override;
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   std::vector<std::unique_ptr<SentenceAST>> &getSentences() {
     return sentences;
@@ -105,6 +118,9 @@ public:
 class ExpressionAST : public SentenceAST {
 protected:
   AstType returnType = type_error;
+  // this node in the flat form of its program, once it is indexed
+  mutable const FlatAST *indexedFlat = nullptr;
+  mutable uint32_t flatId = FlatAST::noNode;
 
 public:
   ~ExpressionAST() override = default;
@@ -112,8 +128,24 @@ public:
   void setReturnType(AstType type) { returnType = type; }
   virtual AstType getReturnType() const { return returnType; }
 
-  Value *codegen() override = 0;
+  // lowers this expression from the flat form of its program with the
+  // iterative walker, the result type is kept for getReturnType(). One
+  // that is not part of an indexed program is flattened first
+  Value *codegen() override;
+  // printed from the flat form, so depth does not cost native stack
+  std::string toString() const override;
   bool isReturn() const override { return false; }
+  void setFlatId(const FlatAST &flat, uint32_t id) const override {
+    indexedFlat = &flat;
+    flatId = id;
+  }
+
+  // move the child expressions out, used to tear trees down without recursion
+  virtual void takeChildren(std::vector<std::unique_ptr<ExpressionAST>> &) {}
+
+protected:
+  // destroys the children of this node with an explicit stack
+  void releaseChildren();
 };
 
 class ConditionalExpressionAST : public ExpressionAST {
@@ -135,11 +167,12 @@ public:
       return then->getReturnType();
   }
 
-  Value *codegen() override;
-
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~ConditionalExpressionAST() override = default;
+  ~ConditionalExpressionAST() override { releaseChildren(); }
   bool isReturn() const override {
     return then->isReturn() && else_->isReturn();
   }
@@ -157,19 +190,27 @@ public:
   AstType getReturnType() const override {
     if (returnType != type_error)
       return returnType;
-    if (LHS != nullptr && RHS != nullptr)
+    if (isBoolExpr(type))
+      return type_bool;
+    if (LHS != nullptr && RHS != nullptr) {
+      if (type == times_expr &&
+          isMatrixProduct(LHS->getReturnType(), RHS->getReturnType()))
+        return matrixProductType(LHS->getReturnType(), RHS->getReturnType());
       return LHS->getReturnType();
+    }
+    return type_error;
   }
 
-  Value *codegen() override;
-
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
   ExprType getType() const { return type; }
   std::unique_ptr<ExpressionAST> &getLHS() { return LHS; }
   std::unique_ptr<ExpressionAST> &getRHS() { return RHS; }
 
-  ~BinaryExpressionAST() override = default;
+  ~BinaryExpressionAST() override { releaseChildren(); }
 
   bool isReturn() const override { return LHS->isReturn() && RHS->isReturn(); }
 };
@@ -183,6 +224,8 @@ public:
       : type(type), RHS(std::move(RHS)) {}
 
   AstType getReturnType() const override {
+    if (returnType != type_error)
+      return returnType;
     switch (type) {
     case plus_p_expr:
     case minus_m_expr:
@@ -192,17 +235,18 @@ public:
       return RHS->getReturnType();
       break;
     case not_expr:
-      return type_int;
+      return type_bool;
     default:
       return type_error;
     }
   }
 
-  Value *codegen() override;
-
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~PrefixExpressionAST() override = default;
+  ~PrefixExpressionAST() override { releaseChildren(); }
 
   bool isReturn() const override { return RHS->isReturn(); }
 };
@@ -217,12 +261,15 @@ public:
       : type(type), LHS(std::move(LHS)) {}
 
   AstType getReturnType() const override {
+    if (returnType != type_error)
+      return returnType;
     switch (type) {
     case plus_p_expr:
     case minus_m_expr:
       return type_int;
-    case dot_expr:
-      return type_float;
+    case dot_expr: // one lane per swizzle letter
+      return getVectorAstType(getAstTypeInfo(LHS->getReturnType()).scalar,
+                              identifier.size());
     default:
       return type_error;
     }
@@ -231,13 +278,14 @@ public:
   void setIdentifier(const std::string &identifier) {
     this->identifier = identifier;
   }
-  Value *codegen() override;
-
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
   bool isReturn() const override { return LHS->isReturn(); }
 
-  ~PostfixExpressionAST() override = default;
+  ~PostfixExpressionAST() override { releaseChildren(); }
 };
 
 class SequenceExpressionAST : public ExpressionAST {
@@ -268,17 +316,18 @@ public:
     expressions = std::vector<std::unique_ptr<ExpressionAST>>();
   }
 
-  Value *codegen() override;
-
   Value *getArgs();
 
   std::vector<std::unique_ptr<ExpressionAST>> &getExpressions() {
     return expressions;
   }
 
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~SequenceExpressionAST() override = default;
+  ~SequenceExpressionAST() override { releaseChildren(); }
 };
 
 class ExprListAST : public ExpressionAST {
@@ -311,11 +360,12 @@ public:
     return expressions;
   }
 
-  Value *codegen() override;
-
-  std::string toString() const;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~ExprListAST() = default;
+  ~ExprListAST() override { releaseChildren(); }
 };
 
 class FunctionCallAST : public ExpressionAST {
@@ -339,11 +389,12 @@ public:
     return false;
   }
 
-  Value *codegen() override;
-
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~FunctionCallAST() override = default;
+  ~FunctionCallAST() override { releaseChildren(); }
 };
 
 class IfStatementAST : public SentenceAST {
@@ -361,6 +412,8 @@ public:
   Value *codegen() override;
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   bool isReturn() const override {
     if (then != nullptr && else_ != nullptr)
@@ -389,11 +442,12 @@ public:
     return false;
   }
 
-  Value *codegen() override;
-
-  std::string toString() const;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~TypeConstructorAST() = default;
+  ~TypeConstructorAST() override { releaseChildren(); }
 };
 
 class ForStatementAST : public SentenceAST {
@@ -419,6 +473,8 @@ public:
   }
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   ~ForStatementAST() override = default;
 };
@@ -438,6 +494,8 @@ public:
   Value *codegen() override;
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   ~ReturnStatementAST() override = default;
 };
@@ -456,11 +514,9 @@ public:
 
   AstType getType() const { return type; }
   std::string getValue() const { return value; }
-  Value *codegen() override;
-
   bool isReturn() const override { return false; }
 
-  std::string toString() const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   ~NumberExprAST() override = default;
 };
@@ -471,15 +527,15 @@ class VariableExprAST : public ExpressionAST {
 public:
   explicit VariableExprAST(std::string name) : name(std::move(name)) {}
 
-  AstType getReturnType() const {
+  AstType getReturnType() const override {
+    if (returnType != type_error)
+      return returnType;
     return currentScope->getIndentifier(name)->first;
   }
 
-  Value *codegen() override;
-
   bool isReturn() const override { return false; }
 
-  std::string toString() const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   std::string getName() const { return name; }
 
@@ -498,25 +554,22 @@ public:
     if (returnType != type_error) {
       return returnType;
     }
-    switch (currentScope->getIndentifier(name)->first) {
-    case type_mat2:
-      return type_vec2;
-    case type_mat3:
-      return type_vec3;
-    case type_mat4:
-      return type_vec4;
-    default:
+    // one column of a matrix
+    const AstTypeInfo &info =
+        getAstTypeInfo(currentScope->getIndentifier(name)->first);
+    if (!info.isMatrix())
       return type_error;
-    }
+    return getVectorAstType(info.scalar, info.rows);
   }
 
-  Value *codegen() override;
-
   bool isReturn() const override { return false; }
 
-  std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
+  void takeChildren(
+      std::vector<std::unique_ptr<ExpressionAST>> &children) override;
 
-  ~VariableIndexExprAST() override = default;
+  ~VariableIndexExprAST() override { releaseChildren(); }
 };
 
 class DefinitionAST : public AST {
@@ -524,6 +577,8 @@ public:
   virtual ~DefinitionAST() = default;
 
   Value *codegen() override = 0;
+  // a top level definition is a function or a global variable
+  virtual bool isFunction() const { return false; }
 
   std::string toString() const override;
 };
@@ -545,9 +600,15 @@ public:
                                                      std::move(args))),
         Body(std::move(Body)) {}
 
+  const std::string &getName() const { return Proto->getName(); }
+  // create the signature only, so calls can precede the body
+  Function *declare() { return Proto->codegen(); }
   Function *codegen() override;
+  bool isFunction() const override { return true; }
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   ~FunctionDefinitionAST() override = default;
   void checkAndInsertVoidReturn(Function *);
@@ -568,7 +629,13 @@ public:
         init(std::move(init)) {}
   Value *codegen() override;
 
+  const std::string &getName() const { return name; }
+  AstType getType() const { return type; }
+  bool getIsConst() const { return isConst; }
+
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 
   bool isReturn() const override { return false; }
 
@@ -599,6 +666,9 @@ public:
   LayoutQualifierIdAST(LayoutIdentifier id, int value) : id(id), value(value) {}
   explicit LayoutQualifierIdAST(LayoutIdentifier id) : id(id) {}
 
+  LayoutIdentifier getId() const { return id; }
+  int getValue() const { return value; }
+
   std::string toString() const;
 };
 
@@ -610,6 +680,9 @@ public:
       std::unique_ptr<std::vector<std::unique_ptr<LayoutQualifierIdAST>>> ids)
       : ids(std::move(ids)) {}
 
+  const std::vector<std::unique_ptr<LayoutQualifierIdAST>> &getIds() const {
+    return *ids;
+  }
   std::string toString() const;
 };
 
@@ -623,7 +696,9 @@ public:
       : type(type), layoutQualifier(std::move(layoutQualifier)) {}
   ~LayoutAst() = default;
   Value *codegen() override;
+  LayoutType getType() const { return type; }
   std::string toString() const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 };
 
 class GlobalVariableDefinitionAST : public VariableDefinitionAST {
@@ -637,24 +712,49 @@ public:
         layout(std::move(layout)) {}
 
   Value *codegen() override;
+  LayoutType getLayoutType() const {
+    return layout ? layout->getType() : empty;
+  }
 
   bool isReturn() const override { return false; }
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 };
 
 class TopLevelAST : public AST {
   uint64_t version;
   std::unique_ptr<std::vector<std::unique_ptr<DefinitionAST>>> definitions;
+  // the whole program flattened once, expressions are lowered from it
+  FlatAST flat;
+  bool indexed = false;
 
 public:
   TopLevelAST(
       uint64_t version,
       std::unique_ptr<std::vector<std::unique_ptr<DefinitionAST>>> definitions)
       : version(version), definitions(std::move(definitions)) {}
+  // indexes the program first unless it is
   Value *codegen() override;
+  const std::vector<std::unique_ptr<DefinitionAST>> &getDefinitions() const {
+    return *definitions;
+  }
+  // the definitions may be changed through this, which drops the index
+  std::vector<std::unique_ptr<DefinitionAST>> &getDefinitions() {
+    indexed = false;
+    return *definitions;
+  }
+
+  // flatten the program into getFlat() and point every expression at its
+  // node there
+  const FlatAST &index();
+  bool isIndexed() const { return indexed; }
+  const FlatAST &getFlat() const { return flat; }
 
   std::string toString() const override;
+  void getChildren(std::vector<const AST *> &children) const override;
+  uint32_t flatten(FlatAST &flat, const uint32_t *childIds) const override;
 };
 } // namespace ast
 #define LLVM_AST_H
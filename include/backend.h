@@ -0,0 +1,38 @@
+#ifndef LLVM_BACKEND_H
+#define LLVM_BACKEND_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <string>
+
+using namespace llvm;
+
+// Machine code for the host. The module is optimized at O2, split into
+// `jobs` parts that the target backend compiles concurrently, and the parts
+// are joined again by the system linker, with the symbols they share local
+// again so the object exports the same as with one job.
+
+// the O2 pipeline for `machine`
+void optimizeModule(Module &module, TargetMachine &machine);
+
+// runs on the optimized module before it is compiled
+using OptimizedHook = function_ref<void(Module &)>;
+
+// write a relocatable object to `path`, false on failure
+bool emitObjectFile(Module &module, const std::string &path, unsigned jobs,
+                    OptimizedHook optimized = nullptr);
+
+// link the object into a shared library at `path`, with libm for the
+// functions the built-ins call
+bool emitSharedLibrary(Module &module, const std::string &path,
+                       unsigned jobs, OptimizedHook optimized = nullptr);
+
+// run `name` found in PATH with `args`, the first being the program name.
+// False if it cannot be run or fails
+bool runProgram(StringRef name, ArrayRef<StringRef> args);
+
+#endif // LLVM_BACKEND_H
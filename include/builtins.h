@@ -0,0 +1,28 @@
+#ifndef LLVM_BUILTINS_H
+#define LLVM_BUILTINS_H
+
+#include "global.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/Value.h"
+
+#include <string>
+
+using namespace llvm;
+
+// GLSL built-in functions. They are emitted inline at the call, as LLVM
+// intrinsics where there is one and as plain instruction sequences
+// otherwise, so the optimizer sees through them. Scalar arguments of a
+// component-wise function are splat to the width of the vector ones.
+
+bool isBuiltinFunction(const std::string &name);
+
+// a * b + c, fused only when the builder's fast-math flags allow
+// contraction
+Value *emitMulAdd(Value *a, Value *b, Value *c);
+
+// lower `name(args)`, `args` are values and not pointers. Sets `resultType`
+// and returns nullptr if there is no overload for the arguments
+Value *emitBuiltinCall(const std::string &name, ArrayRef<Value *> args,
+                       ArrayRef<AstType> argTypes, AstType &resultType);
+
+#endif // LLVM_BUILTINS_H
@@ -0,0 +1,46 @@
+#ifndef LLVM_CACHE_H
+#define LLVM_CACHE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+// An on-disk cache of compiler outputs, shared by every run pointed at the
+// same directory. An entry is named by the hash of everything the output
+// depends on, so entries never go stale and concurrent runs agree on them.
+// Entries are written to a temporary file and renamed into place, and the
+// least recently used ones are removed once the directory outgrows its
+// limit.
+
+// the key of an output of `source` compiled with `options`. Line endings and
+// trailing blanks of the source do not matter, the compiler version and the
+// host target do
+std::string computeCacheKey(StringRef source, ArrayRef<std::string> options);
+
+class CompileCache {
+  std::string directory;
+  uint64_t maxBytes;
+  bool compress;
+
+  std::string getPath(StringRef key) const;
+
+public:
+  CompileCache(std::string directory, uint64_t maxBytes, bool compress);
+
+  // the output stored under `key`, nullptr on a miss
+  std::unique_ptr<MemoryBuffer> lookup(StringRef key);
+  void store(StringRef key, StringRef data);
+
+  // add this run, a hit when its outputs came from the cache however many
+  // lookups that took, to the totals kept in the directory and print them.
+  // Runs finishing at the same time may lose counts
+  void recordStatistics(bool hit, bool print);
+};
+
+#endif // LLVM_CACHE_H
@@ -0,0 +1,78 @@
+#ifndef LLVM_DOCUMENT_H
+#define LLVM_DOCUMENT_H
+
+#include "ast.h"
+#include "tokenizer.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A shader kept tokenized and parsed while it is edited, for editors that
+// want tokens and asts on every keystroke. An edit is lexed again from the
+// last token before it until the new tokens line up with the old ones, and
+// only the top level definitions those tokens fall in are parsed again.
+// The others keep their asts, and so does a definition whose tokens only
+// moved or come back.
+
+// `removed` characters at `offset` replaced by `inserted`
+struct TextEdit {
+  uint32_t offset = 0;
+  uint32_t removed = 0;
+  std::string inserted;
+};
+
+// the definitions from `first` on, `removed` of them before the edit and
+// `inserted` after it, are the ones it replaced
+struct DocumentChange {
+  size_t first = 0;
+  size_t removed = 0;
+  size_t inserted = 0;
+  // of the inserted ones, how many were parsed rather than moved
+  size_t parsed = 0;
+  size_t relexed = 0;
+};
+
+class Document {
+  std::string text;
+  std::vector<Token> lexed;
+  int version = -1;
+  // the token the definitions start at, after the version
+  uint32_t definitionsBegin = 0;
+  // the program, with gl_Position first as the parser puts it. A
+  // definition that does not parse is null. The token ranges and hashes
+  // go along, with nothing for gl_Position
+  std::unique_ptr<ast::TopLevelAST> program;
+  std::vector<std::pair<uint32_t, uint32_t>> spans;
+  std::vector<uint64_t> hashes;
+  // the asts edits dropped, by the hashes of their tokens, for an edit that
+  // brings the tokens back. Typing a `{` runs its definition into the rest
+  // of the file until the `}` is typed as well
+  DenseMap<uint64_t, std::unique_ptr<ast::DefinitionAST>> retired;
+  size_t mostDefinitions = 0;
+
+  void parseAll(DocumentChange &change);
+  void reparse(size_t first, uint32_t begin, uint32_t damageEnd,
+               uint32_t reusable, int64_t tokenShift,
+               DocumentChange &change);
+
+public:
+  explicit Document(std::string text);
+
+  DocumentChange edit(const TextEdit &edit);
+
+  const std::string &getText() const { return text; }
+  const std::vector<Token> &getTokens() const { return lexed; }
+  int getVersion() const { return version; }
+  ast::TopLevelAST &getProgram() { return *program; }
+  // the tokens of definition `i`, from first to one past the last
+  std::pair<uint32_t, uint32_t> getDefinitionTokens(size_t i) const {
+    return spans[i];
+  }
+  // false while the version or a definition does not parse
+  bool isValid() const;
+};
+
+#endif // LLVM_DOCUMENT_H
@@ -0,0 +1,37 @@
+#ifndef LLVM_FINGERPRINT_H
+#define LLVM_FINGERPRINT_H
+
+#include "flat_ast.h"
+
+#include <string>
+
+// A hash of what a shader means rather than how it is spelled. It is taken
+// over the parsed program, so whitespace and comments are already gone, and
+// names are resolved the way the generator resolves them:
+// - locals and arguments become their position in their function
+// - private globals and functions helping main become the order main
+//   reaches them in, so their declaration order does not matter either
+// - uniforms, inputs, outputs and built-ins keep their names, and the
+//   interface keeps its source order, which the C entry point depends on
+// Definitions main does not reach are left out, like in the output. A
+// shader without main is a library and keeps its names and order.
+//
+// The output names globals, functions, arguments and locals after the
+// source, so shaders told apart by those names only share a meaning, not an
+// output. The output fingerprint keeps every name and the source order, and
+// the whole interface whether main reads it or not, since the context struct
+// and the header hold all of it.
+
+namespace ast {
+
+// SHA-256 of the canonical form of the program under the top level node
+// `top`, as hex
+std::string computeFingerprint(const FlatAST &flat, uint32_t top);
+
+// like computeFingerprint(), but equal only for shaders that compile to the
+// same output
+std::string computeOutputFingerprint(const FlatAST &flat, uint32_t top);
+
+} // namespace ast
+
+#endif // LLVM_FINGERPRINT_H
@@ -0,0 +1,113 @@
+#ifndef LLVM_FLAT_AST_H
+#define LLVM_FLAT_AST_H
+
+#include "global.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace ast {
+
+class AST;
+
+enum FlatKind : uint8_t {
+  flat_top_level,
+  flat_function_definition,
+  flat_function_prototype,
+  flat_function_argument,
+  flat_global_variable_definition,
+  flat_variable_definition,
+  flat_layout,
+  flat_layout_qualifier_id,
+  flat_sentences,
+  flat_empty_sentence,
+  flat_if_statement,
+  flat_for_statement,
+  flat_return_statement,
+  flat_conditional_expression,
+  flat_binary_expression,
+  flat_prefix_expression,
+  flat_postfix_expression,
+  flat_sequence_expression,
+  flat_expr_list,
+  flat_function_call,
+  flat_type_constructor,
+  flat_number,
+  flat_variable,
+  flat_variable_index,
+};
+
+enum FlatFlag : uint8_t {
+  flat_const = 1 << 0,
+  flat_has_init = 1 << 1,
+  flat_has_layout = 1 << 2,
+  flat_has_else = 1 << 3,
+  flat_has_expr = 1 << 4,
+};
+
+// A flat mirror of the pointer tree as parallel node arrays in post-order.
+// Children are referenced by index, so a pass can walk a subtree with a
+// plain loop or an explicit stack, and the whole thing can be written out
+// as a few flat arrays.
+//
+// It is not the primary representation: the parser builds the pointer
+// tree and TopLevelAST::index() copies it here in one pass. Expressions are
+// lowered from this form, and the fingerprint, reachability and the binary
+// format read it, but statements, functions and globals are lowered from
+// the pointer tree, so a compile holds both.
+struct FlatAST {
+  static constexpr uint32_t noNode = UINT32_MAX;
+
+  std::vector<FlatKind> kinds;
+  std::vector<AstType> types;
+  std::vector<int32_t> ops; // ExprType, LayoutType or LayoutIdentifier
+  std::vector<uint8_t> flags;
+  std::vector<uint32_t> payloads; // name or literal index, or a plain value
+  std::vector<uint32_t> childBegin;
+  std::vector<uint32_t> childCount;
+  std::vector<uint32_t> children;
+  std::vector<std::string> names;
+  std::vector<std::string> literals;
+  uint32_t root = noNode;
+
+  size_t size() const { return kinds.size(); }
+  void clear();
+
+  uint32_t addNode(FlatKind kind, AstType type, int32_t op, uint8_t flag,
+                   uint32_t payload, const uint32_t *childIds,
+                   uint32_t numChildren);
+  uint32_t internName(StringRef name);
+  uint32_t addLiteral(StringRef literal);
+
+  uint32_t child(uint32_t node, uint32_t i) const {
+    return children[childBegin[node] + i];
+  }
+  const std::string &name(uint32_t node) const {
+    return names[payloads[node]];
+  }
+  const std::string &literal(uint32_t node) const {
+    return literals[payloads[node]];
+  }
+
+  // binary form, host byte order
+  void write(raw_ostream &os) const;
+  bool read(StringRef buffer);
+
+private:
+  StringMap<uint32_t> nameIds;
+};
+
+// flatten the tree under `root` into `flat` without recursion, returns the
+// flat id of `root`. With `setIds` every node learns its id, see
+// AST::setFlatId
+uint32_t flattenAST(const AST *root, FlatAST &flat, bool setIds = false);
+
+} // namespace ast
+
+#endif // LLVM_FLAT_AST_H
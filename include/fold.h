@@ -0,0 +1,17 @@
+#ifndef LLVM_FOLD_H
+#define LLVM_FOLD_H
+
+#include "llvm/IR/Constant.h"
+
+using namespace llvm;
+
+// IRBuilder folds an instruction whose operands are all constants as it is
+// created. What reaches the function anyway are calls of built-in functions
+// on constants and whatever is computed from their results.
+
+// `value` as a constant, nullptr if it depends on something only known at
+// run time. The instructions it is computed with that fold are replaced by
+// their constants and erased, `value` itself included
+Constant *foldConstant(Value *value);
+
+#endif // LLVM_FOLD_H
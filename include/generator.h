@@ -2,7 +2,44 @@
 #define LLVM_GENERATOR_H
 
 #include "ast.h"
+#include "llvm/ADT/StringMap.h"
 
-void codeGen(const char *filename);
+#include <string>
+
+// how much floating point math may deviate from IEEE. relaxed allows what
+// the GLSL precision model does: contraction into fma, approximate
+// functions and reciprocals. fast also assumes no nan, inf or signed zero
+// and allows reassociation
+enum FPMode {
+  fp_strict,
+  fp_relaxed,
+  fp_fast,
+};
+
+extern FPMode fpMode;
+
+// leave out the functions and globals main does not reach, see
+// reachability.h
+extern bool stripUnusedDefinitions;
+
+// the uniforms codegen on this thread lowers as consts of a value, by name,
+// each the bytes of its field of the context, see abi.h. A variant of the
+// shader specialized for them, see specialize.h
+extern thread_local const StringMap<std::string> *specializedUniforms;
+
+// threads lowering function bodies, each into a module of its own that is
+// linked into TheModule at the end
+extern unsigned codegenJobs;
+
+// destroy TheModule with its context and whatever holds values of them,
+// InitializeModule starts over
+void resetModule();
+
+FastMathFlags getFastMathFlags(FPMode mode);
+bool parseFPMode(const std::string &name, FPMode &mode);
+
+// TheModule as text IR or as bitcode, false if the file was not written
+bool codeGen(const char *filename);
+bool codeGenBitcode(const char *filename);
 
 #endif // LLVM_GENERATOR_H
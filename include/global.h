@@ -44,11 +44,24 @@ enum TokenType {
   tok_void = -27,   //
   tok_bool = -28,   //
   tok_int = -29,    //
+  tok_uint = -30,   //
   tok_float = -31,  //
   tok_double = -32, //
   tok_vec2 = -33,   //
   tok_vec3 = -34,   //
   tok_vec4 = -35,   //
+  tok_dvec2 = -36,  //
+  tok_dvec3 = -37,  //
+  tok_dvec4 = -38,  //
+  tok_bvec2 = -39,  //
+  tok_bvec3 = -40,  //
+  tok_bvec4 = -41,  //
+  tok_ivec2 = -42,  //
+  tok_ivec3 = -43,  //
+  tok_ivec4 = -44,  //
+  tok_uvec2 = -45,  //
+  tok_uvec3 = -46,  //
+  tok_uvec4 = -47,  //
   tok_mat2 = -48,   //
   tok_mat3 = -49,   //
   tok_mat4 = -50,   //
@@ -184,24 +197,132 @@ enum ExprType {
 
 std::string exprTypeToString(ExprType exprType);
 ExprType tokenToExprType(TokenType token);
+// comparisons and the logical operators, they yield a bool
+bool isBoolExpr(ExprType exprType);
 
 enum AstType {
   type_void = -1,
   type_bool = -2,
   type_int = -3, // default
+  type_uint = -4,
   type_float = -5, // default
   type_double = -6,
   type_vec2 = -7,
   type_vec3 = -8,
   type_vec4 = -9,
+  type_dvec2 = -10,
+  type_dvec3 = -11,
+  type_dvec4 = -12,
+  type_bvec2 = -13,
+  type_bvec3 = -14,
+  type_bvec4 = -15,
+  type_ivec2 = -16,
+  type_ivec3 = -17,
+  type_ivec4 = -18,
+  type_uvec2 = -19,
+  type_uvec3 = -20,
   type_mat2 = -21,
   type_mat3 = -22,
   type_mat4 = -23,
-  type_error = -24,
+  type_uvec4 = -24,
+  type_error = -25,
 };
 
 std::string astTypeToString(AstType astType);
 
+enum ScalarKind {
+  scalar_void,
+  scalar_bool,
+  scalar_int,
+  scalar_uint,
+  scalar_float,
+  scalar_double,
+};
+
+// static description of a GLSL type, matrices are column-major with `rows`
+// lanes per column
+struct AstTypeInfo {
+  AstType type;
+  TokenType token;
+  const char *name;
+  ScalarKind scalar;
+  unsigned rows;
+  unsigned columns;
+
+  constexpr unsigned lanes() const { return rows * columns; }
+  constexpr bool isVector() const { return columns == 1 && rows > 1; }
+  constexpr bool isMatrix() const { return columns > 1; }
+};
+
+// one slot per AstType value, indexed by astTypeSlot()
+inline constexpr AstTypeInfo astTypeInfos[] = {
+    {type_void, tok_void, "void", scalar_void, 0, 0},
+    {type_bool, tok_bool, "bool", scalar_bool, 1, 1},
+    {type_int, tok_int, "int", scalar_int, 1, 1},
+    {type_uint, tok_uint, "uint", scalar_uint, 1, 1},
+    {type_float, tok_float, "float", scalar_float, 1, 1},
+    {type_double, tok_double, "double", scalar_double, 1, 1},
+    {type_vec2, tok_vec2, "vec2", scalar_float, 2, 1},
+    {type_vec3, tok_vec3, "vec3", scalar_float, 3, 1},
+    {type_vec4, tok_vec4, "vec4", scalar_float, 4, 1},
+    {type_dvec2, tok_dvec2, "dvec2", scalar_double, 2, 1},
+    {type_dvec3, tok_dvec3, "dvec3", scalar_double, 3, 1},
+    {type_dvec4, tok_dvec4, "dvec4", scalar_double, 4, 1},
+    {type_bvec2, tok_bvec2, "bvec2", scalar_bool, 2, 1},
+    {type_bvec3, tok_bvec3, "bvec3", scalar_bool, 3, 1},
+    {type_bvec4, tok_bvec4, "bvec4", scalar_bool, 4, 1},
+    {type_ivec2, tok_ivec2, "ivec2", scalar_int, 2, 1},
+    {type_ivec3, tok_ivec3, "ivec3", scalar_int, 3, 1},
+    {type_ivec4, tok_ivec4, "ivec4", scalar_int, 4, 1},
+    {type_uvec2, tok_uvec2, "uvec2", scalar_uint, 2, 1},
+    {type_uvec3, tok_uvec3, "uvec3", scalar_uint, 3, 1},
+    {type_mat2, tok_mat2, "mat2", scalar_float, 2, 2},
+    {type_mat3, tok_mat3, "mat3", scalar_float, 3, 3},
+    {type_mat4, tok_mat4, "mat4", scalar_float, 4, 4},
+    {type_uvec4, tok_uvec4, "uvec4", scalar_uint, 4, 1},
+    {type_error, tok_unkown, "error", scalar_void, 0, 0},
+};
+
+inline constexpr unsigned astTypeSlotCount =
+    sizeof(astTypeInfos) / sizeof(astTypeInfos[0]);
+
+constexpr unsigned astTypeSlot(AstType type) { return -(int)type - 1; }
+
+constexpr const AstTypeInfo &getAstTypeInfo(AstType type) {
+  unsigned slot = astTypeSlot(type);
+  return slot < astTypeSlotCount ? astTypeInfos[slot]
+                                 : astTypeInfos[astTypeSlotCount - 1];
+}
+
+// the scalar or vector type with the given element kind and lane count,
+// type_error if GLSL has no such type
+constexpr AstType getVectorAstType(ScalarKind scalar, unsigned lanes) {
+  for (const AstTypeInfo &info : astTypeInfos) {
+    if (info.scalar == scalar && info.rows == lanes && info.columns == 1)
+      return info.type;
+  }
+  return type_error;
+}
+
+// the type keyword spelled by `token`, type_error if it is not one
+constexpr AstType getAstTypeFromToken(TokenType token) {
+  for (const AstTypeInfo &info : astTypeInfos) {
+    if (info.token == token && info.type != type_error)
+      return info.type;
+  }
+  return type_error;
+}
+
+constexpr bool astTypeInfosInSlotOrder() {
+  for (unsigned i = 0; i < astTypeSlotCount; i++) {
+    if (astTypeSlot(astTypeInfos[i].type) != i)
+      return false;
+  }
+  return true;
+}
+
+static_assert(astTypeInfosInSlotOrder(), "astTypeInfos is out of order");
+
 // std::string getTokName(int Tok) {
 //   switch (Tok) {
 //   case tok_eof:
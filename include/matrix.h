@@ -0,0 +1,27 @@
+#ifndef LLVM_MATRIX_H
+#define LLVM_MATRIX_H
+
+#include "global.h"
+#include "llvm/IR/Value.h"
+
+using namespace llvm;
+
+// Matrices are flat column-major vectors, element (row, column) is lane
+// `column * rows + row`. Products are lowered to column broadcasts chained
+// with llvm.fmuladd, everything else to shuffles of the flat vector.
+
+// whether `left * right` is a linear algebra product rather than a
+// component-wise one: matrix times matrix or vector, or vector times matrix
+bool isMatrixProduct(AstType left, AstType right);
+
+// the type of `left * right`, type_error if the shapes do not match
+AstType matrixProductType(AstType left, AstType right);
+
+Value *emitMatrixProduct(Value *left, AstType leftType, Value *right,
+                         AstType rightType);
+
+Value *emitTranspose(Value *matrix, AstType type);
+Value *emitDeterminant(Value *matrix, AstType type);
+Value *emitInverse(Value *matrix, AstType type);
+
+#endif // LLVM_MATRIX_H
@@ -7,6 +7,10 @@
 using namespace llvm;
 using namespace ast;
 
+// nesting limits, exceeding one rejects the shader with a diagnostic
+extern uint32_t maxExpressionDepth;
+extern uint32_t maxSentenceDepth;
+
 void InitializeModule();
 
 std::unique_ptr<ExpressionAST> ParseExpression();
@@ -15,6 +19,10 @@ std::unique_ptr<SentencesAST> ParseSentences();
 std::unique_ptr<VariableDefinitionAST> ParseVariableDefinition();
 std::unique_ptr<GlobalVariableDefinitionAST> ParseGlobalVariableDefinition();
 std::unique_ptr<FunctionDefinitionAST> ParseFunctionDefinition();
+// a function or global at the current token, nullptr if neither parses or
+// it nests too deep
+std::unique_ptr<DefinitionAST> ParseDefinition();
+int ParseVersion();
 
 int parseAST();
 
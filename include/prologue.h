@@ -0,0 +1,34 @@
+#ifndef LLVM_PROLOGUE_H
+#define LLVM_PROLOGUE_H
+
+#include "ast.h"
+#include "llvm/IR/Module.h"
+
+#include <string>
+
+using namespace llvm;
+
+// Work a fragment shader does on its uniforms alone, like scaling by the
+// resolution or the sines and cosines of the time, gives every pixel of a
+// draw the same result. Once main is inlined into the entry point, a value
+// of the entry point is uniform when it is
+// - a load of a uniform from the context
+// - an operation without memory access whose operands are uniform or
+//   constants, and which is safe to run early or runs on every path anyway
+// The uniform values that code depending on the invocation uses are
+// computed by the prologue instead, which stores them in the draw buffer,
+// and the entry point loads them from there. One that is no more than a
+// load of a uniform is left alone, it would be a load either way.
+
+// a constant computed without the address of a global
+bool isPlainConstant(const Value *value);
+// a cast or a move of vector or aggregate lanes, about as cheap as getting
+// its operands
+bool movesLanes(const Instruction &instruction);
+
+// fill the prologue emitEntryPoint added for `entry` in the optimized
+// `module`, and set the draw size. The number of values hoisted
+unsigned hoistUniformWork(const ast::TopLevelAST &program, Module &module,
+                          const std::string &entry);
+
+#endif // LLVM_PROLOGUE_H
@@ -0,0 +1,21 @@
+#ifndef LLVM_REACHABILITY_H
+#define LLVM_REACHABILITY_H
+
+#include "flat_ast.h"
+
+#include <vector>
+
+// Which top-level definitions a shader uses. main is the root, a function is
+// used when a used function calls it and a global when a used function or
+// the initializer of a used global names it. Names are matched without
+// scopes, so a local that shadows a global keeps the global alive.
+
+namespace ast {
+
+// one flag per child of the top level node `top`, in source order. All are
+// set when there is no main, e.g. for a library of functions
+std::vector<bool> findUsedDefinitions(const FlatAST &flat, uint32_t top);
+
+} // namespace ast
+
+#endif // LLVM_REACHABILITY_H
@@ -0,0 +1,29 @@
+#ifndef LLVM_SERVER_H
+#define LLVM_SERVER_H
+
+#include <string>
+
+// A compile server on a Unix domain socket. The server initializes LLVM
+// once and keeps children forked from that warm state waiting for
+// connections. Each child takes one request, so it starts without anything
+// a previous compile left behind and cannot take the server down with it,
+// and the server forks a replacement as soon as it is taken.
+//
+// A request is the options and the source, a response the exit status,
+// what the compile printed and the output file. Every number is a 32 bit
+// integer in host byte order and every string its length followed by its
+// bytes:
+//   request:  option count, options..., source
+//   response: status, printed, output
+
+// compile like main does, argv is `glsl input x output options...`
+using CompileFunction = int (*)(int argc, char *argv[]);
+
+// accept requests on `path` until the process is killed
+int serve(const std::string &path, CompileFunction compile);
+
+// send `argv` to the server on `path` and write what it returns, as if
+// compiled here. Paths in the options are made absolute first
+int compileRemotely(const std::string &path, int argc, char *argv[]);
+
+#endif // LLVM_SERVER_H
@@ -0,0 +1,128 @@
+#ifndef LLVM_SPECIALIZE_H
+#define LLVM_SPECIALIZE_H
+
+#include "ast.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// A shader run in the JIT on context after context, the way a host runs
+// it, with the uniforms that stay the same over long runs of contexts
+// folded into the code. It starts on the generic entry point. Once the
+// uniforms have kept their values for a while, a variant lowering them as
+// consts, see specializedUniforms in generator.h, is compiled on a thread
+// of its own and the runs switch to it when it has linked.
+// A uniform that changed along with the others last time, like the time
+// of an animation, is left out of the variant and stays generic, until
+// some other uniform changes without it. The variants are kept by the
+// uniforms they fix and their values, so going back to earlier values
+// finds the variant again. The least recently used one goes first when
+// there are too many.
+class UniformSpecializer {
+public:
+  using EntryFunction = void (*)(void *context);
+
+  struct Statistics {
+    uint64_t runs = 0;
+    uint64_t specializedRuns = 0;
+    uint64_t compiled = 0;
+    uint64_t evicted = 0;
+  };
+
+private:
+  // a uniform and the bytes of its field of the context
+  struct Uniform {
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+  };
+  // the entry point compiled for the uniforms of `key`, which has a byte for
+  // each uniform, 1 when the variant fixes it and then followed by its value
+  struct Variant {
+    std::string key;
+    EntryFunction function = nullptr;
+    ResourceTrackerSP tracker;
+  };
+
+  ast::TopLevelAST &program;
+  std::string entry;
+  size_t capacity;
+  std::unique_ptr<TargetMachine> machine;
+  std::unique_ptr<LLJIT> jit;
+  std::vector<Uniform> uniforms;
+  uint64_t contextSize = 0;
+  unsigned compiledCount = 0;
+  EntryFunction generic = nullptr;
+
+  // used by the thread calling run alone
+  EntryFunction current = nullptr;
+  std::string currentKey;
+  // the values the uniforms had on the last run, and which of them changed
+  // when they last did
+  std::vector<std::string> values;
+  std::vector<bool> lastChanged;
+  uint64_t runLength = 0;
+  // most recently used first
+  std::list<Variant> variants;
+  StringMap<std::list<Variant>::iterator> byKey;
+  Statistics statistics;
+
+  // shared with the compiling thread. A key is empty when there is none
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::string queued;
+  std::string compiling;
+  std::vector<Variant> finished;
+  std::atomic<bool> hasFinished{false};
+  bool stopping = false;
+  std::thread compiler;
+
+  UniformSpecializer(ast::TopLevelAST &program, std::string entry,
+                     size_t capacity)
+      : program(program), entry(std::move(entry)), capacity(capacity) {}
+
+  bool compileVariant(Variant &variant);
+  void compileQueued();
+  void noteUniforms(const char *context);
+  void request();
+  void takeFinished();
+
+public:
+  ~UniformSpecializer();
+
+  // compile the generic entry point `entry` of `program`, which has to
+  // outlive the specializer, with up to `capacity` variants. Null, with an
+  // error, if it does not compile
+  static std::unique_ptr<UniformSpecializer>
+  create(ast::TopLevelAST &program, const std::string &entry,
+         size_t capacity);
+
+  uint64_t getContextSize() const { return contextSize; }
+  const Statistics &getStatistics() const { return statistics; }
+
+  // run the entry point on `context`, see abi.h. From one thread only
+  void run(void *context);
+};
+
+// run `entry`, see abi.h, of the shader at `path` on every context in the
+// file `input`, contexts laid out one after the other as the header puts
+// them, and write them to `output` after. Up to `capacity` specialized
+// variants are kept, none with 0. -1 if the shader or the contexts cannot
+// be read
+int runShader(const std::string &path, const std::string &input,
+              const std::string &output, const std::string &entry,
+              size_t capacity);
+
+#endif // LLVM_SPECIALIZE_H
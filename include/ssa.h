@@ -0,0 +1,47 @@
+#ifndef LLVM_SSA_H
+#define LLVM_SSA_H
+
+#include "global.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+// a local held in registers, identified by its scope entry. The entry's value
+// is null, the current definition lives in the SSABuilder
+using SSAVariable = std::pair<AstType, Value *>;
+
+// builds ssa form while the function is emitted, following Braun et al.,
+// "Simple and Efficient Construction of Static Single Assignment Form".
+// A block is sealed once all of its predecessors are emitted, reads in an
+// unsealed block get a phi that is completed at sealing time.
+class SSABuilder {
+  DenseMap<BasicBlock *, DenseMap<SSAVariable *, WeakTrackingVH>> currentDef;
+  DenseMap<BasicBlock *, std::vector<std::pair<SSAVariable *, PHINode *>>>
+      incompletePhis;
+  SmallPtrSet<BasicBlock *, 32> sealedBlocks;
+
+  PHINode *createPhi(SSAVariable *variable, BasicBlock *block);
+  Value *readVariableRecursive(SSAVariable *variable, BasicBlock *block);
+  Value *addPhiOperands(SSAVariable *variable, PHINode *phi);
+  Value *tryRemoveTrivialPhi(PHINode *phi);
+
+public:
+  void writeVariable(SSAVariable *variable, BasicBlock *block, Value *value);
+  Value *readVariable(SSAVariable *variable, BasicBlock *block);
+  void sealBlock(BasicBlock *block);
+  // seal what is left once the whole function is emitted
+  void sealFunction(Function *function);
+};
+
+// the builder of the function being emitted
+extern thread_local std::unique_ptr<SSABuilder> TheSSA;
+
+#endif // LLVM_SSA_H
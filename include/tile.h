@@ -0,0 +1,37 @@
+#ifndef LLVM_TILE_H
+#define LLVM_TILE_H
+
+#include "ast.h"
+#include "llvm/IR/Module.h"
+
+#include <string>
+
+using namespace llvm;
+
+// Gradients, scanline effects and noise hashed from one axis do much of
+// their work on the y of the window coordinate alone, or on the x alone.
+// The tile kernel runs the pixels of a tile in loops over strips of
+// columns, rows and the pixels of a row, and the entry point's values move
+// out of the pixel loop as far as what they vary with allows:
+// - those depending on uniforms alone to the start of the tile
+// - on the x and uniforms to a pass over the columns of the strip, which
+//   keeps them in a buffer on the stack
+// - on the y and uniforms to the start of the row
+// What a value varies with is found lane by lane, the shader divides the
+// whole coordinate by the resolution and picks the lanes after. As for the
+// prologue only values that do more than load and move lanes are moved,
+// and only when safe to run early or run on every path anyway.
+
+// false, with an error, if input `coordinate` of `program` cannot be the
+// window coordinate, which takes a float vector
+bool checkTileCoordinate(const ast::TopLevelAST &program,
+                         const std::string &coordinate);
+
+// add <entry>_tile to the optimized `module`, running the entry point
+// emitEntryPoint added for `entry` over a tile. The number of values moved
+// out of the pixel loop
+unsigned emitTileKernel(const ast::TopLevelAST &program, Module &module,
+                        const std::string &entry,
+                        const std::string &coordinate);
+
+#endif // LLVM_TILE_H
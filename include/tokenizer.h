@@ -5,6 +5,7 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <vector>
 
 int gettok();
 int advance();
@@ -14,17 +15,28 @@ void redirectOutput(std::string filePath);
 void rediectOutput(std::string filePath);
 void consolePrint(std::string str);
 void Tokenize();
+// lex `begin` to `end` instead of stdin, offsets counting from `offset`
+void setInputText(const char *begin, const char *end, uint32_t offset);
+// forget the tokens and the lookahead, to tokenize another input
+void resetTokenizer();
 void printTokens();
 
 struct Token {
     TokenType type;
     std::unique_ptr<std::string> value;
+    // where the token is in the input, in characters
+    uint32_t offset = 0;
+    uint32_t length = 0;
     Token(TokenType type, std::unique_ptr<std::string> value) : type(type), value(std::move(value)) {}
     Token(TokenType type,const char *value) : type(type), value(std::make_unique<std::string>(value)) {}
-    Token(Token&& other) noexcept : type(other.type), value(std::move(other.value)) {}
+    Token(Token&& other) noexcept : type(other.type), value(std::move(other.value)), offset(other.offset), length(other.length) {}
+    Token &operator=(Token &&other) noexcept = default;
     std::string toString();
 };
 
+// append the next token to `into`, false once the input is used up
+bool lexToken(std::vector<Token> &into);
+
 #define LLVM_TOKENIZER_H
 
 #endif // LLVM_TOKENIZER_H
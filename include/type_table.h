@@ -0,0 +1,44 @@
+#ifndef LLVM_TYPE_TABLE_H
+#define LLVM_TYPE_TABLE_H
+
+#include "global.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Alignment.h"
+
+#include <memory>
+
+using namespace llvm;
+
+// llvm types of every AstType, built once per LLVMContext so codegen never
+// has to rebuild a VectorType
+class TypeTable {
+public:
+  struct Entry {
+    Type *type = nullptr;        // register type, matrices are flattened
+    Type *elementType = nullptr; // type of one lane
+    Type *columnType = nullptr;  // one column of a matrix, else same as type
+    Type *memoryType = nullptr;  // as stored, bool lanes are widened to i32
+    unsigned lanes = 0;
+    Align align; // of memoryType
+  };
+
+private:
+  Entry entries[astTypeSlotCount];
+
+public:
+  TypeTable(LLVMContext &context, const DataLayout &layout);
+
+  const Entry &get(AstType type) const {
+    return entries[astTypeSlot(getAstTypeInfo(type).type)];
+  }
+  Type *getType(AstType type) const { return get(type).type; }
+
+  // `lanes` x `scalar`, the scalar type itself for a single lane
+  Type *getVectorType(ScalarKind scalar, unsigned lanes) const;
+};
+
+extern thread_local std::unique_ptr<TypeTable> TheTypes;
+
+#endif // LLVM_TYPE_TABLE_H
@@ -0,0 +1,29 @@
+#ifndef LLVM_WATCH_H
+#define LLVM_WATCH_H
+
+#include <string>
+
+// Live reloading while a shader is edited. The shader runs in an in-process
+// JIT and is rebuilt whenever its file changes, but only as far as the edit
+// reaches:
+// - the file is kept as a Document, see document.h, and a change to it is
+//   one edit from the first to the last character that differ, so only
+//   the definitions in between are lexed and parsed again
+// - every function and global is an object of its own, compiled again only
+//   when its tokens, the signatures of the functions it names or the
+//   globals it names (const ones with the constants they are folded from)
+//   changed
+// - the entry point is one more object, compiled again when a global or the
+//   signature of main changed
+// Functions are called through stubs, a new version is linked next to the
+// old one and swapped in by pointing the stub at it once everything new
+// has linked. An edit that does not parse leaves the old version running.
+// Functions are optimized one at a time and are not inlined into each
+// other, an edit would have to recompile every caller otherwise.
+
+// watch `path` until killed. After every change the shader is reloaded and
+// `entry`, see abi.h, is called once with a zeroed context. -1 if the JIT
+// cannot be created
+int watchShader(const std::string &path, const std::string &entry);
+
+#endif // LLVM_WATCH_H
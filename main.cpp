@@ -2,14 +2,27 @@
 // Created by jb030 on 12/05/2023.
 //
 
+#include "abi.h"
 #include "parser.h"
 #include "tokenizer.h"
+#include "backend.h"
+#include "cache.h"
+#include "fingerprint.h"
 #include "generator.h"
+#include "prologue.h"
 #include "scope.h"
+#include "server.h"
+#include "specialize.h"
+#include "tile.h"
+#include "watch.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <limits>
 
 extern std::unique_ptr<TopLevelAST> topLevelAst;
-extern std::set<std::shared_ptr<Scope>> scopeSet;
-extern Module *TheModule;
+extern thread_local std::set<std::shared_ptr<Scope>> scopeSet;
+extern thread_local std::unique_ptr<Module> TheModule;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
 //int main(int argc,char *argv[]) {
 //  initBinopPrecedence();
 //  redirectInput(GLSL_FILE);
@@ -33,15 +46,167 @@ extern Module *TheModule;
 //  scopeSet.clear();
 //}
 
+// the number after the first `length` characters of `option`, false when
+// there is none or it does not fit into `value`
+template <typename T>
+static bool parseOptionValue(const std::string &option, size_t length,
+                             T &value) {
+  unsigned long long parsed;
+  if (StringRef(option).drop_front(length).getAsInteger(10, parsed) ||
+      parsed > std::numeric_limits<T>::max())
+    return false;
+  value = parsed;
+  return true;
+}
+
+// outputs and the cache keys they are stored under
+using CachedOutputs = std::vector<std::pair<std::string, std::string>>;
+
+// write every output from the cache, false unless all of them were there
+static bool restoreOutputs(CompileCache &cache, const CachedOutputs &outputs) {
+  std::vector<std::unique_ptr<MemoryBuffer>> entries;
+  for (auto &output : outputs) {
+    entries.push_back(cache.lookup(output.second));
+    if (!entries.back())
+      return false;
+  }
+  for (size_t i = 0; i < outputs.size(); i++) {
+    std::error_code error;
+    raw_fd_ostream os(outputs[i].first, error, sys::fs::OF_None);
+    if (error)
+      return false;
+    os << entries[i]->getBuffer();
+  }
+  return true;
+}
+
+static void storeOutputs(CompileCache &cache, const CachedOutputs &outputs) {
+  for (auto &output : outputs) {
+    if (auto file = MemoryBuffer::getFile(output.first))
+      cache.store(output.second, (*file)->getBuffer());
+  }
+}
+
 // test1
-int main(int argc,char *argv[]) {
+static int compile(int argc, char *argv[]) {
+  // options after the positional arguments
+  bool emitObject = false;
+  bool emitShared = false;
+  bool emitBitcode = false;
+  bool prologue = false;
+  // the input holding the window coordinate, for a tile kernel
+  std::string tileCoordinate;
+  std::string entry = "shader_main";
+  std::string header;
+  std::string cacheDirectory;
+  uint64_t cacheMegabytes = 512;
+  bool cacheCompress = false;
+  bool cacheStatistics = false;
+  bool printFingerprint = false;
+  bool watch = false;
+  // the contexts to run the shader on, and the variants it may keep
+  std::string runInput;
+  size_t specializeCapacity = 8;
+  // the options the output depends on
+  std::vector<std::string> keyOptions;
+  for (int i = 4; i < argc; i++) {
+    std::string option(argv[i]);
+    if (option.rfind("-jobs=", 0) != 0 && option.rfind("-cache", 0) != 0 &&
+        option.rfind("-header=", 0) != 0 && option != "-fingerprint")
+      keyOptions.push_back(option);
+    bool valid = true;
+    if (option.rfind("-max-expr-depth=", 0) == 0)
+      valid = parseOptionValue(option, 16, maxExpressionDepth);
+    else if (option.rfind("-max-block-depth=", 0) == 0)
+      valid = parseOptionValue(option, 17, maxSentenceDepth);
+    else if (option.rfind("-jobs=", 0) == 0)
+      valid = parseOptionValue(option, 6, codegenJobs) && codegenJobs > 0;
+    else if (option == "-emit-obj")
+      emitObject = true;
+    else if (option == "-emit-bc")
+      emitBitcode = true;
+    else if (option == "-emit-so")
+      emitShared = true;
+    else if (option == "-uniform-prologue")
+      prologue = true;
+    else if (option.rfind("-tile-coord=", 0) == 0)
+      tileCoordinate = option.substr(12);
+    else if (option.rfind("-entry=", 0) == 0)
+      entry = option.substr(7);
+    else if (option.rfind("-header=", 0) == 0)
+      header = option.substr(8);
+    else if (option.rfind("-cache-dir=", 0) == 0)
+      cacheDirectory = option.substr(11);
+    else if (option.rfind("-cache-size=", 0) == 0)
+      valid = parseOptionValue(option, 12, cacheMegabytes);
+    else if (option == "-cache-compress")
+      cacheCompress = true;
+    else if (option == "-cache-stats")
+      cacheStatistics = true;
+    else if (option == "-fingerprint")
+      printFingerprint = true;
+    else if (option == "-watch")
+      watch = true;
+    else if (option.rfind("-run=", 0) == 0)
+      runInput = option.substr(5);
+    else if (option.rfind("-specialize=", 0) == 0)
+      valid = parseOptionValue(option, 12, specializeCapacity);
+    else if (option == "-keep-unused")
+      stripUnusedDefinitions = false;
+    else if (option.rfind("-fp-mode=", 0) == 0 &&
+             !parseFPMode(option.substr(9), fpMode)) {
+      printf("unknown -fp-mode, expected strict, relaxed or fast\n");
+      return -1;
+    }
+    if (!valid) {
+      printf("invalid option value in %s\n", option.c_str());
+      return -1;
+    }
+  }
+  // machine code is split by job, text IR and bitcode come out the same
+  if (emitObject || emitShared)
+    keyOptions.push_back("-jobs=" + std::to_string(codegenJobs));
+
+  // runs the shader and reloads it on every change instead, the output is
+  // not written
+  if (watch)
+    return watchShader(argv[1], entry);
+  // runs the shader on the contexts in the file and writes them to the
+  // output, with uniforms folded in as they stay the same
+  if (!runInput.empty())
+    return runShader(argv[1], runInput, argv[3], entry, specializeCapacity);
+
+  std::unique_ptr<CompileCache> cache;
+  CachedOutputs outputs;
+  if (!cacheDirectory.empty()) {
+    if (auto source = MemoryBuffer::getFile(argv[1])) {
+      cache = std::make_unique<CompileCache>(
+          cacheDirectory, cacheMegabytes << 20, cacheCompress);
+      std::string key = computeCacheKey((*source)->getBuffer(), keyOptions);
+      outputs.push_back({argv[3], key});
+      if (!header.empty())
+        outputs.push_back({header, key + "-header"});
+      // a hit skips the whole compiler
+      if (restoreOutputs(*cache, outputs)) {
+        printf("accept");
+        cache->recordStatistics(true, cacheStatistics);
+        return 0;
+      }
+    }
+  }
+
   initBinopPrecedence();
   redirectInput(argv[1]);
 //  rediectOutput(JSON_FILE);
 
   Tokenize();
   //printTokens();
-  InitializeModule();
+  // a server worker prepares it before the request comes, so before the
+  // request's -fp-mode is known
+  if (!TheModule)
+    InitializeModule();
+  else
+    Builder->setFastMathFlags(getFastMathFlags(fpMode));
 
   if (parseAST() < 0) {
     //consolePrint("reject");
@@ -51,9 +216,89 @@ int main(int argc,char *argv[]) {
     printf("accept");
     //consolePrint("accept");
   }
+  if (printFingerprint)
+    printf("\nfingerprint %s\n",
+           computeFingerprint(topLevelAst->getFlat(),
+                              topLevelAst->getFlat().root)
+               .c_str());
+  // shaders that only differ in spacing, comments or definitions main does
+  // not reach share their outputs. Not with -keep-unused, which emits those
+  if (cache && stripUnusedDefinitions) {
+    keyOptions.push_back("-exact-fingerprint");
+    std::string key = computeCacheKey(
+        computeOutputFingerprint(topLevelAst->getFlat(),
+                                 topLevelAst->getFlat().root),
+        keyOptions);
+    CachedOutputs canonical = {{argv[3], key}};
+    if (!header.empty())
+      canonical.push_back({header, key + "-header"});
+    if (restoreOutputs(*cache, canonical)) {
+      storeOutputs(*cache, outputs);
+      cache->recordStatistics(true, cacheStatistics);
+      return 0;
+    }
+    outputs.insert(outputs.end(), canonical.begin(), canonical.end());
+  }
 //  std::cout << topLevelAst->toString() << std::endl;
+  if (!tileCoordinate.empty() &&
+      !checkTileCoordinate(*topLevelAst, tileCoordinate))
+    return -1;
   topLevelAst->codegen();
-  verifyModule(*TheModule, &llvm::outs());
-  codeGen(argv[3]);
+  bool broken = verifyModule(*TheModule, &llvm::outs());
+  if (!header.empty()) {
+    std::error_code error;
+    raw_fd_ostream os(header, error);
+    if (error) {
+      printf("Error: cannot write %s\n", header.c_str());
+      return -1;
+    }
+    printEntryPointHeader(*topLevelAst, entry, os, prologue,
+                          !tileCoordinate.empty());
+  }
+  if (emitObject || emitShared) {
+    // the backend would crash on it
+    if (broken)
+      return -1;
+    if (!emitEntryPoint(*topLevelAst, *TheModule, entry, true, prologue))
+      return -1;
+    // main has to be inlined into the entry point first
+    auto hoist = [&](Module &module) {
+      if (prologue)
+        hoistUniformWork(*topLevelAst, module, entry);
+      if (!tileCoordinate.empty())
+        emitTileKernel(*topLevelAst, module, entry, tileCoordinate);
+    };
+    OptimizedHook optimized = nullptr;
+    if (prologue || !tileCoordinate.empty())
+      optimized = hoist;
+    bool written =
+        emitShared
+            ? emitSharedLibrary(*TheModule, argv[3], codegenJobs, optimized)
+            : emitObjectFile(*TheModule, argv[3], codegenJobs, optimized);
+    if (!written)
+      return -1;
+  } else {
+    bool written = emitBitcode ? codeGenBitcode(argv[3]) : codeGen(argv[3]);
+    if (!written)
+      return -1;
+  }
+  if (cache) {
+    if (!broken)
+      storeOutputs(*cache, outputs);
+    cache->recordStatistics(false, cacheStatistics);
+  }
   scopeSet.clear();
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // glsl -serve=SOCKET, or a compile handed to one with -connect=SOCKET
+  if (argc == 2 && std::string(argv[1]).rfind("-serve=", 0) == 0)
+    return serve(std::string(argv[1]).substr(7), compile);
+  for (int i = 4; i < argc; i++) {
+    std::string option(argv[i]);
+    if (option.rfind("-connect=", 0) == 0)
+      return compileRemotely(option.substr(9), argc, argv);
+  }
+  return compile(argc, argv);
 }
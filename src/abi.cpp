@@ -0,0 +1,207 @@
+#include "abi.h"
+#include "type_table.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/IRBuilder.h"
+
+#include <vector>
+
+using namespace ast;
+
+namespace {
+struct InterfaceVariable {
+  const GlobalVariableDefinitionAST *definition;
+  bool input; // loaded before main, else stored after it
+};
+} // namespace
+
+static std::vector<InterfaceVariable>
+getInterface(const TopLevelAST &program) {
+  std::vector<InterfaceVariable> variables;
+  for (auto &definition : program.getDefinitions()) {
+    if (definition->isFunction())
+      continue;
+    auto *global =
+        static_cast<const GlobalVariableDefinitionAST *>(definition.get());
+    if (global->getIsConst())
+      continue;
+    LayoutType layout = global->getLayoutType();
+    if (layout == uniform || layout == in)
+      variables.push_back({global, true});
+    else if (layout == out || global->getName() == "gl_Position")
+      variables.push_back({global, false});
+  }
+  return variables;
+}
+
+static Type *getFieldType(AstType type) {
+  const TypeTable::Entry &entry = TheTypes->get(type);
+  Type *lane = entry.memoryType->getScalarType();
+  return entry.lanes == 1 ? lane : ArrayType::get(lane, entry.lanes);
+}
+
+std::vector<unsigned> getUniformFields(const TopLevelAST &program) {
+  std::vector<InterfaceVariable> variables = getInterface(program);
+  std::vector<unsigned> fields;
+  for (unsigned i = 0; i < variables.size(); i++) {
+    if (variables[i].definition->getLayoutType() == uniform)
+      fields.push_back(i);
+  }
+  return fields;
+}
+
+int getInputField(const TopLevelAST &program, const std::string &name) {
+  std::vector<InterfaceVariable> variables = getInterface(program);
+  for (unsigned i = 0; i < variables.size(); i++) {
+    const GlobalVariableDefinitionAST *definition = variables[i].definition;
+    if (definition->getLayoutType() == in && definition->getName() == name)
+      return i;
+  }
+  return -1;
+}
+
+bool emitEntryPoint(const TopLevelAST &program, Module &module,
+                    const std::string &entry, bool internalize,
+                    bool prologue) {
+  Function *shaderMain = module.getFunction("main");
+  if (!shaderMain || (internalize && shaderMain->isDeclaration()) ||
+      shaderMain->arg_size() != 0) {
+    printf("Error: %s needs a main without arguments to call\n",
+           entry.c_str());
+    return false;
+  }
+  for (Function &function : module) {
+    if (internalize && !function.isDeclaration())
+      function.setLinkage(GlobalValue::InternalLinkage);
+  }
+  for (GlobalVariable &global : module.globals()) {
+    if (internalize) {
+      global.setLinkage(GlobalValue::InternalLinkage);
+      global.setThreadLocal(true);
+    }
+    if (!global.hasInitializer())
+      global.setInitializer(Constant::getNullValue(global.getValueType()));
+  }
+
+  std::vector<InterfaceVariable> variables = getInterface(program);
+  std::vector<Type *> fields;
+  for (const InterfaceVariable &variable : variables)
+    fields.push_back(getFieldType(variable.definition->getType()));
+  LLVMContext &context = module.getContext();
+  StructType *contextType =
+      StructType::create(context, fields, entry + "_context");
+
+  std::vector<Type *> params = {PointerType::getUnqual(contextType)};
+  if (prologue)
+    params.push_back(PointerType::getUnqual(context));
+  FunctionType *functionType =
+      FunctionType::get(Type::getVoidTy(context), params, false);
+  Function *function = Function::Create(
+      functionType, GlobalValue::ExternalLinkage, entry, module);
+  Argument *contextArg = function->getArg(0);
+  contextArg->setName("context");
+  if (prologue) {
+    function->getArg(1)->setName("draw");
+    Function *perDraw = Function::Create(functionType,
+                                         GlobalValue::ExternalLinkage,
+                                         entry + "_prologue", module);
+    perDraw->getArg(0)->setName("context");
+    perDraw->getArg(1)->setName("draw");
+    ReturnInst::Create(context,
+                       BasicBlock::Create(context, "entry", perDraw));
+  }
+  IRBuilder<> builder(BasicBlock::Create(context, "entry", function));
+
+  SmallPtrSet<GlobalVariable *, 8> loaded;
+  for (unsigned i = 0; i < variables.size(); i++) {
+    const GlobalVariableDefinitionAST *definition = variables[i].definition;
+    GlobalVariable *global = module.getNamedGlobal(definition->getName());
+    if (!variables[i].input || !global)
+      continue;
+    const TypeTable::Entry &type = TheTypes->get(definition->getType());
+    Value *field = builder.CreateStructGEP(contextType, contextArg, i);
+    Align align = module.getDataLayout().getABITypeAlign(fields[i]);
+    builder.CreateStore(
+        builder.CreateAlignedLoad(type.memoryType, field, align), global);
+    loaded.insert(global);
+  }
+  // every call starts like a new invocation
+  for (GlobalVariable &global : module.globals()) {
+    if (!loaded.count(&global))
+      builder.CreateStore(global.getInitializer(), &global);
+  }
+
+  builder.CreateCall(shaderMain);
+  for (unsigned i = 0; i < variables.size(); i++) {
+    const GlobalVariableDefinitionAST *definition = variables[i].definition;
+    GlobalVariable *global = module.getNamedGlobal(definition->getName());
+    if (variables[i].input || !global)
+      continue;
+    const TypeTable::Entry &type = TheTypes->get(definition->getType());
+    Value *field = builder.CreateStructGEP(contextType, contextArg, i);
+    Align align = module.getDataLayout().getABITypeAlign(fields[i]);
+    builder.CreateAlignedStore(builder.CreateLoad(type.memoryType, global),
+                               field, align);
+  }
+  builder.CreateRetVoid();
+
+  // folds once the target's data layout is known
+  Type *sizeType = Type::getInt64Ty(context);
+  new GlobalVariable(module, sizeType, true, GlobalValue::ExternalLinkage,
+                     ConstantExpr::getSizeOf(contextType),
+                     entry + "_context_size");
+  if (prologue)
+    new GlobalVariable(module, sizeType, true, GlobalValue::ExternalLinkage,
+                       ConstantInt::get(sizeType, 0), entry + "_draw_size");
+  return true;
+}
+
+static const char *getCType(ScalarKind scalar) {
+  switch (scalar) {
+  case scalar_bool:
+  case scalar_int:
+    return "int32_t";
+  case scalar_uint:
+    return "uint32_t";
+  case scalar_float:
+    return "float";
+  case scalar_double:
+    return "double";
+  default:
+    return "void";
+  }
+}
+
+void printEntryPointHeader(const TopLevelAST &program,
+                           const std::string &entry, raw_ostream &os,
+                           bool prologue, bool tile) {
+  os << "#include <stdint.h>\n\n";
+  os << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+  os << "struct " << entry << "_context {\n";
+  for (const InterfaceVariable &variable : getInterface(program)) {
+    const AstTypeInfo &info = getAstTypeInfo(variable.definition->getType());
+    os << "  " << getCType(info.scalar) << " "
+       << variable.definition->getName();
+    if (info.lanes() > 1)
+      os << "[" << info.lanes() << "]";
+    os << ";\n";
+  }
+  os << "};\n\n";
+  if (prologue) {
+    os << "void " << entry << "_prologue(struct " << entry
+       << "_context *context, void *draw);\n";
+    os << "void " << entry << "(struct " << entry
+       << "_context *context, const void *draw);\n";
+    os << "extern const uint64_t " << entry << "_draw_size;\n";
+  } else {
+    os << "void " << entry << "(struct " << entry << "_context *context);\n";
+  }
+  if (tile) {
+    os << "void " << entry << "_tile(struct " << entry
+       << "_context *contexts,\n    ";
+    if (prologue)
+      os << "const void *draw, ";
+    os << "uint32_t x, uint32_t y, uint32_t width, uint32_t height);\n";
+  }
+  os << "extern const uint64_t " << entry << "_context_size;\n\n";
+  os << "#ifdef __cplusplus\n}\n#endif\n";
+}
@@ -2,9 +2,9 @@
 
 using namespace ast;
 
-extern std::unique_ptr<LLVMContext> TheContext;
-extern std::unique_ptr<Module> TheModule;
-extern std::unique_ptr<IRBuilder<>> Builder;
+extern thread_local std::unique_ptr<LLVMContext> TheContext;
+extern thread_local std::unique_ptr<Module> TheModule;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
 extern std::map<std::string, Value *> NamedValues;
 
 std::string ast::layoutTypeToString(LayoutType type) {
@@ -31,50 +31,6 @@ std::string ast::layoutIdentifierToString(LayoutIdentifier id) {
   return "";
 }
 
-std::string ConditionalExpressionAST::toString() const {
-  // toJson
-  // there is a function called getReturnType
-  return R"({"type":"ConditionalExpressionAST","condition":)" +
-         condition->toString() + ",\"then\":" + then->toString() +
-         ",\"else\":" + else_->toString() + "}";
-}
-
-std::string BinaryExpressionAST::toString() const {
-  return R"({"type":"BinaryExpressionAST","operator":")" +
-         exprTypeToString(type) + R"(","left":)" + LHS->toString() +
-         ",\"right\":" + RHS->toString() + "}";
-}
-
-std::string PrefixExpressionAST::toString() const {
-  return R"({"type":"PrefixExpressionAST","operator":")" +
-         exprTypeToString(type) + R"(","operand":)" + RHS->toString() + "}";
-}
-
-std::string PostfixExpressionAST::toString() const {
-  return R"({"type":"PostfixExpressionAST","operator":")" +
-         exprTypeToString(type) + R"(","identifier":")" + identifier +
-         R"(","LHS":)" + LHS->toString() + "}";
-}
-
-std::string ExprListAST::toString() const {
-  // change exprs vector to string
-  std::string exprsString;
-  for (auto &expr : expressions) {
-    exprsString += expr->toString();
-    exprsString += ",";
-  }
-  if (!exprsString.empty()) {
-    exprsString.pop_back();
-  }
-  return R"({"type":"ExprListAST","exprs":[)" + exprsString + "]}";
-}
-
-std::string FunctionCallAST::toString() const {
-  // toJson: callee ,args
-  return R"({"type":"FunctionCallAST","callee":)" + callee +
-         ",\"args\":" + args->toString() + "}";
-}
-
 std::string FunctionPrototypeAST::toString() const {
   // toJson: returnType, Name, Args
   //  change args vector to string
@@ -115,11 +71,6 @@ std::string IfStatementAST::toString() const {
          "}";
 }
 
-std::string TypeConstructorAST::toString() const {
-  return R"({"type":"TypeConstructorAST","astType":")" + astTypeToString(type) +
-         R"(","args":)" + args->toString() + "}";
-}
-
 std::string ReturnStatementAST::toString() const {
   if (expr == nullptr) {
     return R"({"type":"ReturnStatementAST"})";
@@ -127,23 +78,6 @@ std::string ReturnStatementAST::toString() const {
   return R"({"type":"ReturnStatementAST","expr":)" + expr->toString() + "}";
 }
 
-std::string NumberExprAST::toString() const {
-  // valueType, value
-  return R"({"type":"NumberExprAST","astType":")" + astTypeToString(type) +
-         R"(","value":)" + value + "}";
-}
-
-std::string VariableExprAST::toString() const {
-  // identifier
-  return R"({"type":"VariableExprAST","identifier":")" + name + "\"}";
-}
-
-std::string VariableIndexExprAST::toString() const {
-  // identifier, index
-  return R"({"type":"VariableIndexExprAST","identifier":")" + name +
-         R"(","index":)" + index->toString() + "}";
-}
-
 std::string FunctionDefinitionAST::toString() const {
   // prototype, body
   return R"({"type":"FunctionDefinitionAST","prototype":)" + Proto->toString() +
@@ -235,20 +169,6 @@ std::string LayoutQualifierAst::toString() const {
   return R"({"type":"LayoutQualifierAst","ids":[)" + idsString + "]}";
 }
 
-std::string SequenceExpressionAST::toString() const {
-  // toJson: expressions
-  std::string expressionsString;
-  for (auto &expression : expressions) {
-    expressionsString += expression->toString();
-    expressionsString += ",";
-  }
-  if (!expressionsString.empty()) {
-    expressionsString.pop_back();
-  }
-  return R"({"type":"SequenceExpressionAST","expressions":[)" +
-         expressionsString + "]}";
-}
-
 std::string EmptySentenceAST::toString() const {
   return R"({"type":"EmptySentenceAST"})";
 }
@@ -259,3 +179,163 @@ std::string ForStatementAST::toString() const {
              ",\"step\":" + step->toString(),
          ",\"body\":" + body->toString() + "}";
 }
+
+// JSON text that goes before child `i` of a flat expression node, `i` equal to
+// the child count gives the closing text
+static std::string flatExpressionPiece(const FlatAST &flat, uint32_t node,
+                                       uint32_t i) {
+  uint32_t count = flat.childCount[node];
+  std::string op = exprTypeToString((ExprType)flat.ops[node]);
+  std::string astType = astTypeToString(flat.types[node]);
+  const char *separator = ",";
+  switch (flat.kinds[node]) {
+  case flat_conditional_expression:
+    return i == 0   ? R"({"type":"ConditionalExpressionAST","condition":)"
+           : i == 1 ? ",\"then\":"
+           : i == 2 ? ",\"else\":"
+                    : "}";
+  case flat_binary_expression:
+    return i == 0 ? R"({"type":"BinaryExpressionAST","operator":")" + op +
+                        R"(","left":)"
+           : i == 1 ? ",\"right\":"
+                    : "}";
+  case flat_prefix_expression:
+    return i == 0 ? R"({"type":"PrefixExpressionAST","operator":")" + op +
+                        R"(","operand":)"
+                  : "}";
+  case flat_postfix_expression:
+    return i == 0 ? R"({"type":"PostfixExpressionAST","operator":")" + op +
+                        R"(","identifier":")" + flat.name(node) +
+                        R"(","LHS":)"
+                  : "}";
+  case flat_sequence_expression:
+    return i == 0 ? R"({"type":"SequenceExpressionAST","expressions":[)" +
+                        std::string(i == count ? "]}" : "")
+           : i == count ? "]}"
+                        : separator;
+  case flat_expr_list:
+    return i == 0 ? R"({"type":"ExprListAST","exprs":[)" +
+                        std::string(i == count ? "]}" : "")
+           : i == count ? "]}"
+                        : separator;
+  case flat_function_call:
+    return i == 0 ? R"({"type":"FunctionCallAST","callee":)" +
+                        flat.name(node) +
+                        R"(,"args":{"type":"ExprListAST","exprs":[)" +
+                        std::string(i == count ? "]}}" : "")
+           : i == count ? "]}}"
+                        : separator;
+  case flat_type_constructor:
+    return i == 0 ? R"({"type":"TypeConstructorAST","astType":")" + astType +
+                        R"(","args":{"type":"ExprListAST","exprs":[)" +
+                        std::string(i == count ? "]}}" : "")
+           : i == count ? "]}}"
+                        : separator;
+  case flat_number:
+    return R"({"type":"NumberExprAST","astType":")" + astType +
+           R"(","value":)" + flat.literal(node) + "}";
+  case flat_variable:
+    return R"({"type":"VariableExprAST","identifier":")" + flat.name(node) +
+           "\"}";
+  case flat_variable_index:
+    return i == 0 ? R"({"type":"VariableIndexExprAST","identifier":")" +
+                        flat.name(node) + R"(","index":)"
+                  : "}";
+  default:
+    return "";
+  }
+}
+
+std::string ExpressionAST::toString() const {
+  FlatAST flat;
+  flat.root = flattenAST(this, flat);
+  // node and the next piece to print, a node with n children has n + 1 pieces
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{flat.root, 0}};
+  std::string result;
+  while (!stack.empty()) {
+    uint32_t node = stack.back().first;
+    uint32_t i = stack.back().second++;
+    result += flatExpressionPiece(flat, node, i);
+    if (i < flat.childCount[node])
+      stack.push_back({flat.child(node, i), 0});
+    else
+      stack.pop_back();
+  }
+  return result;
+}
+
+void ExpressionAST::releaseChildren() {
+  std::vector<std::unique_ptr<ExpressionAST>> pending;
+  takeChildren(pending);
+  while (!pending.empty()) {
+    // children are moved out before `expression` dies, so its own
+    // destructor finds nothing left to release
+    std::unique_ptr<ExpressionAST> expression = std::move(pending.back());
+    pending.pop_back();
+    expression->takeChildren(pending);
+  }
+}
+
+template <typename T>
+static void takeChild(std::unique_ptr<T> &child,
+                      std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  if (child != nullptr)
+    children.push_back(std::move(child));
+}
+
+template <typename T>
+static void
+takeChildren(std::vector<std::unique_ptr<T>> &expressions,
+             std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  for (auto &expression : expressions)
+    takeChild(expression, children);
+  expressions.clear();
+}
+
+void ConditionalExpressionAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(condition, children);
+  takeChild(then, children);
+  takeChild(else_, children);
+}
+
+void BinaryExpressionAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(LHS, children);
+  takeChild(RHS, children);
+}
+
+void PrefixExpressionAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(RHS, children);
+}
+
+void PostfixExpressionAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(LHS, children);
+}
+
+void SequenceExpressionAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  ::takeChildren(expressions, children);
+}
+
+void ExprListAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  ::takeChildren(expressions, children);
+}
+
+void FunctionCallAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(args, children);
+}
+
+void TypeConstructorAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(args, children);
+}
+
+void VariableIndexExprAST::takeChildren(
+    std::vector<std::unique_ptr<ExpressionAST>> &children) {
+  takeChild(index, children);
+}
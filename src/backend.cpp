@@ -0,0 +1,144 @@
+#include "backend.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+#include <memory>
+#include <vector>
+
+static std::unique_ptr<TargetMachine> createHostTargetMachine() {
+  std::string triple = sys::getDefaultTargetTriple();
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    printf("Error: %s\n", error.c_str());
+    return nullptr;
+  }
+  // position independent, the object may end up in a shared library
+  return std::unique_ptr<TargetMachine>(
+      target->createTargetMachine(triple, sys::getHostCPUName(), "",
+                                  TargetOptions(), Reloc::PIC_));
+}
+
+void optimizeModule(Module &module, TargetMachine &machine) {
+  LoopAnalysisManager loops;
+  FunctionAnalysisManager functions;
+  CGSCCAnalysisManager sccs;
+  ModuleAnalysisManager modules;
+  PassBuilder builder(&machine);
+  builder.registerModuleAnalyses(modules);
+  builder.registerCGSCCAnalyses(sccs);
+  builder.registerFunctionAnalyses(functions);
+  builder.registerLoopAnalyses(loops);
+  builder.crossRegisterProxies(loops, functions, sccs, modules);
+  ModulePassManager passes =
+      builder.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+  passes.run(module, modules);
+}
+
+bool runProgram(StringRef name, ArrayRef<StringRef> args) {
+  ErrorOr<std::string> program = sys::findProgramByName(name);
+  if (!program) {
+    printf("Error: cannot find %s\n", name.str().c_str());
+    return false;
+  }
+  std::string error;
+  if (sys::ExecuteAndWait(*program, args, {}, {}, 0, 0, &error) != 0) {
+    printf("Error: %s failed %s\n", name.str().c_str(), error.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool emitObjectFile(Module &module, const std::string &path, unsigned jobs,
+                    OptimizedHook optimized) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  std::unique_ptr<TargetMachine> machine = createHostTargetMachine();
+  if (!machine)
+    return false;
+  module.setTargetTriple(machine->getTargetTriple().str());
+  module.setDataLayout(machine->createDataLayout());
+  optimizeModule(module, *machine);
+  if (optimized)
+    optimized(module);
+
+  if (jobs <= 1) {
+    std::error_code error;
+    raw_fd_ostream os(path, error, sys::fs::OF_None);
+    if (error) {
+      printf("Error: cannot write %s: %s\n", path.c_str(),
+             error.message().c_str());
+      return false;
+    }
+    raw_pwrite_stream *streams[] = {&os};
+    splitCodeGen(module, streams, {}, createHostTargetMachine);
+    os.close();
+    if (os.has_error()) {
+      printf("Error: cannot write %s: %s\n", path.c_str(),
+             os.error().message().c_str());
+      os.clear_error();
+      return false;
+    }
+    return true;
+  }
+
+  // one temporary object per part, joined into a relocatable one by ld
+  std::vector<SmallString<128>> parts(jobs);
+  std::vector<std::unique_ptr<raw_fd_ostream>> files;
+  std::vector<raw_pwrite_stream *> streams;
+  for (SmallString<128> &part : parts) {
+    int fd;
+    if (sys::fs::createTemporaryFile("glsl", "o", fd, part)) {
+      printf("Error: cannot create a temporary object\n");
+      return false;
+    }
+    files.push_back(std::make_unique<raw_fd_ostream>(fd, true));
+    streams.push_back(files.back().get());
+  }
+  splitCodeGen(module, streams, {}, createHostTargetMachine);
+  bool written = true;
+  for (size_t i = 0; i < files.size(); i++) {
+    files[i]->close();
+    if (files[i]->has_error()) {
+      printf("Error: cannot write %s: %s\n", parts[i].c_str(),
+             files[i]->error().message().c_str());
+      files[i]->clear_error();
+      written = false;
+    }
+  }
+  files.clear();
+
+  // the split makes what the parts share hidden globals. They are local
+  // again afterwards, like with one job, so that objects of several
+  // shaders still link into one library
+  std::vector<StringRef> args = {"ld", "-r", "-o", path};
+  for (SmallString<128> &part : parts)
+    args.push_back(part);
+  bool linked = written && runProgram("ld", args) &&
+                runProgram("objcopy", {"objcopy", "--localize-hidden", path});
+  for (SmallString<128> &part : parts)
+    sys::fs::remove(part);
+  return linked;
+}
+
+bool emitSharedLibrary(Module &module, const std::string &path,
+                       unsigned jobs, OptimizedHook optimized) {
+  SmallString<128> object;
+  if (sys::fs::createTemporaryFile("glsl", "o", object)) {
+    printf("Error: cannot create a temporary object\n");
+    return false;
+  }
+  bool linked = emitObjectFile(module, object.str().str(), jobs, optimized) &&
+                runProgram("cc", {"cc", "-shared", "-o", path, object, "-lm"});
+  sys::fs::remove(object);
+  return linked;
+}
@@ -0,0 +1,466 @@
+#include "builtins.h"
+#include "matrix.h"
+#include "type_table.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+extern thread_local std::unique_ptr<Module> TheModule;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
+
+namespace {
+enum BuiltinResult {
+  result_common, // the common type of the arguments
+  result_scalar, // one lane of the common type
+  result_matrix, // takes one matrix, see emitMatrixBuiltin
+};
+
+struct Builtin {
+  const char *name;
+  unsigned minArgs;
+  unsigned maxArgs;
+  BuiltinResult result;
+  bool integer; // has genIType overloads, otherwise ints become floats
+  // arguments are already converted to the common type
+  Value *(*emit)(ArrayRef<Value *> args);
+  // the genUType overloads, without them uints become floats
+  Value *(*emitUnsigned)(ArrayRef<Value *> args) = nullptr;
+};
+} // namespace
+
+static bool isInteger(Value *value) {
+  return value->getType()->isIntOrIntVectorTy();
+}
+
+static Value *constant(Value *like, double value) {
+  return ConstantFP::get(like->getType(), value);
+}
+
+template <Intrinsic::ID id> static Value *emitUnary(ArrayRef<Value *> args) {
+  return Builder->CreateUnaryIntrinsic(id, args[0]);
+}
+
+template <Intrinsic::ID id> static Value *emitBinary(ArrayRef<Value *> args) {
+  return Builder->CreateBinaryIntrinsic(id, args[0], args[1]);
+}
+
+// functions without an intrinsic go to the C library one lane at a time
+static Value *emitLibmCall(const char *name, ArrayRef<Value *> args) {
+  Type *type = args[0]->getType();
+  Type *scalarType = type->getScalarType();
+  std::string callee = name;
+  if (scalarType->isFloatTy())
+    callee += "f";
+  SmallVector<Type *, 2> params(args.size(), scalarType);
+  FunctionCallee function = TheModule->getOrInsertFunction(
+      callee, FunctionType::get(scalarType, params, false));
+  auto *vecType = dyn_cast<FixedVectorType>(type);
+  if (!vecType)
+    return Builder->CreateCall(function, args);
+  Value *result = PoisonValue::get(type);
+  for (unsigned lane = 0; lane < vecType->getNumElements(); lane++) {
+    SmallVector<Value *, 2> laneArgs;
+    for (Value *arg : args)
+      laneArgs.push_back(Builder->CreateExtractElement(arg, lane));
+    result = Builder->CreateInsertElement(
+        result, Builder->CreateCall(function, laneArgs), lane);
+  }
+  return result;
+}
+
+Value *emitMulAdd(Value *a, Value *b, Value *c) {
+  if (!Builder->getFastMathFlags().allowContract())
+    return Builder->CreateFAdd(Builder->CreateFMul(a, b), c);
+  return Builder->CreateIntrinsic(Intrinsic::fmuladd, {a->getType()},
+                                  {a, b, c});
+}
+
+// sum of the products of the lanes. In lane order unless reassociation is
+// allowed, then as one vector multiply and a reduction
+static Value *emitDotProduct(Value *left, Value *right) {
+  auto *vecType = dyn_cast<FixedVectorType>(left->getType());
+  if (!vecType)
+    return Builder->CreateFMul(left, right);
+  if (Builder->getFastMathFlags().allowReassoc())
+    return Builder->CreateFAddReduce(
+        ConstantFP::getNegativeZero(vecType->getElementType()),
+        Builder->CreateFMul(left, right));
+  Value *result = nullptr;
+  for (unsigned lane = 0; lane < vecType->getNumElements(); lane++) {
+    Value *leftLane = Builder->CreateExtractElement(left, lane);
+    Value *rightLane = Builder->CreateExtractElement(right, lane);
+    if (!result)
+      result = Builder->CreateFMul(leftLane, rightLane);
+    else
+      result = emitMulAdd(leftLane, rightLane, result);
+  }
+  return result;
+}
+
+// `scalar` in every lane of a value shaped like `like`
+static Value *splatLike(Value *scalar, Value *like) {
+  if (auto *vecType = dyn_cast<FixedVectorType>(like->getType()))
+    return Builder->CreateVectorSplat(vecType->getNumElements(), scalar);
+  return scalar;
+}
+
+static Value *emitRadians(ArrayRef<Value *> args) {
+  return Builder->CreateFMul(args[0], constant(args[0], M_PI / 180.0));
+}
+
+static Value *emitDegrees(ArrayRef<Value *> args) {
+  return Builder->CreateFMul(args[0], constant(args[0], 180.0 / M_PI));
+}
+
+static Value *emitTan(ArrayRef<Value *> args) {
+  return Builder->CreateFDiv(
+      Builder->CreateUnaryIntrinsic(Intrinsic::sin, args[0]),
+      Builder->CreateUnaryIntrinsic(Intrinsic::cos, args[0]));
+}
+
+static Value *emitAsin(ArrayRef<Value *> args) {
+  return emitLibmCall("asin", args);
+}
+
+static Value *emitAcos(ArrayRef<Value *> args) {
+  return emitLibmCall("acos", args);
+}
+
+// atan(y_over_x) and atan(y, x)
+static Value *emitAtan(ArrayRef<Value *> args) {
+  return emitLibmCall(args.size() == 1 ? "atan" : "atan2", args);
+}
+
+// with afn and arcp the backend may turn this into a reciprocal square
+// root estimate
+static Value *emitInverseSqrt(ArrayRef<Value *> args) {
+  return Builder->CreateFDiv(
+      constant(args[0], 1.0),
+      Builder->CreateUnaryIntrinsic(Intrinsic::sqrt, args[0]));
+}
+
+static Value *emitAbs(ArrayRef<Value *> args) {
+  if (isInteger(args[0]))
+    return Builder->CreateBinaryIntrinsic(Intrinsic::abs, args[0],
+                                          Builder->getFalse());
+  return Builder->CreateUnaryIntrinsic(Intrinsic::fabs, args[0]);
+}
+
+static Value *emitSign(ArrayRef<Value *> args) {
+  Value *x = args[0];
+  if (isInteger(x)) {
+    Value *clamped = Builder->CreateBinaryIntrinsic(
+        Intrinsic::smin, x, ConstantInt::get(x->getType(), 1));
+    return Builder->CreateBinaryIntrinsic(
+        Intrinsic::smax, clamped, ConstantInt::getSigned(x->getType(), -1));
+  }
+  Value *negative = Builder->CreateSelect(
+      Builder->CreateFCmpOLT(x, constant(x, 0.0)), constant(x, -1.0),
+      constant(x, 0.0));
+  return Builder->CreateSelect(Builder->CreateFCmpOGT(x, constant(x, 0.0)),
+                               constant(x, 1.0), negative);
+}
+
+static Value *emitFract(ArrayRef<Value *> args) {
+  return Builder->CreateFSub(
+      args[0], Builder->CreateUnaryIntrinsic(Intrinsic::floor, args[0]));
+}
+
+// x - y * floor(x / y)
+static Value *emitMod(ArrayRef<Value *> args) {
+  Value *quotient = Builder->CreateUnaryIntrinsic(
+      Intrinsic::floor, Builder->CreateFDiv(args[0], args[1]));
+  return Builder->CreateFSub(args[0], Builder->CreateFMul(args[1], quotient));
+}
+
+static Value *emitMin(ArrayRef<Value *> args) {
+  return Builder->CreateBinaryIntrinsic(
+      isInteger(args[0]) ? Intrinsic::smin : Intrinsic::minnum, args[0],
+      args[1]);
+}
+
+static Value *emitMax(ArrayRef<Value *> args) {
+  return Builder->CreateBinaryIntrinsic(
+      isInteger(args[0]) ? Intrinsic::smax : Intrinsic::maxnum, args[0],
+      args[1]);
+}
+
+static Value *emitClamp(ArrayRef<Value *> args) {
+  return emitMin({emitMax({args[0], args[1]}), args[2]});
+}
+
+static Value *emitUnsignedClamp(ArrayRef<Value *> args) {
+  Value *clamped = Builder->CreateBinaryIntrinsic(Intrinsic::umax, args[0],
+                                                  args[1]);
+  return Builder->CreateBinaryIntrinsic(Intrinsic::umin, clamped, args[2]);
+}
+
+// x + (y - x) * a
+static Value *emitMix(ArrayRef<Value *> args) {
+  Value *difference = Builder->CreateFSub(args[1], args[0]);
+  return emitMulAdd(difference, args[2], args[0]);
+}
+
+static Value *emitStep(ArrayRef<Value *> args) {
+  Value *below = Builder->CreateFCmpOLT(args[1], args[0]);
+  return Builder->CreateSelect(below, constant(args[0], 0.0),
+                               constant(args[0], 1.0));
+}
+
+// t * t * (3 - 2 * t) with t = clamp((x - edge0) / (edge1 - edge0), 0, 1)
+static Value *emitSmoothstep(ArrayRef<Value *> args) {
+  Value *t = Builder->CreateFDiv(Builder->CreateFSub(args[2], args[0]),
+                                 Builder->CreateFSub(args[1], args[0]));
+  t = emitClamp({t, constant(t, 0.0), constant(t, 1.0)});
+  Value *ramp = Builder->CreateFSub(
+      constant(t, 3.0), Builder->CreateFMul(constant(t, 2.0), t));
+  return Builder->CreateFMul(Builder->CreateFMul(t, t), ramp);
+}
+
+static Value *emitFma(ArrayRef<Value *> args) {
+  return Builder->CreateIntrinsic(Intrinsic::fma, {args[0]->getType()}, args);
+}
+
+static Value *emitDot(ArrayRef<Value *> args) {
+  return emitDotProduct(args[0], args[1]);
+}
+
+static Value *emitLength(ArrayRef<Value *> args) {
+  if (!args[0]->getType()->isVectorTy())
+    return Builder->CreateUnaryIntrinsic(Intrinsic::fabs, args[0]);
+  return Builder->CreateUnaryIntrinsic(Intrinsic::sqrt,
+                                       emitDotProduct(args[0], args[0]));
+}
+
+static Value *emitDistance(ArrayRef<Value *> args) {
+  return emitLength({Builder->CreateFSub(args[0], args[1])});
+}
+
+// x * (1 / length(x)), one division for all lanes
+static Value *emitNormalize(ArrayRef<Value *> args) {
+  Value *length = emitLength(args);
+  Value *scale = Builder->CreateFDiv(constant(length, 1.0), length);
+  return Builder->CreateFMul(args[0], splatLike(scale, args[0]));
+}
+
+// a.yzx * b.zxy - a.zxy * b.yzx
+static Value *emitCross(ArrayRef<Value *> args) {
+  const int yzx[] = {1, 2, 0};
+  const int zxy[] = {2, 0, 1};
+  Value *left = Builder->CreateFMul(
+      Builder->CreateShuffleVector(args[0], yzx),
+      Builder->CreateShuffleVector(args[1], zxy));
+  Value *right = Builder->CreateFMul(
+      Builder->CreateShuffleVector(args[0], zxy),
+      Builder->CreateShuffleVector(args[1], yzx));
+  return Builder->CreateFSub(left, right);
+}
+
+// dot(nref, i) < 0 ? n : -n
+static Value *emitFaceforward(ArrayRef<Value *> args) {
+  Value *d = emitDotProduct(args[2], args[1]);
+  return Builder->CreateSelect(Builder->CreateFCmpOLT(d, constant(d, 0.0)),
+                               args[0], Builder->CreateFNeg(args[0]));
+}
+
+// i - 2 * dot(n, i) * n
+static Value *emitReflect(ArrayRef<Value *> args) {
+  Value *d = emitDotProduct(args[1], args[0]);
+  Value *scale = splatLike(Builder->CreateFMul(constant(d, 2.0), d), args[0]);
+  return Builder->CreateFSub(args[0], Builder->CreateFMul(scale, args[1]));
+}
+
+// k = 1 - eta * eta * (1 - dot(n, i) * dot(n, i)), zero when k < 0 and
+// eta * i - (eta * dot(n, i) + sqrt(k)) * n otherwise
+static Value *emitRefract(ArrayRef<Value *> args) {
+  Value *d = emitDotProduct(args[1], args[0]);
+  Value *eta = args[2];
+  if (eta->getType()->isVectorTy())
+    eta = Builder->CreateExtractElement(eta, (uint64_t)0);
+  Value *k = Builder->CreateFSub(
+      constant(d, 1.0),
+      Builder->CreateFMul(
+          Builder->CreateFMul(eta, eta),
+          Builder->CreateFSub(constant(d, 1.0), Builder->CreateFMul(d, d))));
+  Value *scale = Builder->CreateFAdd(
+      Builder->CreateFMul(eta, d),
+      Builder->CreateUnaryIntrinsic(Intrinsic::sqrt, k));
+  Value *refracted = Builder->CreateFSub(
+      Builder->CreateFMul(splatLike(eta, args[0]), args[0]),
+      Builder->CreateFMul(splatLike(scale, args[0]), args[1]));
+  return Builder->CreateSelect(Builder->CreateFCmpOLT(k, constant(k, 0.0)),
+                               constant(args[0], 0.0), refracted);
+}
+
+static Value *emitMatrixCompMult(ArrayRef<Value *> args) {
+  return Builder->CreateFMul(args[0], args[1]);
+}
+
+static const Builtin builtins[] = {
+    // angle and trigonometry
+    {"radians", 1, 1, result_common, false, emitRadians},
+    {"degrees", 1, 1, result_common, false, emitDegrees},
+    {"sin", 1, 1, result_common, false, emitUnary<Intrinsic::sin>},
+    {"cos", 1, 1, result_common, false, emitUnary<Intrinsic::cos>},
+    {"tan", 1, 1, result_common, false, emitTan},
+    {"asin", 1, 1, result_common, false, emitAsin},
+    {"acos", 1, 1, result_common, false, emitAcos},
+    {"atan", 1, 2, result_common, false, emitAtan},
+    // exponential
+    {"pow", 2, 2, result_common, false, emitBinary<Intrinsic::pow>},
+    {"exp", 1, 1, result_common, false, emitUnary<Intrinsic::exp>},
+    {"log", 1, 1, result_common, false, emitUnary<Intrinsic::log>},
+    {"exp2", 1, 1, result_common, false, emitUnary<Intrinsic::exp2>},
+    {"log2", 1, 1, result_common, false, emitUnary<Intrinsic::log2>},
+    {"sqrt", 1, 1, result_common, false, emitUnary<Intrinsic::sqrt>},
+    {"inversesqrt", 1, 1, result_common, false, emitInverseSqrt},
+    // common
+    {"abs", 1, 1, result_common, true, emitAbs},
+    {"sign", 1, 1, result_common, true, emitSign},
+    {"floor", 1, 1, result_common, false, emitUnary<Intrinsic::floor>},
+    {"ceil", 1, 1, result_common, false, emitUnary<Intrinsic::ceil>},
+    {"trunc", 1, 1, result_common, false, emitUnary<Intrinsic::trunc>},
+    {"round", 1, 1, result_common, false, emitUnary<Intrinsic::round>},
+    {"fract", 1, 1, result_common, false, emitFract},
+    {"mod", 2, 2, result_common, false, emitMod},
+    {"min", 2, 2, result_common, true, emitMin,
+     emitBinary<Intrinsic::umin>},
+    {"max", 2, 2, result_common, true, emitMax,
+     emitBinary<Intrinsic::umax>},
+    {"clamp", 3, 3, result_common, true, emitClamp, emitUnsignedClamp},
+    {"mix", 3, 3, result_common, false, emitMix},
+    {"step", 2, 2, result_common, false, emitStep},
+    {"smoothstep", 3, 3, result_common, false, emitSmoothstep},
+    {"fma", 3, 3, result_common, false, emitFma},
+    // geometric
+    {"length", 1, 1, result_scalar, false, emitLength},
+    {"distance", 2, 2, result_scalar, false, emitDistance},
+    {"dot", 2, 2, result_scalar, false, emitDot},
+    {"cross", 2, 2, result_common, false, emitCross},
+    {"normalize", 1, 1, result_common, false, emitNormalize},
+    {"faceforward", 3, 3, result_common, false, emitFaceforward},
+    {"reflect", 2, 2, result_common, false, emitReflect},
+    {"refract", 3, 3, result_common, false, emitRefract},
+    // matrix
+    {"matrixCompMult", 2, 2, result_matrix, false, emitMatrixCompMult},
+    {"transpose", 1, 1, result_matrix, false, nullptr},
+    {"determinant", 1, 1, result_matrix, false, nullptr},
+    {"inverse", 1, 1, result_matrix, false, nullptr},
+};
+
+static const Builtin *findBuiltin(const std::string &name) {
+  for (const Builtin &builtin : builtins) {
+    if (name == builtin.name)
+      return &builtin;
+  }
+  return nullptr;
+}
+
+bool isBuiltinFunction(const std::string &name) {
+  return findBuiltin(name) != nullptr;
+}
+
+// the element kind and width every argument is converted to, the widest
+// of bool, int, uint, float and double among them. Ints and bools only
+// stay integers for functions with genIType overloads, uints for those
+// with genUType ones
+static bool getCommonType(const Builtin &builtin, ArrayRef<AstType> argTypes,
+                          ScalarKind &scalar, unsigned &lanes) {
+  scalar = scalar_bool;
+  lanes = 1;
+  for (AstType type : argTypes) {
+    const AstTypeInfo &info = getAstTypeInfo(type);
+    if (info.scalar == scalar_void || info.isMatrix())
+      return false;
+    scalar = std::max(scalar, info.scalar);
+    if (lanes != 1 && info.rows != 1 && info.rows != lanes)
+      return false;
+    lanes = std::max(lanes, info.rows);
+  }
+  if (scalar == scalar_bool)
+    scalar = scalar_int;
+  if ((scalar == scalar_int && !builtin.integer) ||
+      (scalar == scalar_uint && !builtin.emitUnsigned))
+    scalar = scalar_float;
+  return true;
+}
+
+// `value`, of `fromScalar` lanes, with `elementType` lanes. A scalar is
+// splat to `lanes`. uints and bools are zero extended, true is 1
+static Value *convertArg(Value *value, ScalarKind fromScalar,
+                         Type *elementType, unsigned lanes) {
+  Type *from = value->getType()->getScalarType();
+  Type *to = elementType;
+  if (auto *vecType = dyn_cast<FixedVectorType>(value->getType()))
+    to = FixedVectorType::get(elementType, vecType->getNumElements());
+  bool isSigned = fromScalar == scalar_int;
+  if (from->isIntegerTy() && elementType->isFloatingPointTy())
+    value = isSigned ? Builder->CreateSIToFP(value, to, "intcast")
+                     : Builder->CreateUIToFP(value, to, "intcast");
+  else if (from->isFloatingPointTy() && elementType->isFloatingPointTy())
+    value = Builder->CreateFPCast(value, to, "fpcast");
+  else if (from->isIntegerTy() && elementType->isIntegerTy())
+    value = Builder->CreateIntCast(value, to, isSigned, "intcast");
+  if (lanes > 1 && !value->getType()->isVectorTy())
+    value = Builder->CreateVectorSplat(lanes, value);
+  return value;
+}
+
+static Value *emitMatrixBuiltin(const Builtin &builtin, ArrayRef<Value *> args,
+                                ArrayRef<AstType> argTypes,
+                                AstType &resultType) {
+  for (AstType type : argTypes) {
+    if (type != argTypes[0] || !getAstTypeInfo(type).isMatrix())
+      return nullptr;
+  }
+  resultType = argTypes[0];
+  if (builtin.emit)
+    return builtin.emit(args);
+  if (!strcmp(builtin.name, "transpose"))
+    return emitTranspose(args[0], argTypes[0]); // every matrix is square
+  if (!strcmp(builtin.name, "inverse"))
+    return emitInverse(args[0], argTypes[0]);
+  resultType = getVectorAstType(getAstTypeInfo(argTypes[0]).scalar, 1);
+  return emitDeterminant(args[0], argTypes[0]);
+}
+
+Value *emitBuiltinCall(const std::string &name, ArrayRef<Value *> args,
+                       ArrayRef<AstType> argTypes, AstType &resultType) {
+  resultType = type_error;
+  const Builtin *builtin = findBuiltin(name);
+  if (!builtin)
+    return nullptr;
+  if (args.size() < builtin->minArgs || args.size() > builtin->maxArgs) {
+    printf("Error: wrong number of arguments to %s\n", name.c_str());
+    return nullptr;
+  }
+  if (builtin->result == result_matrix) {
+    Value *result = emitMatrixBuiltin(*builtin, args, argTypes, resultType);
+    if (!result)
+      printf("Error: no matching overload of %s\n", name.c_str());
+    return result;
+  }
+
+  ScalarKind scalar;
+  unsigned lanes;
+  if (!getCommonType(*builtin, argTypes, scalar, lanes) ||
+      (builtin->emit == emitCross && lanes != 3)) {
+    printf("Error: no matching overload of %s\n", name.c_str());
+    return nullptr;
+  }
+  Type *elementType = TheTypes->getVectorType(scalar, 1);
+  SmallVector<Value *, 3> converted;
+  for (size_t i = 0; i < args.size(); i++)
+    converted.push_back(convertArg(
+        args[i], getAstTypeInfo(argTypes[i]).scalar, elementType, lanes));
+  resultType = getVectorAstType(
+      scalar, builtin->result == result_scalar ? 1 : lanes);
+  if (scalar == scalar_uint)
+    return builtin->emitUnsigned(converted);
+  return builtin->emit(converted);
+}
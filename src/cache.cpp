@@ -0,0 +1,162 @@
+#include "cache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA256.h"
+
+#include <chrono>
+
+// bump when the compiler emits different code for the same input
+static const char *cacheVersion = "GLSLParser 1, LLVM " LLVM_VERSION_STRING;
+
+// pruneCache only looks at files with this prefix
+static const char *entryPrefix = "llvmcache-";
+
+// entries start with one of these, compressed ones with the size after it
+static const char rawMagic = 'R';
+static const char zlibMagic = 'Z';
+
+std::string computeCacheKey(StringRef source, ArrayRef<std::string> options) {
+  std::string text;
+  text += cacheVersion;
+  text += '\0';
+  // the backend compiles for this triple and cpu
+  text += sys::getDefaultTargetTriple();
+  text += '\0';
+  text += sys::getHostCPUName();
+  text += '\0';
+  for (const std::string &option : options) {
+    text += option;
+    text += '\0';
+  }
+  while (!source.empty()) {
+    StringRef line;
+    std::tie(line, source) = source.split('\n');
+    text += line.rtrim(" \t\r");
+    text += '\n';
+  }
+  return toHex(SHA256::hash(arrayRefFromStringRef(text)), true);
+}
+
+CompileCache::CompileCache(std::string directory, uint64_t maxBytes,
+                           bool compress)
+    : directory(std::move(directory)), maxBytes(maxBytes),
+      compress(compress && compression::zlib::isAvailable()) {
+  sys::fs::create_directories(this->directory);
+}
+
+std::string CompileCache::getPath(StringRef key) const {
+  SmallString<128> path(directory);
+  sys::path::append(path, entryPrefix + key);
+  return std::string(path.str());
+}
+
+std::unique_ptr<MemoryBuffer> CompileCache::lookup(StringRef key) {
+  std::string path = getPath(key);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> entry = MemoryBuffer::getFile(path);
+  std::unique_ptr<MemoryBuffer> result;
+  if (entry && (*entry)->getBufferSize() > 0) {
+    StringRef data = (*entry)->getBuffer();
+    if (data[0] == rawMagic) {
+      result = MemoryBuffer::getMemBufferCopy(data.drop_front(), path);
+    } else if (data[0] == zlibMagic && data.size() > 9) {
+      size_t size = support::endian::read64le(data.data() + 1);
+      SmallVector<uint8_t, 0> output;
+      if (!errorToBool(compression::zlib::decompress(
+              arrayRefFromStringRef(data.drop_front(9)), output, size)))
+        result = MemoryBuffer::getMemBufferCopy(toStringRef(output), path);
+    }
+  }
+  if (!result)
+    return nullptr;
+  // pruning goes by access time, which the file system may not keep
+  int fd;
+  if (!sys::fs::openFileForRead(path, fd)) {
+    sys::fs::setLastAccessAndModificationTime(
+        fd, std::chrono::system_clock::now());
+    sys::Process::SafelyCloseFileDescriptor(fd);
+  }
+  return result;
+}
+
+// write `data` to `path` through a temporary file, readers see either the
+// old file or all of the new one
+static bool writeAtomically(const std::string &path, StringRef data) {
+  SmallString<128> model(sys::path::parent_path(path));
+  sys::path::append(model, "tmp-%%%%%%");
+  Expected<sys::fs::TempFile> temp = sys::fs::TempFile::create(model);
+  if (!temp) {
+    consumeError(temp.takeError());
+    return false;
+  }
+  raw_fd_ostream os(temp->FD, false);
+  os << data;
+  // the file descriptor belongs to `temp`. A full or read-only disk must
+  // not abort the compile or leave a short entry behind
+  os.flush();
+  if (os.has_error()) {
+    os.clear_error();
+    consumeError(temp->discard());
+    return false;
+  }
+  if (Error error = temp->keep(path)) {
+    consumeError(std::move(error));
+    consumeError(temp->discard());
+    return false;
+  }
+  return true;
+}
+
+void CompileCache::store(StringRef key, StringRef data) {
+  std::string entry;
+  if (compress) {
+    SmallVector<uint8_t, 0> compressed;
+    compression::zlib::compress(arrayRefFromStringRef(data), compressed);
+    entry.resize(9);
+    entry[0] = zlibMagic;
+    support::endian::write64le(&entry[1], data.size());
+    entry += toStringRef(compressed);
+  } else {
+    entry = rawMagic;
+    entry += data;
+  }
+  if (!writeAtomically(getPath(key), entry))
+    return;
+
+  CachePruningPolicy policy;
+  policy.Interval = std::chrono::seconds(0);
+  policy.Expiration = std::chrono::seconds(0);
+  policy.MaxSizeBytes = maxBytes;
+  pruneCache(directory, policy);
+}
+
+void CompileCache::recordStatistics(bool hit, bool print) {
+  SmallString<128> path(directory);
+  sys::path::append(path, "statistics");
+  uint64_t totalHits = hit;
+  uint64_t totalMisses = !hit;
+  if (ErrorOr<std::unique_ptr<MemoryBuffer>> previous =
+          MemoryBuffer::getFile(path)) {
+    SmallVector<StringRef, 2> counts;
+    (*previous)->getBuffer().trim().split(counts, ' ');
+    uint64_t count;
+    if (counts.size() == 2 && !counts[0].getAsInteger(10, count))
+      totalHits += count;
+    if (counts.size() == 2 && !counts[1].getAsInteger(10, count))
+      totalMisses += count;
+  }
+  writeAtomically(std::string(path.str()),
+                  std::to_string(totalHits) + " " +
+                      std::to_string(totalMisses) + "\n");
+  if (print)
+    printf("\ncache: %u hits, %u misses, %llu hits and %llu misses in total\n",
+           (unsigned)hit, (unsigned)!hit, (unsigned long long)totalHits,
+           (unsigned long long)totalMisses);
+}
@@ -0,0 +1,246 @@
+#include "document.h"
+#include "parser.h"
+#include "llvm/ADT/Hashing.h"
+
+#include <algorithm>
+#include <iterator>
+
+extern std::vector<Token> tokens;
+extern uint64_t index_temp;
+
+// one past the last token of the definition starting at `begin`, the `;`
+// ending a global or the `}` closing a function body
+static uint32_t findDefinitionEnd(uint32_t begin) {
+  int depth = 0;
+  uint32_t i = begin;
+  for (; i < tokens.size() && tokens[i].type != tok_eof; i++) {
+    if (tokens[i].type == tok_left_brace) {
+      depth++;
+    } else if (tokens[i].type == tok_right_brace) {
+      if (--depth <= 0)
+        return i + 1;
+    } else if (tokens[i].type == tok_semicolon && depth == 0) {
+      return i + 1;
+    }
+  }
+  return i;
+}
+
+static uint64_t hashTokens(uint32_t begin, uint32_t end) {
+  hash_code hash = hash_value(0);
+  for (uint32_t i = begin; i < end; i++)
+    hash = hash_combine(hash, tokens[i].type, StringRef(*tokens[i].value));
+  return hash;
+}
+
+Document::Document(std::string text) : text(std::move(text)) {
+  setInputText(this->text.data(), this->text.data() + this->text.size(), 0);
+  while (lexToken(lexed))
+    ;
+  DocumentChange change;
+  parseAll(change);
+}
+
+void Document::parseAll(DocumentChange &change) {
+  // the definitions need not have changed with the version, their asts
+  // are kept like those of any other edit
+  size_t removed = 0;
+  if (program) {
+    auto &definitions = program->getDefinitions();
+    removed = definitions.size() - 1;
+    for (size_t i = 1; i < definitions.size(); i++) {
+      if (definitions[i])
+        retired[hashes[i]] = std::move(definitions[i]);
+    }
+  }
+  // the parser reads the global tokens. A version still being typed has
+  // no number yet, which ParseVersion cannot take
+  std::swap(tokens, lexed);
+  index_temp = 0;
+  version = -1;
+  if (tokens.size() > 1 && tokens[0].type == tok_version &&
+      tokens[1].type == tok_number)
+    version = ParseVersion();
+  definitionsBegin = version == -1 ? 0 : index_temp;
+  std::swap(tokens, lexed);
+
+  auto definitions =
+      std::make_unique<std::vector<std::unique_ptr<DefinitionAST>>>();
+  definitions->push_back(std::make_unique<GlobalVariableDefinitionAST>(
+      type_vec4, false, "gl_Position", nullptr, nullptr));
+  program = std::make_unique<TopLevelAST>(version, std::move(definitions));
+  spans.assign(1, {0, 0});
+  hashes.assign(1, 0);
+  reparse(1, definitionsBegin, lexed.size(), lexed.size(), 0, change);
+  change.removed = removed;
+}
+
+// split the tokens into definitions again from `begin`, which starts
+// definition `first`, until a definition starts where an old one past the
+// damage did. The old tokens from `reusable` on are unchanged and moved by
+// `tokenShift`, the new ones up to `damageEnd` were lexed again
+void Document::reparse(size_t first, uint32_t begin, uint32_t damageEnd,
+                       uint32_t reusable, int64_t tokenShift,
+                       DocumentChange &change) {
+  std::swap(tokens, lexed);
+  std::vector<std::pair<uint32_t, uint32_t>> newSpans;
+  size_t last = first;
+  bool linedUp = false;
+  while (begin < tokens.size() && tokens[begin].type != tok_eof) {
+    if (begin >= damageEnd) {
+      while (last < spans.size() &&
+             (spans[last].first < reusable ||
+              spans[last].first + tokenShift < begin))
+        last++;
+      if (last < spans.size() && spans[last].first + tokenShift == begin) {
+        linedUp = true;
+        break;
+      }
+    }
+    uint32_t end = findDefinitionEnd(begin);
+    newSpans.push_back({begin, end});
+    begin = end;
+  }
+  if (!linedUp)
+    last = spans.size();
+
+  // a definition whose tokens were dropped before or only moved keeps its
+  // ast, the others are parsed. One running into the end of the tokens is
+  // cut short and cannot parse
+  auto &definitions = program->getDefinitions();
+  for (size_t i = first; i < last; i++) {
+    if (definitions[i])
+      retired[hashes[i]] = std::move(definitions[i]);
+  }
+  std::vector<std::unique_ptr<DefinitionAST>> parsed;
+  std::vector<uint64_t> newHashes;
+  for (auto &span : newSpans) {
+    uint64_t hash = hashTokens(span.first, span.second);
+    std::unique_ptr<DefinitionAST> definition;
+    auto found = retired.find(hash);
+    if (found != retired.end()) {
+      definition = std::move(found->second);
+      retired.erase(found);
+    } else if (span.second < tokens.size()) {
+      index_temp = span.first;
+      definition = ParseDefinition();
+      if (index_temp != span.second)
+        definition = nullptr;
+      change.parsed++;
+    }
+    parsed.push_back(std::move(definition));
+    newHashes.push_back(hash);
+  }
+  std::swap(tokens, lexed);
+
+  for (size_t i = last; i < spans.size(); i++) {
+    spans[i].first += tokenShift;
+    spans[i].second += tokenShift;
+  }
+  definitions.erase(definitions.begin() + first, definitions.begin() + last);
+  definitions.insert(definitions.begin() + first,
+                     std::make_move_iterator(parsed.begin()),
+                     std::make_move_iterator(parsed.end()));
+  spans.erase(spans.begin() + first, spans.begin() + last);
+  spans.insert(spans.begin() + first, newSpans.begin(), newSpans.end());
+  hashes.erase(hashes.begin() + first, hashes.begin() + last);
+  hashes.insert(hashes.begin() + first, newHashes.begin(), newHashes.end());
+  mostDefinitions = std::max(mostDefinitions, definitions.size());
+  if (retired.size() > mostDefinitions)
+    retired.clear();
+  change.first = first;
+  change.removed = last - first;
+  change.inserted = newSpans.size();
+}
+
+DocumentChange Document::edit(const TextEdit &edit) {
+  DocumentChange change;
+  int64_t shift = (int64_t)edit.inserted.size() - edit.removed;
+  uint32_t insertedEnd = edit.offset + edit.inserted.size();
+  text.replace(edit.offset, edit.removed, edit.inserted);
+
+  // a token ending before the edit looked ahead at most at the character
+  // at its end and stays. Past the stop of a lexer that gave up on a
+  // character nothing was lexed to begin with
+  size_t first =
+      std::partition_point(lexed.begin(), lexed.end(),
+                           [&](const Token &token) {
+                             return token.offset + token.length < edit.offset;
+                           }) -
+      lexed.begin();
+  if (first == lexed.size())
+    return change;
+  uint32_t restart = first ? lexed[first - 1].offset + lexed[first - 1].length
+                           : 0;
+
+  // lex until a token past the edit starts where an old one did, from
+  // there on the text and so the tokens are the old ones
+  setInputText(text.data() + restart, text.data() + text.size(), restart);
+  std::vector<Token> relexed;
+  size_t reusable = first;
+  bool linedUp = false;
+  bool more = true;
+  while (more && !linedUp) {
+    size_t count = relexed.size();
+    more = lexToken(relexed);
+    if (relexed.size() == count || relexed.back().offset < insertedEnd)
+      continue;
+    const Token &token = relexed.back();
+    uint32_t was = token.offset - shift;
+    while (reusable < lexed.size() && lexed[reusable].offset < was)
+      reusable++;
+    if (reusable < lexed.size() && lexed[reusable].offset == was &&
+        lexed[reusable].type == token.type &&
+        *lexed[reusable].value == *token.value) {
+      relexed.pop_back();
+      linedUp = true;
+    }
+  }
+  if (!linedUp)
+    reusable = lexed.size();
+  change.relexed = relexed.size();
+
+  // splice the new tokens in, moving the tail once
+  for (size_t i = reusable; i < lexed.size(); i++)
+    lexed[i].offset += shift;
+  size_t removed = reusable - first;
+  size_t common = std::min(removed, relexed.size());
+  std::move(relexed.begin(), relexed.begin() + common, lexed.begin() + first);
+  if (relexed.size() > removed)
+    lexed.insert(lexed.begin() + first + common,
+                 std::make_move_iterator(relexed.begin() + common),
+                 std::make_move_iterator(relexed.end()));
+  else
+    lexed.erase(lexed.begin() + first + common, lexed.begin() + reusable);
+  int64_t tokenShift = (int64_t)relexed.size() - (int64_t)removed;
+
+  // the version is at most the first two tokens
+  if (first < 2) {
+    parseAll(change);
+    return change;
+  }
+  // split again from the definition ending at the first damaged token or
+  // later, the one before may have been cut short by the end of the tokens
+  size_t definition =
+      std::partition_point(spans.begin() + 1, spans.end(),
+                           [&](const std::pair<uint32_t, uint32_t> &span) {
+                             return span.second < first;
+                           }) -
+      spans.begin();
+  uint32_t begin = definition < spans.size() ? spans[definition].first
+                   : spans.size() > 1        ? spans.back().second
+                                             : definitionsBegin;
+  reparse(definition, begin, first + change.relexed, reusable, tokenShift,
+          change);
+  return change;
+}
+
+bool Document::isValid() const {
+  if (version == -1)
+    return false;
+  for (auto &definition : program->getDefinitions()) {
+    if (!definition)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,232 @@
+#include "fingerprint.h"
+#include "ast.h"
+#include "reachability.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/SHA256.h"
+
+#include <deque>
+
+using namespace ast;
+
+namespace {
+// writes definitions in canonical form, naming the private definitions they
+// reach as it goes
+class Canonicalizer {
+  const FlatAST &flat;
+  raw_string_ostream &os;
+  // every name and the source order are kept
+  bool keepNames;
+  StringMap<uint32_t> functions;
+  StringMap<uint32_t> globals;
+  // names used in the canonical form, `$` cannot start an identifier
+  StringMap<std::string> canonicalNames;
+  std::deque<uint32_t> worklist;
+  unsigned reached = 0;
+  // locals of the function being written, innermost scope last
+  std::vector<StringMap<unsigned>> scopes;
+  unsigned locals = 0;
+
+  void writeU32(uint32_t value) { os.write((const char *)&value, 4); }
+  void writeString(StringRef string) {
+    writeU32(string.size());
+    os << string;
+  }
+
+  StringRef reach(const std::string &name, uint32_t definition, char tag);
+  std::string resolveVariable(const std::string &name);
+  std::string resolveFunction(const std::string &name);
+  void enter(uint32_t node);
+  void leave(uint32_t node);
+
+public:
+  Canonicalizer(const FlatAST &flat, uint32_t top, raw_string_ostream &os,
+                bool keepNames);
+
+  // the interface, then main and what it reaches. Without main, or when
+  // names are kept, the interface and every used definition in source order
+  void writeProgram(uint32_t top);
+  void writeDefinition(uint32_t definition);
+};
+} // namespace
+
+Canonicalizer::Canonicalizer(const FlatAST &flat, uint32_t top,
+                             raw_string_ostream &os, bool keepNames)
+    : flat(flat), os(os), keepNames(keepNames) {
+  for (uint32_t i = 0; i < flat.childCount[top]; i++) {
+    uint32_t definition = flat.child(top, i);
+    if (flat.kinds[definition] == flat_function_definition)
+      functions[flat.name(definition)] = definition;
+    else if (flat.kinds[definition] == flat_global_variable_definition)
+      globals[flat.name(definition)] = definition;
+  }
+}
+
+static bool isInterface(const FlatAST &flat, uint32_t definition) {
+  return (flat.flags[definition] & flat_has_layout) ||
+         flat.name(definition) == "gl_Position";
+}
+
+StringRef Canonicalizer::reach(const std::string &name, uint32_t definition,
+                               char tag) {
+  auto inserted = canonicalNames.try_emplace(name);
+  if (inserted.second) {
+    inserted.first->second = std::string("$") + tag + std::to_string(reached++);
+    worklist.push_back(definition);
+  }
+  return inserted.first->second;
+}
+
+std::string Canonicalizer::resolveVariable(const std::string &name) {
+  if (keepNames)
+    return name;
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+    auto local = scope->find(name);
+    if (local != scope->end())
+      return "$L" + std::to_string(local->second);
+  }
+  auto global = globals.find(name);
+  if (global == globals.end() || isInterface(flat, global->second))
+    return name;
+  return reach(name, global->second, 'G').str();
+}
+
+std::string Canonicalizer::resolveFunction(const std::string &name) {
+  auto function = functions.find(name);
+  // a built-in
+  if (keepNames || function == functions.end())
+    return name;
+  return reach(name, function->second, 'F').str();
+}
+
+void Canonicalizer::enter(uint32_t node) {
+  FlatKind kind = flat.kinds[node];
+  os << (char)kind;
+  writeU32(flat.types[node]);
+  writeU32(flat.ops[node]);
+  os << (char)flat.flags[node];
+  writeU32(flat.childCount[node]);
+  switch (kind) {
+  case flat_function_definition:
+  case flat_function_prototype:
+  case flat_global_variable_definition: {
+    auto name = canonicalNames.find(flat.name(node));
+    writeString(name != canonicalNames.end() ? StringRef(name->second)
+                                             : StringRef(flat.name(node)));
+    break;
+  }
+  case flat_function_argument:
+    scopes.back()[flat.name(node)] = locals;
+    writeString(keepNames ? flat.name(node) : "$L" + std::to_string(locals));
+    locals++;
+    break;
+  case flat_variable_definition:
+    // bound once its initializer is written, which cannot declare anything
+    writeString(keepNames ? flat.name(node) : "$L" + std::to_string(locals));
+    break;
+  case flat_variable:
+  case flat_variable_index:
+    writeString(resolveVariable(flat.name(node)));
+    break;
+  case flat_function_call:
+    writeString(resolveFunction(flat.name(node)));
+    break;
+  case flat_postfix_expression: // swizzle letters
+    writeString(flat.name(node));
+    break;
+  case flat_number:
+    writeString(flat.literal(node));
+    break;
+  default:
+    writeU32(flat.payloads[node]);
+    break;
+  }
+  if (kind == flat_function_definition || kind == flat_sentences)
+    scopes.emplace_back();
+}
+
+void Canonicalizer::leave(uint32_t node) {
+  FlatKind kind = flat.kinds[node];
+  if (kind == flat_variable_definition)
+    scopes.back()[flat.name(node)] = locals++;
+  if (kind == flat_function_definition || kind == flat_sentences)
+    scopes.pop_back();
+}
+
+void Canonicalizer::writeDefinition(uint32_t definition) {
+  // globals sit in an empty scope
+  scopes.assign(1, {});
+  locals = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  enter(definition);
+  stack.push_back({definition, 0});
+  while (!stack.empty()) {
+    uint32_t node = stack.back().first;
+    uint32_t next = stack.back().second;
+    if (next < flat.childCount[node]) {
+      stack.back().second++;
+      uint32_t child = flat.child(node, next);
+      enter(child);
+      stack.push_back({child, 0});
+      continue;
+    }
+    leave(node);
+    stack.pop_back();
+  }
+}
+
+void Canonicalizer::writeProgram(uint32_t top) {
+  writeU32(flat.payloads[top]); // the version
+  if (keepNames) {
+    // the interface is in the context struct and the header whether main
+    // reads it or not
+    std::vector<bool> used = findUsedDefinitions(flat, top);
+    for (uint32_t i = 0; i < flat.childCount[top]; i++) {
+      uint32_t definition = flat.child(top, i);
+      if (used[i] ||
+          (flat.kinds[definition] == flat_global_variable_definition &&
+           isInterface(flat, definition)))
+        writeDefinition(definition);
+    }
+    return;
+  }
+  if (!functions.count("main")) {
+    for (auto &entry : functions)
+      canonicalNames[entry.getKey()] = entry.getKey().str();
+    for (auto &entry : globals)
+      canonicalNames[entry.getKey()] = entry.getKey().str();
+    for (uint32_t i = 0; i < flat.childCount[top]; i++)
+      writeDefinition(flat.child(top, i));
+    return;
+  }
+  canonicalNames["main"] = "main";
+  for (uint32_t i = 0; i < flat.childCount[top]; i++) {
+    uint32_t definition = flat.child(top, i);
+    if (flat.kinds[definition] == flat_global_variable_definition &&
+        isInterface(flat, definition))
+      writeDefinition(definition);
+  }
+  worklist.push_back(functions["main"]);
+  while (!worklist.empty()) {
+    writeDefinition(worklist.front());
+    worklist.pop_front();
+  }
+}
+
+static std::string fingerprint(const FlatAST &flat, uint32_t top,
+                               bool keepNames) {
+  std::string canonical;
+  raw_string_ostream os(canonical);
+  Canonicalizer canonicalizer(flat, top, os, keepNames);
+  canonicalizer.writeProgram(top);
+  os.flush();
+  return toHex(SHA256::hash(arrayRefFromStringRef(canonical)), true);
+}
+
+std::string ast::computeFingerprint(const FlatAST &flat, uint32_t top) {
+  return fingerprint(flat, top, false);
+}
+
+std::string ast::computeOutputFingerprint(const FlatAST &flat, uint32_t top) {
+  return fingerprint(flat, top, true);
+}
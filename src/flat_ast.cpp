@@ -0,0 +1,437 @@
+#include "flat_ast.h"
+#include "ast.h"
+
+#include <cstring>
+
+using namespace ast;
+
+static const char flatMagic[4] = {'G', 'L', 'F', 'A'};
+static const uint32_t flatVersion = 1;
+
+void FlatAST::clear() {
+  kinds.clear();
+  types.clear();
+  ops.clear();
+  flags.clear();
+  payloads.clear();
+  childBegin.clear();
+  childCount.clear();
+  children.clear();
+  names.clear();
+  literals.clear();
+  nameIds.clear();
+  root = noNode;
+}
+
+uint32_t FlatAST::addNode(FlatKind kind, AstType type, int32_t op,
+                          uint8_t flag, uint32_t payload,
+                          const uint32_t *childIds, uint32_t numChildren) {
+  kinds.push_back(kind);
+  types.push_back(type);
+  ops.push_back(op);
+  flags.push_back(flag);
+  payloads.push_back(payload);
+  childBegin.push_back(children.size());
+  childCount.push_back(numChildren);
+  children.insert(children.end(), childIds, childIds + numChildren);
+  return kinds.size() - 1;
+}
+
+uint32_t FlatAST::internName(StringRef name) {
+  auto inserted = nameIds.try_emplace(name, names.size());
+  if (inserted.second)
+    names.push_back(name.str());
+  return inserted.first->second;
+}
+
+uint32_t FlatAST::addLiteral(StringRef literal) {
+  literals.push_back(literal.str());
+  return literals.size() - 1;
+}
+
+template <typename T>
+static void writeArray(raw_ostream &os, const std::vector<T> &array) {
+  os.write((const char *)array.data(), array.size() * sizeof(T));
+}
+
+static void writeU32(raw_ostream &os, uint32_t value) {
+  os.write((const char *)&value, sizeof(value));
+}
+
+static void writeStrings(raw_ostream &os,
+                         const std::vector<std::string> &strings) {
+  writeU32(os, strings.size());
+  for (auto &string : strings) {
+    writeU32(os, string.size());
+    os << string;
+  }
+}
+
+void FlatAST::write(raw_ostream &os) const {
+  os.write(flatMagic, sizeof(flatMagic));
+  writeU32(os, flatVersion);
+  writeU32(os, size());
+  writeU32(os, children.size());
+  writeU32(os, root);
+  writeArray(os, kinds);
+  writeArray(os, types);
+  writeArray(os, ops);
+  writeArray(os, flags);
+  writeArray(os, payloads);
+  writeArray(os, childBegin);
+  writeArray(os, childCount);
+  writeArray(os, children);
+  writeStrings(os, names);
+  writeStrings(os, literals);
+}
+
+namespace {
+// bounds checked cursor over a serialized FlatAST
+struct FlatReader {
+  StringRef buffer;
+  size_t offset = 0;
+
+  bool readBytes(void *out, size_t size) {
+    if (buffer.size() - offset < size)
+      return false;
+    memcpy(out, buffer.data() + offset, size);
+    offset += size;
+    return true;
+  }
+  bool readU32(uint32_t &value) { return readBytes(&value, sizeof(value)); }
+  template <typename T> bool readArray(std::vector<T> &array, uint32_t size) {
+    array.resize(size);
+    return readBytes(array.data(), size * sizeof(T));
+  }
+  bool readStrings(std::vector<std::string> &strings) {
+    uint32_t count;
+    if (!readU32(count))
+      return false;
+    strings.clear();
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t size;
+      if (!readU32(size) || buffer.size() - offset < size)
+        return false;
+      strings.emplace_back(buffer.data() + offset, size);
+      offset += size;
+    }
+    return true;
+  }
+};
+} // namespace
+
+bool FlatAST::read(StringRef buffer) {
+  clear();
+  FlatReader reader{buffer};
+  char magic[sizeof(flatMagic)];
+  uint32_t version, nodes, edges;
+  if (!reader.readBytes(magic, sizeof(magic)) ||
+      memcmp(magic, flatMagic, sizeof(magic)) != 0 ||
+      !reader.readU32(version) || version != flatVersion ||
+      !reader.readU32(nodes) || !reader.readU32(edges) ||
+      !reader.readU32(root))
+    return false;
+  if (!reader.readArray(kinds, nodes) || !reader.readArray(types, nodes) ||
+      !reader.readArray(ops, nodes) || !reader.readArray(flags, nodes) ||
+      !reader.readArray(payloads, nodes) ||
+      !reader.readArray(childBegin, nodes) ||
+      !reader.readArray(childCount, nodes) ||
+      !reader.readArray(children, edges) || !reader.readStrings(names) ||
+      !reader.readStrings(literals)) {
+    clear();
+    return false;
+  }
+  for (uint32_t i = 0; i < names.size(); i++)
+    nameIds[names[i]] = i;
+  return true;
+}
+
+uint32_t ast::flattenAST(const AST *root, FlatAST &flat, bool setIds) {
+  struct Frame {
+    const AST *node;
+    size_t childBegin; // this node's children in `pending`
+    size_t childEnd;
+    size_t next;   // next child to visit in `pending`
+    size_t idBase; // flat ids of finished children start here in `ids`
+  };
+  std::vector<Frame> frames;
+  std::vector<const AST *> pending;
+  std::vector<uint32_t> ids;
+
+  auto push = [&](const AST *node) {
+    size_t begin = pending.size();
+    node->getChildren(pending);
+    frames.push_back({node, begin, pending.size(), begin, ids.size()});
+  };
+
+  push(root);
+  while (!frames.empty()) {
+    Frame &frame = frames.back();
+    if (frame.next < frame.childEnd) {
+      push(pending[frame.next++]);
+      continue;
+    }
+    uint32_t id = frame.node->flatten(flat, ids.data() + frame.idBase);
+    if (setIds)
+      frame.node->setFlatId(flat, id);
+    pending.resize(frame.childBegin);
+    ids.resize(frame.idBase);
+    ids.push_back(id);
+    frames.pop_back();
+  }
+  return ids.back();
+}
+
+const FlatAST &TopLevelAST::index() {
+  flat.clear();
+  flat.root = flattenAST(this, flat, true);
+  indexed = true;
+  return flat;
+}
+
+// children
+
+void SentencesAST::getChildren(std::vector<const AST *> &children) const {
+  for (auto &sentence : sentences)
+    children.push_back(sentence.get());
+}
+
+void ConditionalExpressionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(condition.get());
+  children.push_back(then.get());
+  children.push_back(else_.get());
+}
+
+void BinaryExpressionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(LHS.get());
+  children.push_back(RHS.get());
+}
+
+void PrefixExpressionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(RHS.get());
+}
+
+void PostfixExpressionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(LHS.get());
+}
+
+void SequenceExpressionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  for (auto &expression : expressions)
+    children.push_back(expression.get());
+}
+
+void ExprListAST::getChildren(std::vector<const AST *> &children) const {
+  for (auto &expression : expressions)
+    children.push_back(expression.get());
+}
+
+void FunctionCallAST::getChildren(std::vector<const AST *> &children) const {
+  if (args != nullptr)
+    args->getChildren(children);
+}
+
+void IfStatementAST::getChildren(std::vector<const AST *> &children) const {
+  children.push_back(condition.get());
+  children.push_back(then.get());
+  if (else_ != nullptr)
+    children.push_back(else_.get());
+}
+
+void TypeConstructorAST::getChildren(
+    std::vector<const AST *> &children) const {
+  if (args != nullptr)
+    args->getChildren(children);
+}
+
+void ForStatementAST::getChildren(std::vector<const AST *> &children) const {
+  children.push_back(init.get());
+  children.push_back(condition.get());
+  children.push_back(step.get());
+  children.push_back(body.get());
+}
+
+void ReturnStatementAST::getChildren(
+    std::vector<const AST *> &children) const {
+  if (expr != nullptr)
+    children.push_back(expr.get());
+}
+
+void VariableIndexExprAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(index.get());
+}
+
+void FunctionDefinitionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  children.push_back(Proto.get());
+  children.push_back(Body.get());
+}
+
+void VariableDefinitionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  if (init != nullptr)
+    children.push_back(init.get());
+}
+
+void GlobalVariableDefinitionAST::getChildren(
+    std::vector<const AST *> &children) const {
+  VariableDefinitionAST::getChildren(children);
+  if (layout != nullptr)
+    children.push_back(layout.get());
+}
+
+void TopLevelAST::getChildren(std::vector<const AST *> &children) const {
+  for (auto &definition : *definitions)
+    children.push_back(definition.get());
+}
+
+// nodes
+
+uint32_t FunctionPrototypeAST::flatten(FlatAST &flat,
+                                       const uint32_t *) const {
+  std::vector<uint32_t> argIds;
+  for (auto &arg : args) {
+    argIds.push_back(flat.addNode(flat_function_argument, arg->getType(), 0,
+                                  0, flat.internName(arg->getName()), nullptr,
+                                  0));
+  }
+  return flat.addNode(flat_function_prototype, returnType, 0, 0,
+                      flat.internName(name), argIds.data(), argIds.size());
+}
+
+uint32_t EmptySentenceAST::flatten(FlatAST &flat, const uint32_t *) const {
+  return flat.addNode(flat_empty_sentence, type_void, 0, 0, 0, nullptr, 0);
+}
+
+uint32_t SentencesAST::flatten(FlatAST &flat, const uint32_t *childIds) const {
+  return flat.addNode(flat_sentences, type_void, 0, 0, 0, childIds,
+                      sentences.size());
+}
+
+uint32_t ConditionalExpressionAST::flatten(FlatAST &flat,
+                                           const uint32_t *childIds) const {
+  return flat.addNode(flat_conditional_expression, returnType, 0, 0, 0,
+                      childIds, 3);
+}
+
+uint32_t BinaryExpressionAST::flatten(FlatAST &flat,
+                                      const uint32_t *childIds) const {
+  return flat.addNode(flat_binary_expression, returnType, type, 0, 0,
+                      childIds, 2);
+}
+
+uint32_t PrefixExpressionAST::flatten(FlatAST &flat,
+                                      const uint32_t *childIds) const {
+  return flat.addNode(flat_prefix_expression, returnType, type, 0, 0,
+                      childIds, 1);
+}
+
+uint32_t PostfixExpressionAST::flatten(FlatAST &flat,
+                                       const uint32_t *childIds) const {
+  return flat.addNode(flat_postfix_expression, returnType, type, 0,
+                      flat.internName(identifier), childIds, 1);
+}
+
+uint32_t SequenceExpressionAST::flatten(FlatAST &flat,
+                                        const uint32_t *childIds) const {
+  return flat.addNode(flat_sequence_expression, returnType, sequence_expr, 0,
+                      0, childIds, expressions.size());
+}
+
+uint32_t ExprListAST::flatten(FlatAST &flat, const uint32_t *childIds) const {
+  return flat.addNode(flat_expr_list, returnType, 0, 0, 0, childIds,
+                      expressions.size());
+}
+
+uint32_t FunctionCallAST::flatten(FlatAST &flat,
+                                  const uint32_t *childIds) const {
+  return flat.addNode(flat_function_call, returnType, 0, 0,
+                      flat.internName(callee), childIds,
+                      args != nullptr ? args->getExpressions().size() : 0);
+}
+
+uint32_t IfStatementAST::flatten(FlatAST &flat,
+                                 const uint32_t *childIds) const {
+  return flat.addNode(flat_if_statement, type_void, 0,
+                      else_ != nullptr ? flat_has_else : 0, 0, childIds,
+                      else_ != nullptr ? 3 : 2);
+}
+
+uint32_t TypeConstructorAST::flatten(FlatAST &flat,
+                                     const uint32_t *childIds) const {
+  return flat.addNode(flat_type_constructor, type, 0, 0, 0, childIds,
+                      args != nullptr ? args->getExpressions().size() : 0);
+}
+
+uint32_t ForStatementAST::flatten(FlatAST &flat,
+                                  const uint32_t *childIds) const {
+  return flat.addNode(flat_for_statement, type_void, 0, 0, 0, childIds, 4);
+}
+
+uint32_t ReturnStatementAST::flatten(FlatAST &flat,
+                                     const uint32_t *childIds) const {
+  return flat.addNode(flat_return_statement, type_void, 0,
+                      expr != nullptr ? flat_has_expr : 0, 0, childIds,
+                      expr != nullptr ? 1 : 0);
+}
+
+uint32_t NumberExprAST::flatten(FlatAST &flat, const uint32_t *) const {
+  return flat.addNode(flat_number, type, 0, 0, flat.addLiteral(value),
+                      nullptr, 0);
+}
+
+uint32_t VariableExprAST::flatten(FlatAST &flat, const uint32_t *) const {
+  return flat.addNode(flat_variable, returnType, 0, 0, flat.internName(name),
+                      nullptr, 0);
+}
+
+uint32_t VariableIndexExprAST::flatten(FlatAST &flat,
+                                       const uint32_t *childIds) const {
+  return flat.addNode(flat_variable_index, returnType, 0, 0,
+                      flat.internName(name), childIds, 1);
+}
+
+uint32_t FunctionDefinitionAST::flatten(FlatAST &flat,
+                                        const uint32_t *childIds) const {
+  return flat.addNode(flat_function_definition, Proto->getReturnType(), 0, 0,
+                      flat.internName(Proto->getName()), childIds, 2);
+}
+
+uint32_t VariableDefinitionAST::flatten(FlatAST &flat,
+                                        const uint32_t *childIds) const {
+  uint8_t flag = (isConst ? flat_const : 0) | (init ? flat_has_init : 0);
+  return flat.addNode(flat_variable_definition, type, 0, flag,
+                      flat.internName(name), childIds, init ? 1 : 0);
+}
+
+uint32_t LayoutAst::flatten(FlatAST &flat, const uint32_t *) const {
+  std::vector<uint32_t> idIds;
+  if (layoutQualifier != nullptr) {
+    for (auto &id : layoutQualifier->getIds()) {
+      idIds.push_back(flat.addNode(flat_layout_qualifier_id, type_void,
+                                   id->getId(), 0, id->getValue(), nullptr,
+                                   0));
+    }
+  }
+  return flat.addNode(flat_layout, type_void, this->type, 0, 0, idIds.data(),
+                      idIds.size());
+}
+
+uint32_t GlobalVariableDefinitionAST::flatten(FlatAST &flat,
+                                              const uint32_t *childIds) const {
+  uint8_t flag = (isConst ? flat_const : 0) | (init ? flat_has_init : 0) |
+                 (layout ? flat_has_layout : 0);
+  return flat.addNode(flat_global_variable_definition, type, 0, flag,
+                      flat.internName(name), childIds,
+                      (init ? 1 : 0) + (layout ? 1 : 0));
+}
+
+uint32_t TopLevelAST::flatten(FlatAST &flat, const uint32_t *childIds) const {
+  return flat.addNode(flat_top_level, type_void, 0, 0, version, childIds,
+                      definitions->size());
+}
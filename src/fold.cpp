@@ -0,0 +1,63 @@
+#include "fold.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <vector>
+
+extern thread_local std::unique_ptr<Module> TheModule;
+
+// the constant `inst` computes, its operands are already folded
+static Constant *foldInstruction(Instruction *inst) {
+  if (isa<PHINode>(inst) || isa<LoadInst>(inst) || isa<AllocaInst>(inst))
+    return nullptr;
+  SmallVector<Constant *, 4> operands;
+  for (Value *operand : inst->operands()) {
+    auto *constant = dyn_cast<Constant>(operand);
+    if (!constant)
+      return nullptr;
+    operands.push_back(constant);
+  }
+  const DataLayout &layout = TheModule->getDataLayout();
+  if (auto *compare = dyn_cast<CmpInst>(inst))
+    return ConstantFoldCompareInstOperands(compare->getPredicate(), operands[0],
+                                           operands[1], layout);
+  return ConstantFoldInstOperands(inst, operands, layout);
+}
+
+Constant *foldConstant(Value *value) {
+  if (auto *constant = dyn_cast<Constant>(value))
+    return constant;
+  auto *root = dyn_cast<Instruction>(value);
+  if (!root)
+    return nullptr;
+  // operands before their users, with an explicit stack. The second member
+  // is set once the operands of the instruction are pushed
+  std::vector<std::pair<Instruction *, bool>> stack = {{root, false}};
+  SmallPtrSet<Instruction *, 16> visited;
+  Constant *result = nullptr;
+  while (!stack.empty()) {
+    auto [inst, expanded] = stack.back();
+    stack.pop_back();
+    if (!expanded) {
+      if (!visited.insert(inst).second)
+        continue;
+      stack.push_back({inst, true});
+      for (Value *operand : inst->operands()) {
+        if (auto *operandInst = dyn_cast<Instruction>(operand))
+          stack.push_back({operandInst, false});
+      }
+      continue;
+    }
+    Constant *constant = foldInstruction(inst);
+    if (!constant)
+      continue;
+    inst->replaceAllUsesWith(constant);
+    inst->eraseFromParent();
+    if (inst == root)
+      result = constant;
+  }
+  return result;
+}
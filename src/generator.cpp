@@ -1,6 +1,16 @@
 #include "generator.h"
 #include "ast.h"
+#include "builtins.h"
+#include "fold.h"
+#include "matrix.h"
+#include "parser.h"
+#include "reachability.h"
 #include "scope.h"
+#include "ssa.h"
+#include "type_table.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -12,85 +22,113 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
 
-#include <fstream>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 using namespace llvm;
 using namespace ast;
 
-std::unique_ptr<LLVMContext> TheContext;
-std::unique_ptr<Module> TheModule;
-std::unique_ptr<IRBuilder<>> Builder;
-std::shared_ptr<Scope> topScope = std::make_shared<Scope>();
-std::set<std::shared_ptr<Scope>> scopeSet = {topScope};
-std::shared_ptr<Scope> currentScope = topScope;
-
-void codeGen(const char *filename) {
-  std::string filenameStr(filename);
-  std::string code;
-  raw_string_ostream os(code);
-  TheModule->print(os, nullptr);
-  os.flush();
-  // override file
-  std::ofstream out(filenameStr, std::ios::out | std::ios::trunc);
-  out << code;
-  out.close();
+// codegen state, one per thread so functions can be lowered in parallel
+thread_local std::unique_ptr<LLVMContext> TheContext;
+thread_local std::unique_ptr<Module> TheModule;
+thread_local std::unique_ptr<IRBuilder<>> Builder;
+thread_local std::shared_ptr<Scope> topScope = std::make_shared<Scope>();
+thread_local std::set<std::shared_ptr<Scope>> scopeSet = {topScope};
+thread_local std::shared_ptr<Scope> currentScope = topScope;
+
+FPMode fpMode = fp_strict;
+bool stripUnusedDefinitions = true;
+unsigned codegenJobs = 1;
+thread_local const StringMap<std::string> *specializedUniforms = nullptr;
+
+FastMathFlags getFastMathFlags(FPMode mode) {
+  FastMathFlags flags;
+  switch (mode) {
+  case fp_strict:
+    break;
+  case fp_relaxed:
+    flags.setAllowContract();
+    flags.setApproxFunc();
+    flags.setAllowReciprocal();
+    break;
+  case fp_fast:
+    flags.setFast();
+    break;
+  }
+  return flags;
+}
+
+bool parseFPMode(const std::string &name, FPMode &mode) {
+  if (name == "strict")
+    mode = fp_strict;
+  else if (name == "relaxed")
+    mode = fp_relaxed;
+  else if (name == "fast")
+    mode = fp_fast;
+  else
+    return false;
+  return true;
+}
+
+// the output file, truncated. Writes go straight to it without a copy of
+// the module in memory
+static std::unique_ptr<raw_fd_ostream> openOutput(const char *filename,
+                                                  sys::fs::OpenFlags flags) {
+  std::error_code error;
+  auto os = std::make_unique<raw_fd_ostream>(filename, error, flags);
+  if (error) {
+    printf("Error: cannot write %s: %s\n", filename, error.message().c_str());
+    return nullptr;
+  }
+  return os;
+}
+
+// false if anything written to `os` did not reach the file
+static bool closeOutput(raw_fd_ostream &os, const char *filename) {
+  os.close();
+  if (os.has_error()) {
+    printf("Error: cannot write %s: %s\n", filename,
+           os.error().message().c_str());
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+bool codeGen(const char *filename) {
+  auto os = openOutput(filename, sys::fs::OF_Text);
+  if (!os)
+    return false;
+  TheModule->print(*os, nullptr);
+  return closeOutput(*os, filename);
+}
+
+bool codeGenBitcode(const char *filename) {
+  auto os = openOutput(filename, sys::fs::OF_None);
+  if (!os)
+    return false;
+  WriteBitcodeToFile(*TheModule, *os);
+  return closeOutput(*os, filename);
 }
 
 Type *getTypeFromAstType(AstType type) {
-  switch (type) {
-  case type_int:
-    return Type::getInt32Ty(*TheContext);
-  case type_bool:
-    return Type::getInt32Ty(*TheContext);
-  case type_float:
-    return Type::getFloatTy(*TheContext);
-  case type_double:
-    return Type::getDoubleTy(*TheContext);
-  case type_vec2:
-    return VectorType::get(Type::getFloatTy(*TheContext), 2, false);
-  case type_vec3:
-    return VectorType::get(Type::getFloatTy(*TheContext), 3, false);
-  case type_vec4:
-    return VectorType::get(Type::getFloatTy(*TheContext), 4, false);
-  case type_mat2:
-    return VectorType::get(Type::getFloatTy(*TheContext), 4, false);
-  case type_mat3:
-    return VectorType::get(Type::getFloatTy(*TheContext), 9, false);
-  case type_mat4:
-    return VectorType::get(Type::getFloatTy(*TheContext), 16, false);
-  case type_void:
-    return Type::getVoidTy(*TheContext);
-  default:
+  Type *llvmType = TheTypes->getType(type);
+  if (llvmType == nullptr)
     printf("Error: unknown type\n");
-    break;
-  }
+  return llvmType;
 }
 
 Type *getPtrTypeFromAstType(AstType type) {
-  switch (type) {
-  case type_int:
-    return Type::getInt32Ty(*TheContext);
-  case type_bool:
-    return Type::getInt1Ty(*TheContext);
-  case type_float:
-    return Type::getFloatTy(*TheContext);
-  case type_double:
-    return Type::getDoubleTy(*TheContext);
-  case type_vec2:
-  case type_vec3:
-  case type_vec4:
-  case type_mat2:
-  case type_mat3:
-  case type_mat4:
-    return Type::getFloatPtrTy(*TheContext);
-  case type_void:
-    return Type::getVoidTy(*TheContext);
-  default:
-    printf("Error: unknown type\n");
-    break;
-  }
+  const AstTypeInfo &info = getAstTypeInfo(type);
+  if (info.lanes() > 1)
+    return PointerType::getUnqual(TheTypes->get(type).elementType);
+  return TheTypes->get(type).memoryType;
 }
 
 Value *getPtrFromPtrOrVector(Value *value) {
@@ -105,24 +143,24 @@ Value *getPtrFromPtrOrVector(Value *value) {
 
 Value *getValueFromAllType(Value *value, AstType type) {
   if (value->getType()->isPointerTy()) {
-    return Builder->CreateLoad(getTypeFromAstType(type), value, "tmp");
+    const TypeTable::Entry &entry = TheTypes->get(type);
+    value = Builder->CreateAlignedLoad(entry.memoryType, value, entry.align,
+                                       "tmp");
+    if (entry.memoryType != entry.type)
+      value = Builder->CreateICmpNE(
+          value, Constant::getNullValue(entry.memoryType), "tobool");
+    return value;
   } else {
     return value;
   }
 }
 
-Type *getTypeFromAssignableValue(Value *value) {
-  if (value->getType()->isPointerTy()) {
-    return getTypeFromAstType(
-        currentScope->getIndentifier(((VariableExprAST *)value)->getName())
-            ->first);
-  } else if (value->getType()->isVectorTy()) {
-    // get ptr of the first element of the vector
-    Type *vecType = ((VectorType *)value->getType())->getElementType();
-    return vecType;
-  } else {
-    return value->getType();
-  }
+// store a value of `type`, bools are widened to their memory type
+static void storeValue(Value *value, Value *ptr, AstType type) {
+  const TypeTable::Entry &entry = TheTypes->get(type);
+  if (entry.memoryType != entry.type)
+    value = Builder->CreateZExt(value, entry.memoryType, "frombool");
+  Builder->CreateAlignedStore(value, ptr, entry.align);
 }
 
 Value *toDouble(Value *value) {
@@ -130,15 +168,17 @@ Value *toDouble(Value *value) {
     return value;
   else if (value->getType()->isFloatTy())
     return Builder->CreateFPExt(value, Type::getDoubleTy(*TheContext), "tmp");
+  else if (value->getType()->isIntegerTy(1))
+    return Builder->CreateUIToFP(value, Type::getDoubleTy(*TheContext), "tmp");
   else if (value->getType()->isIntegerTy())
     return Builder->CreateSIToFP(value, Type::getDoubleTy(*TheContext), "tmp");
   else if (value->getType()->isVectorTy())
     // change vector to double vector
     return Builder->CreateFPExt(
         value,
-        VectorType::get(Type::getDoubleTy(*TheContext),
-                        ((FixedVectorType *)value->getType())->getNumElements(),
-                        false),
+        TheTypes->getVectorType(
+            scalar_double,
+            ((FixedVectorType *)value->getType())->getNumElements()),
         "tmp");
   //    return value;
   else {
@@ -152,13 +192,16 @@ Value *doubleTo(Type *type, Value *value) {
     return value;
   else if (type->isFloatTy())
     return Builder->CreateFPTrunc(value, Type::getFloatTy(*TheContext), "tmp");
+  else if (type->isIntegerTy(1))
+    return Builder->CreateFCmpONE(value, ConstantFP::get(value->getType(), 0.0),
+                                  "tobool");
   else if (type->isIntegerTy())
     return Builder->CreateFPToSI(value, Type::getInt32Ty(*TheContext), "tmp");
   else if (type->isVectorTy())
     return Builder->CreateFPTrunc(
         value,
-        VectorType::get(Type::getFloatTy(*TheContext),
-                        ((FixedVectorType *)type)->getNumElements(), false),
+        TheTypes->getVectorType(scalar_float,
+                                ((FixedVectorType *)type)->getNumElements()),
         "tmp");
   else {
     printf("Error: unknown type\n");
@@ -166,6 +209,32 @@ Value *doubleTo(Type *type, Value *value) {
   }
 }
 
+// convert a scalar to another scalar type, following the usual int/float
+// promotions. A bool is 0 or 1 as a number and any non-zero number is true
+Value *convertScalar(Value *value, Type *to) {
+  Type *from = value->getType();
+  if (from == to)
+    return value;
+  if (to->isIntegerTy(1) && from->isIntegerTy())
+    return Builder->CreateICmpNE(value, ConstantInt::get(from, 0), "tobool");
+  if (to->isIntegerTy(1) && from->isFloatingPointTy())
+    return Builder->CreateFCmpONE(value, ConstantFP::get(from, 0.0), "tobool");
+  if (from->isIntegerTy(1) && to->isIntegerTy())
+    return Builder->CreateZExt(value, to, "frombool");
+  if (from->isIntegerTy(1) && to->isFloatingPointTy())
+    return Builder->CreateUIToFP(value, to, "frombool");
+  if (from->isIntegerTy() && to->isIntegerTy())
+    return Builder->CreateIntCast(value, to, true, "intcast");
+  if (from->isIntegerTy() && to->isFloatingPointTy())
+    return Builder->CreateSIToFP(value, to, "intcast");
+  if (from->isFloatingPointTy() && to->isIntegerTy())
+    return Builder->CreateFPToSI(value, to, "intcast");
+  if (from->isFloatingPointTy() && to->isFloatingPointTy())
+    return Builder->CreateFPCast(value, to, "fpcast");
+  printf("Error: cannot cast type\n");
+  return nullptr;
+}
+
 bool isIncrementable(Type *type) {
   if (type->isPointerTy() || type->isVectorTy())
     //  if (type->isIntegerTy() || type->isFloatingPointTy() ||
@@ -176,53 +245,160 @@ bool isIncrementable(Type *type) {
     return false;
 }
 
-Value *ConditionalExpressionAST::codegen() {
-  Value *cond = condition->codegen();
-  if (!cond)
-    return nullptr;
-
-  cond = getValueFromAllType(cond, condition->getReturnType());
-
-  // change int 1 to int 32
-  cond = Builder->CreateSExt(cond, Type::getInt32Ty(*TheContext), "ifcond");
-  cond = Builder->CreateICmpNE(
-      cond, ConstantInt::get(Type::getInt32Ty(*TheContext), 0), "ifcond");
+namespace {
+// a lowered expression and the AstType it was lowered as. Reads of an ssa
+// local remember the variable so the expression can be assigned to, a
+// swizzle also remembers the lanes it selected and, for a vector in memory,
+// its address
+struct FlatValue {
+  Value *value;
+  AstType type;
+  SSAVariable *variable = nullptr;
+  Value *address = nullptr;
+  SmallVector<int, 4> swizzle;
+};
+} // namespace
+
+// the value `current op= right` writes back, `leftAstType` is the type of
+// the assigned variable
+static Value *emitCompoundValue(ExprType type, Value *current,
+                                AstType leftAstType, Value *right,
+                                AstType rightAstType) {
+  Type *leftType = getTypeFromAstType(leftAstType);
+  Value *zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
+  Value *one = ConstantInt::get(Type::getInt32Ty(*TheContext), 1);
+  Value *cond;
+  Value *temp;
+  Instruction::BinaryOps opcode;
+  const char *name;
+  if (type == times_assign_expr && isMatrixProduct(leftAstType, rightAstType)) {
+    // v *= m and m *= m, the product keeps the type of the variable
+    if (matrixProductType(leftAstType, rightAstType) != leftAstType) {
+      printf("Error: cannot assign the product to %s\n",
+             astTypeToString(leftAstType).c_str());
+      return nullptr;
+    }
+    return emitMatrixProduct(current, leftAstType, right, rightAstType);
+  }
+  switch (type) {
+  case plus_assign_expr:
+    opcode = Instruction::FAdd;
+    name = "addtmp";
+    break;
+  case minus_assign_expr:
+    opcode = Instruction::FSub;
+    name = "subtmp";
+    break;
+  case times_assign_expr:
+    opcode = Instruction::FMul;
+    name = "multmp";
+    break;
+  case divide_assign_expr:
+    opcode = Instruction::FDiv;
+    name = "divtmp";
+    break;
+  case mod_assign_expr:
+    opcode = Instruction::FRem;
+    name = "modtmp";
+    break;
+  default:
+    // integer only operators
+    if (!leftType->isIntOrIntVectorTy() ||
+        !right->getType()->isIntOrIntVectorTy()) {
+      printf("Error: don't support %s for non-integer type\n",
+             exprTypeToString(type).c_str());
+      return nullptr;
+    }
+    switch (type) {
+    case bit_and_assign_expr:
+      return Builder->CreateAnd(current, right);
+    case bit_or_assign_expr:
+      return Builder->CreateOr(current, right);
+    case left_shift_assign_expr:
+      return Builder->CreateShl(current, right);
+    case right_shift_assign_expr:
+      return Builder->CreateAShr(current, right);
+    case or_assign_expr:
+      cond = Builder->CreateOr(Builder->CreateICmpEQ(current, zero),
+                               Builder->CreateICmpEQ(right, zero), "ortmp");
+      return Builder->CreateSelect(cond, zero, one);
+    case and_assign_expr:
+      cond = Builder->CreateAnd(Builder->CreateICmpEQ(current, zero),
+                                Builder->CreateICmpEQ(right, zero), "andtmp");
+      return Builder->CreateSelect(cond, zero, one);
+    default:
+      printf("Error: unknown assignment\n");
+      return nullptr;
+    }
+  }
+  if (auto *vecType = dyn_cast<FixedVectorType>(leftType)) {
+    // float vectors are computed as they are, a scalar applies to every lane
+    if (!right->getType()->isVectorTy())
+      right = Builder->CreateVectorSplat(
+          vecType->getNumElements(),
+          convertScalar(right, vecType->getElementType()));
+    return Builder->CreateBinOp(opcode, current, right, name);
+  }
+  temp = Builder->CreateBinOp(opcode, toDouble(current), toDouble(right),
+                              name);
+  return doubleTo(leftType, temp);
+}
 
-  Value *trueValue = then->codegen();
-  Value *falseValue = else_->codegen();
+// `value` as an i1 that is set when it is not zero
+static Value *emitCondition(Value *value, AstType type) {
+  if (!value)
+    return nullptr;
+  value = getValueFromAllType(value, type);
+  if (value->getType()->isVectorTy()) {
+    printf("Error: condition is not a scalar\n");
+    return nullptr;
+  }
+  return convertScalar(value, Builder->getInt1Ty());
+}
 
-  if (!trueValue || !falseValue)
+// the arm of a ?: as a value of the type of the true arm
+static Value *emitConditionalArm(Value *value, AstType type,
+                                 AstType resultType) {
+  if (!value)
     return nullptr;
+  value = getValueFromAllType(value, type);
+  Type *resultLLVMType = getTypeFromAstType(resultType);
+  if (value->getType() != resultLLVMType && !resultLLVMType->isVectorTy() &&
+      !value->getType()->isVectorTy())
+    value = convertScalar(value, resultLLVMType);
+  return value;
+}
 
+// both arms are already lowered, see isCheapExpression
+static Value *emitConditionalExpression(Value *cond, AstType condAstType,
+                                        Value *trueValue, AstType trueAstType,
+                                        Value *falseValue,
+                                        AstType falseAstType) {
+  cond = emitCondition(cond, condAstType);
+  trueValue = emitConditionalArm(trueValue, trueAstType, trueAstType);
+  falseValue = emitConditionalArm(falseValue, falseAstType, trueAstType);
+  if (!cond || !trueValue || !falseValue)
+    return nullptr;
   return Builder->CreateSelect(cond, trueValue, falseValue, "ifresult");
 }
 
-Value *BinaryExpressionAST::codegen() {
-  Value *zero;
-  Value *one;
+static Value *emitBinaryExpression(ExprType type, Value *left,
+                                   AstType leftAstType, Value *right,
+                                   AstType rightAstType) {
   Value *cond;
-  Value *cond2;
-  Value *left;
-  Value *right;
-  Value *is_left_zero;
-  Value *is_right_zero;
   Value *temp;
   Type *tempType;
   std::string tempName;
-  VariableExprAST *tempVar;
   Type *rightType;
   Type *leftType;
   Value *leftDoubleTemp;
-  Value *rightDoubleTemp;
   switch (type) {
   case plus_expr: // TOD: handle type conversion eg, int + float
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     if (!right->getType()->isVectorTy() && left->getType()->isVectorTy()) {
@@ -232,13 +408,11 @@ Value *BinaryExpressionAST::codegen() {
     temp = Builder->CreateFAdd(left, right, "addtmp");
     return doubleTo(leftType, temp);
   case minus_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     if (!right->getType()->isVectorTy() && left->getType()->isVectorTy()) {
@@ -248,13 +422,13 @@ Value *BinaryExpressionAST::codegen() {
     temp = Builder->CreateFSub(left, right, "subtmp");
     return doubleTo(leftType, temp);
   case times_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    if (isMatrixProduct(leftAstType, rightAstType))
+      return emitMatrixProduct(left, leftAstType, right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     if (!right->getType()->isVectorTy() && left->getType()->isVectorTy()) {
@@ -264,13 +438,11 @@ Value *BinaryExpressionAST::codegen() {
     temp = Builder->CreateFMul(left, right, "multmp");
     return doubleTo(leftType, temp);
   case divide_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     if (!right->getType()->isVectorTy() && left->getType()->isVectorTy()) {
@@ -280,14 +452,12 @@ Value *BinaryExpressionAST::codegen() {
     temp = Builder->CreateFDiv(left, right, "divtmp");
     return doubleTo(leftType, temp);
   case mod_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
-    rightType = getTypeFromAstType(RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
+    rightType = getTypeFromAstType(rightAstType);
     if (!leftType->isIntegerTy() || !rightType->isIntegerTy()) {
       printf("Error: mod operator only works on integer\n");
       return nullptr;
@@ -295,223 +465,153 @@ Value *BinaryExpressionAST::codegen() {
     temp = Builder->CreateSRem(left, right, "modtmp");
     return doubleTo(leftType, temp);
   case and_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
-      printf("Error: and operator only works on integer\n");
-      return nullptr;
-    }
-    zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-    is_left_zero = Builder->CreateICmpEQ(left, zero);
-    is_right_zero = Builder->CreateICmpEQ(right, zero);
-    cond = Builder->CreateAnd(is_left_zero, is_right_zero, "andtmp");
-    return Builder->CreateSelect(
-        cond, zero, ConstantInt::get(Type::getInt32Ty(*TheContext), 1),
-        "andtmp");
   case or_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
+    // the right side is cheap and has no side effects, so it was lowered
+    // unconditionally, see isCheapExpression
+    left = emitCondition(left, leftAstType);
+    right = emitCondition(right, rightAstType);
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
-      printf("Error: or operator only works on integer\n");
-      return nullptr;
-    }
-    zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-    is_left_zero = Builder->CreateICmpEQ(left, zero);
-    is_right_zero = Builder->CreateICmpEQ(right, zero);
-    cond = Builder->CreateOr(is_left_zero, is_right_zero, "ortmp");
-    return Builder->CreateSelect(
-        cond, zero, ConstantInt::get(Type::getInt32Ty(*TheContext), 1),
-        "ortmp");
+    if (type == and_expr)
+      cond = Builder->CreateLogicalAnd(left, right, "andtmp");
+    else
+      cond = Builder->CreateLogicalOr(left, right, "ortmp");
+    return cond;
   case xor_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
-      printf("Error: xor operator only works on integer\n");
+    left = emitCondition(left, leftAstType);
+    right = emitCondition(right, rightAstType);
+    if (!left || !right)
       return nullptr;
-    }
-    zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-    is_left_zero = Builder->CreateICmpEQ(left, zero);
-    is_right_zero = Builder->CreateICmpEQ(right, zero);
-    cond = Builder->CreateOr(is_left_zero, is_right_zero, "ortmp");
-    cond2 = Builder->CreateAnd(Builder->CreateNot(is_left_zero),
-                               Builder->CreateNot(is_right_zero), "andtmp");
-    one = ConstantInt::get(Type::getInt32Ty(*TheContext), 1);
-    return Builder->CreateSelect(
-        cond, Builder->CreateSelect(cond2, zero, one, "xortmp1"), one,
-        "xortmp2");
+    return Builder->CreateXor(left, right, "xortmp");
   case bit_and_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
     if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
       printf("Error: bit_and operator only works on integer\n");
       return nullptr;
     }
     return Builder->CreateAnd(left, right, "bandtmp");
   case bit_or_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
     if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
       printf("Error: bit_or operator only works on integer\n");
       return nullptr;
     }
     return Builder->CreateOr(left, right, "bortmp");
   case bit_xor_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
     if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
       printf("Error: bit_xor operator only works on integer\n");
       return nullptr;
     }
     return Builder->CreateXor(left, right, "bxortmp");
   case left_shift_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
     if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
       printf("Error: left_shift operator only works on integer\n");
       return nullptr;
     }
     return Builder->CreateShl(left, right, "lshifttmp");
   case right_shift_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
     if (!left->getType()->isIntegerTy() || !right->getType()->isIntegerTy()) {
       printf("Error: right_shift operator only works on integer\n");
       return nullptr;
     }
     return Builder->CreateLShr(left, right, "rshifttmp");
   case less_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpULT(left, right, "lesstmp");
-    // return bool using i32
     return temp;
   case greater_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpUGT(left, right, "greatertmp");
-    // change bool to 32 int
-    temp = Builder->CreateSExt(temp, Type::getInt32Ty(*TheContext), "ifcond");
     return temp;
   case less_equal_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpULE(left, right, "lessequaltmp");
-    temp = Builder->CreateSExt(temp, Type::getInt32Ty(*TheContext), "ifcond");
-
     return temp;
   case greater_equal_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpUGE(left, right, "greaterequaltmp");
-    temp = Builder->CreateSExt(temp, Type::getInt32Ty(*TheContext), "ifcond");
-
     return temp;
   case equal_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpUEQ(left, right, "equaltmp");
-    temp = Builder->CreateSExt(temp, Type::getInt32Ty(*TheContext), "ifcond");
-
     return temp;
   case not_equal_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    left = getValueFromAllType(left, LHS->getReturnType());
-    right = getValueFromAllType(right, RHS->getReturnType());
-    leftType = getTypeFromAstType(LHS->getReturnType());
+    left = getValueFromAllType(left, leftAstType);
+    right = getValueFromAllType(right, rightAstType);
+    leftType = getTypeFromAstType(leftAstType);
     left = toDouble(left);
     right = toDouble(right);
     temp = Builder->CreateFCmpUNE(left, right, "notequaltmp");
-    temp = Builder->CreateSExt(temp, Type::getInt32Ty(*TheContext), "ifcond");
-
     return temp;
   case assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
     if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
+      right = getValueFromAllType(right, rightAstType);
       left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
+      leftType = getTypeFromAstType(leftAstType);
       if (leftType->isVectorTy()) {
         // store to the vector
-        Builder->CreateStore(right, left);
-        return Builder->CreateLoad(leftType, left);
+        storeValue(right, left, leftAstType);
+        return right;
       } else {
-        rightDoubleTemp = toDouble(right);
-        temp = doubleTo(leftType, rightDoubleTemp);
+        temp = convertScalar(right, leftType);
+        if (!temp)
+          return nullptr;
         // store to the pointer
-        Builder->CreateStore(temp, left);
+        storeValue(temp, left, leftAstType);
         return temp;
       }
     } else {
@@ -519,314 +619,34 @@ Value *BinaryExpressionAST::codegen() {
       return nullptr;
     }
   case plus_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (leftType->isVectorTy()) {
-        // store to the vector
-        temp = Builder->CreateLoad(leftType, left);
-        temp = Builder->CreateFAdd(temp, right, "addtmp");
-        Builder->CreateStore(temp, left);
-        return temp;
-      } else {
-        rightDoubleTemp = toDouble(right);
-        temp = Builder->CreateLoad(leftType, left);
-        temp = toDouble(temp);
-        temp = Builder->CreateFAdd(temp, rightDoubleTemp, "addtmp");
-        temp = doubleTo(leftType, temp);
-        // store to the pointer
-        Builder->CreateStore(temp, left);
-        return temp;
-      }
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
-    //    left = LHS->codegen();
-    //    right = RHS->codegen();
-    //    if (!left || !right)
-    //      return nullptr;
-    //    tempType = right->getType();
-    //    if (right->getType()->isPointerTy()) {
-    //      tempName = ((VariableExprAST *)RHS.get())->getName();
-    //      tempType =
-    //          getTypeFromAstType(currentScope->getIndentifier(tempName)->first);
-    //      right = Builder->CreateLoad(
-    //          getTypeFromAstType(currentScope->getIndentifier(tempName)->first),
-    //          right, "tmp");
-    //    }
-    //    temp = Builder->CreateAdd(Builder->CreateLoad(tempType, left), right);
-    //    Builder->CreateStore(temp, left);
-    //    return temp;
   case minus_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (leftType->isVectorTy()) {
-        // store to the vector
-        temp = Builder->CreateLoad(leftType, left);
-        temp = Builder->CreateFSub(temp, right, "subtmp");
-        Builder->CreateStore(temp, left);
-        return temp;
-      } else {
-        rightDoubleTemp = toDouble(right);
-        temp = Builder->CreateLoad(leftType, left);
-        temp = toDouble(temp);
-        temp = Builder->CreateFSub(temp, rightDoubleTemp, "subtmp");
-        temp = doubleTo(leftType, temp);
-        // store to the pointer
-        Builder->CreateStore(temp, left);
-        return temp;
-      }
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case times_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (leftType->isVectorTy()) {
-        // store to the vector
-        temp = Builder->CreateLoad(leftType, left);
-        temp = Builder->CreateFMul(temp, right, "multmp");
-        Builder->CreateStore(temp, left);
-        return temp;
-      } else {
-        rightDoubleTemp = toDouble(right);
-        temp = Builder->CreateLoad(leftType, left);
-        temp = toDouble(temp);
-        temp = Builder->CreateFMul(temp, rightDoubleTemp, "multmp");
-        temp = doubleTo(leftType, temp);
-        // store to the pointer
-        Builder->CreateStore(temp, left);
-        return temp;
-      }
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case divide_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (leftType->isVectorTy()) {
-        // store to the vector
-        temp = Builder->CreateLoad(leftType, left);
-        temp = Builder->CreateFDiv(temp, right, "divtmp");
-        Builder->CreateStore(temp, left);
-        return temp;
-      } else {
-        rightDoubleTemp = toDouble(right);
-        temp = Builder->CreateLoad(leftType, left);
-        temp = toDouble(temp);
-        temp = Builder->CreateFDiv(temp, rightDoubleTemp, "divtmp");
-        temp = doubleTo(leftType, temp);
-        // store to the pointer
-        Builder->CreateStore(temp, left);
-        return temp;
-      }
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case mod_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (leftType->isVectorTy()) {
-        // store to the vector
-        temp = Builder->CreateLoad(leftType, left);
-        temp = Builder->CreateFRem(temp, right, "modtmp");
-        Builder->CreateStore(temp, left);
-        return temp;
-      } else {
-        rightDoubleTemp = toDouble(right);
-        temp = Builder->CreateLoad(leftType, left);
-        temp = toDouble(temp);
-        temp = Builder->CreateFRem(temp, rightDoubleTemp, "modtmp");
-        temp = doubleTo(leftType, temp);
-        // store to the pointer
-        Builder->CreateStore(temp, left);
-        return temp;
-      }
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case bit_and_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy() || left->getType()->isVectorTy()) {
-      rightType = getTypeFromAssignableValue(right);
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = left->getType();
-      // load int from left pointer
-      if (!rightType->isIntegerTy() || !leftType->isIntegerTy()) {
-        printf("Error: don't support bit and assign for non-integer type\n");
-      }
-      temp = Builder->CreateLoad(leftType, left);
-      temp = Builder->CreateAnd(temp, right);
-      // store to the pointer
-      Builder->CreateStore(temp, left);
-      return temp;
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case bit_or_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy() || left->getType()->isVectorTy()) {
-      rightType = getTypeFromAssignableValue(right);
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = left->getType();
-      // load int from left pointer
-      if (!rightType->isIntegerTy() || !leftType->isIntegerTy()) {
-        printf("Error: don't support bit or assign for non-integer type\n");
-      }
-      temp = Builder->CreateLoad(leftType, left);
-      temp = Builder->CreateOr(temp, right);
-      // store to the pointer
-      Builder->CreateStore(temp, left);
-      return temp;
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case left_shift_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (!getTypeFromAstType(LHS->getReturnType())->isIntegerTy() ||
-          !right->getType()->isIntegerTy()) {
-        printf("Error: don't support left shift assign for non-integer type\n");
-      }
-      temp = Builder->CreateLoad(leftType, left);
-      temp = Builder->CreateShl(temp, right);
-      // store to the pointer
-      Builder->CreateStore(temp, left);
-      return temp;
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case right_shift_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      if (!getTypeFromAstType(LHS->getReturnType())->isIntegerTy() ||
-          !right->getType()->isIntegerTy()) {
-        printf(
-            "Error: don't support right shift assign for non-integer type\n");
-      }
-      temp = Builder->CreateLoad(leftType, left);
-      temp = Builder->CreateAShr(temp, right);
-      // store to the pointer
-      Builder->CreateStore(temp, left);
-      return temp;
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case or_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
-    if (!left || !right)
-      return nullptr;
-    if (left->getType()->isPointerTy()) {
-      rightType = getTypeFromAstType(RHS->getReturnType());
-      right = getValueFromAllType(right, RHS->getReturnType());
-      left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      // load int from left pointer
-      if (!rightType->isIntegerTy() || !leftType->isIntegerTy()) {
-        printf("Error: don't support or assign for non-integer type\n");
-      }
-      zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-      temp = Builder->CreateLoad(leftType, left);
-      is_left_zero = Builder->CreateICmpEQ(temp, zero);
-      is_right_zero = Builder->CreateICmpEQ(right, zero);
-      cond = Builder->CreateOr(is_left_zero, is_right_zero, "ortmp");
-      temp = Builder->CreateSelect(
-          cond, zero, ConstantInt::get(Type::getInt32Ty(*TheContext), 1));
-      Builder->CreateStore(temp, left);
-      return temp;
-    } else {
-      printf("Error: left side of assignment is not a pointer\n");
-      return nullptr;
-    }
   case and_assign_expr:
-    left = LHS->codegen();
-    right = RHS->codegen();
     if (!left || !right)
       return nullptr;
-    if (left->getType()->isPointerTy() || left->getType()->isVectorTy()) {
-      rightType = getTypeFromAstType(RHS->getReturnType());
-      right = getValueFromAllType(right, RHS->getReturnType());
+    if (left->getType()->isPointerTy()) {
+      right = getValueFromAllType(right, rightAstType);
       left = getPtrFromPtrOrVector(left);
-      leftType = getTypeFromAstType(LHS->getReturnType());
-      // load int from left pointer
-      if (!rightType->isIntegerTy() || !leftType->isIntegerTy()) {
-        printf("Error: don't support and assign for non-integer type\n");
-      }
-      zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-      temp = Builder->CreateLoad(leftType, left);
-      is_left_zero = Builder->CreateICmpEQ(temp, zero);
-      is_right_zero = Builder->CreateICmpEQ(right, zero);
-      cond = Builder->CreateAnd(is_left_zero, is_right_zero, "andtmp");
-      temp = Builder->CreateSelect(
-          cond, zero, ConstantInt::get(Type::getInt32Ty(*TheContext), 1));
-      Builder->CreateStore(temp, left);
+      temp = getValueFromAllType(left, leftAstType);
+      temp = emitCompoundValue(type, temp, leftAstType, right, rightAstType);
+      if (!temp)
+        return nullptr;
+      // store to the pointer
+      storeValue(temp, left, leftAstType);
       return temp;
     } else {
       printf("Error: left side of assignment is not a pointer\n");
       return nullptr;
     }
   case sequence_expr:
-    LHS->codegen();
-    return RHS->codegen();
+    return right;
   default:
     printf("Error: unknown binary expression\n");
     break;
@@ -834,12 +654,12 @@ Value *BinaryExpressionAST::codegen() {
   return nullptr;
 }
 
-Value *PrefixExpressionAST::codegen() { // TODO: 06.21 finish this and after
-  Value *var;
+// TODO: 06.21 finish this and after
+static Value *emitPrefixExpression(ExprType type, Value *var,
+                                   AstType rightAstType) {
   Value *oldValue;
   Value *newValue;
   Type *varType;
-  Value *zero;
   Value *cond;
   std::string tempName;
   Value *temp;
@@ -847,15 +667,16 @@ Value *PrefixExpressionAST::codegen() { // TODO: 06.21 finish this and after
   Value *right;
   Type *leftType;
   Type *rightType;
+  if (!var)
+    return nullptr;
   switch (type) {
   case plus_p_expr: // TODO: check the RHS can be assigned, eg, ++vec2.x
-    var = RHS->codegen();
     varType = var->getType();
     // check
     if (isIncrementable(varType)) {
       // get element from pointer
-      right = getValueFromAllType(var, RHS->getReturnType());
-      rightType = getTypeFromAstType(RHS->getReturnType());
+      right = getValueFromAllType(var, rightAstType);
+      rightType = getTypeFromAstType(rightAstType);
       // load int from left pointer
       if (!rightType->isIntegerTy()) {
         printf("Error: don't support plus plus for non-integer type\n");
@@ -870,13 +691,12 @@ Value *PrefixExpressionAST::codegen() { // TODO: 06.21 finish this and after
       return nullptr;
     }
   case minus_m_expr:
-    var = RHS->codegen();
     varType = var->getType();
     // check
     if (isIncrementable(varType)) {
       // get element from pointer
-      right = getValueFromAllType(var, RHS->getReturnType());
-      rightType = getTypeFromAstType(RHS->getReturnType());
+      right = getValueFromAllType(var, rightAstType);
+      rightType = getTypeFromAstType(rightAstType);
       // load int from left pointer
       if (!rightType->isIntegerTy()) {
         printf("Error: don't support plus plus for non-integer type\n");
@@ -891,42 +711,35 @@ Value *PrefixExpressionAST::codegen() { // TODO: 06.21 finish this and after
       return nullptr;
     }
   case minus_expr:
-    temp = RHS->codegen();
+    temp = var;
     if (!temp)
       return nullptr;
     if (isIncrementable(temp->getType())) {
-      temp = getValueFromAllType(temp, RHS->getReturnType());
+      temp = getValueFromAllType(temp, rightAstType);
     }
     right = toDouble(temp);
-    temp = Builder->CreateNeg(right, "negtmp");
-    temp = doubleTo(getTypeFromAstType(RHS->getReturnType()), temp);
+    temp = Builder->CreateFNeg(right, "negtmp");
+    temp = doubleTo(getTypeFromAstType(rightAstType), temp);
     return temp;
   case plus_expr:
-    temp = RHS->codegen();
+    temp = var;
     if (!temp)
       return nullptr;
     if (isIncrementable(temp->getType())) {
-      temp = getValueFromAllType(temp, RHS->getReturnType());
+      temp = getValueFromAllType(temp, rightAstType);
     }
     return temp;
   case not_expr: // !, logical not
-    zero = ConstantInt::get(Type::getInt32Ty(*TheContext), 0);
-    temp = RHS->codegen();
-    if (!temp)
+    cond = emitCondition(var, rightAstType);
+    if (!cond)
       return nullptr;
-    if (isIncrementable(temp->getType())) {
-      temp = getValueFromAllType(temp, RHS->getReturnType());
-    }
-    cond = Builder->CreateICmpEQ(temp, zero, "ifcond");
-    return Builder->CreateSelect(
-        cond, zero, ConstantInt::get(Type::getInt32Ty(*TheContext), 1),
-        "selecttmp");
+    return Builder->CreateNot(cond, "nottmp");
   case tilde_expr: // ~, bitwise not
-    temp = RHS->codegen();
+    temp = var;
     if (!temp)
       return nullptr;
     if (isIncrementable(temp->getType())) {
-      temp = getValueFromAllType(temp, RHS->getReturnType());
+      temp = getValueFromAllType(temp, rightAstType);
     }
     return Builder->CreateNot(temp, "nottmp");
   default:
@@ -935,21 +748,18 @@ Value *PrefixExpressionAST::codegen() { // TODO: 06.21 finish this and after
   }
 }
 
-Value *PostfixExpressionAST::codegen() {
+static Value *emitPostfixExpression(ExprType type, Value *lhs,
+                                    AstType leftAstType) {
   Value *var;
-  AllocaInst *left;
-  Value *oldValue;
   Value *newValue;
   Value *temp;
-  std::string varName;
-  VariableExprAST *varExpr;
-  Type *varType;
-  int index = -1;
+  if (!lhs)
+    return nullptr;
   switch (type) {
   case plus_p_expr: // TODO: check the RHS can be assigned, eg, ++vec2.x | also
-    temp = LHS->codegen();
+    temp = lhs;
     if (isIncrementable(temp->getType())) {
-      var = getValueFromAllType(temp, LHS->getReturnType());
+      var = getValueFromAllType(temp, leftAstType);
       newValue = Builder->CreateAdd(
           var, ConstantInt::get(llvm::Type::getInt32Ty(*TheContext), 1),
           "newvalue");
@@ -960,9 +770,9 @@ Value *PostfixExpressionAST::codegen() {
       return nullptr;
     }
   case minus_m_expr:
-    temp = LHS->codegen();
+    temp = lhs;
     if (isIncrementable(temp->getType())) {
-      var = getValueFromAllType(temp, LHS->getReturnType());
+      var = getValueFromAllType(temp, leftAstType);
       newValue = Builder->CreateSub(
           var, ConstantInt::get(llvm::Type::getInt32Ty(*TheContext), 1),
           "newvalue");
@@ -972,43 +782,6 @@ Value *PostfixExpressionAST::codegen() {
       printf("Error: cannot decrement this type\n");
       return nullptr;
     }
-  case dot_expr:
-    varExpr = (VariableExprAST *)LHS.get();
-    varName = varExpr->getName();
-    if (identifier == "x") {
-      index = 0;
-    }
-    if (identifier == "y") {
-      index = 1;
-    }
-    if (identifier == "z") {
-      index = 2;
-    }
-    if (identifier == "w") {
-      index = 3;
-    }
-    if (index == -1) {
-      printf("Error: unknown identifier\n");
-      return nullptr;
-    }
-    var = LHS->codegen();
-    varType = getTypeFromAstType(LHS->getReturnType());
-    // return the pointer to the element
-    if (varType->isVectorTy() || varType->isPointerTy()) {
-      temp = ConstantInt::get(Type::getInt32Ty(*TheContext), index);
-      std::vector<Value *> indices;
-      // sub one from index
-      indices.push_back(ConstantInt::get(Type::getInt32Ty(*TheContext), 0));
-      indices.push_back(temp);
-      // create one element vector using indices
-      temp = Builder->CreateGEP(
-          VectorType::get(Type::getFloatTy(*TheContext), 1, false), var,
-          indices); // TODO: dont know how to use GEP
-      return temp;
-    } else {
-      printf("Error: cannot extract element from this type\n");
-      return nullptr;
-    }
   default:
     printf("Error: unknown type\n");
     break;
@@ -1030,28 +803,34 @@ Value *PostfixExpressionAST::codegen() {
 //   return leftValues;
 // }
 
-Value *SequenceExpressionAST::codegen() {
-  for (int i = 0; i < expressions.size() - 1; i++) {
-    expressions[i]->codegen();
-  }
-  Value *last = expressions[expressions.size() - 1]->codegen();
-  if (last->getType()->isPointerTy()) {
-    return Builder->CreateLoad(
-        getTypeFromAstType(
-            expressions[expressions.size() - 1]->getReturnType()),
-        last);
+static Value *emitSequenceExpression(const FlatValue *expressions,
+                                     uint32_t count) {
+  if (count == 0)
+    return nullptr;
+  const FlatValue &last = expressions[count - 1];
+  if (last.value == nullptr)
+    return nullptr;
+  if (last.value->getType()->isPointerTy()) {
+    return getValueFromAllType(last.value, last.type);
   } else {
-    return last;
+    return last.value;
   }
 }
 
 Value *SequenceExpressionAST::getArgs() {
   Value *first = expressions[0]->codegen();
+  if (!first)
+    return nullptr;
+  first = getValueFromAllType(first, expressions[0]->getReturnType());
   Type *firstType = first->getType();
   Type *vecType = VectorType::get(firstType, expressions.size(), false);
   Value *vecValue = UndefValue::get(vecType);
-  for (int i = 0; i < expressions.size(); i++) {
+  vecValue = Builder->CreateInsertElement(vecValue, first, (uint64_t)0);
+  for (int i = 1; i < expressions.size(); i++) {
     Value *newValue = expressions[i]->codegen();
+    if (!newValue)
+      return nullptr;
+    newValue = getValueFromAllType(newValue, expressions[i]->getReturnType());
     // type cast
     if (newValue->getType() != firstType) {
       // check whether the type is castable
@@ -1075,28 +854,53 @@ Value *SequenceExpressionAST::getArgs() {
     }
     vecValue = Builder->CreateInsertElement(vecValue, newValue, i);
   }
-
-  Value *vecAlloc = Builder->CreateAlloca(vecType);
-  Builder->CreateStore(vecValue, vecAlloc);
-  return Builder->CreateLoad(vecType, vecAlloc, "vec");
+  return vecValue;
 }
 
-Value *FunctionCallAST::codegen() {
+static Value *emitFunctionCall(const std::string &callee,
+                               const FlatValue *args, uint32_t count) {
   Function *function = TheModule->getFunction(callee);
   if (!function) {
     printf("Error: unknown function referenced\n");
     return nullptr;
   }
 
+  if (function->arg_size() != count) {
+    printf("Error: wrong number of arguments to %s\n", callee.c_str());
+    return nullptr;
+  }
+
   std::vector<Value *> funcArgs;
-  for (const auto &arg : args->getExpressions()) {
-    funcArgs.push_back(arg->codegen());
+  for (uint32_t i = 0; i < count; i++) {
+    if (!args[i].value)
+      return nullptr;
+    Value *arg = getValueFromAllType(args[i].value, args[i].type);
+    Type *paramType = function->getArg(i)->getType();
+    if (arg->getType() != paramType && !paramType->isVectorTy() &&
+        !arg->getType()->isVectorTy())
+      arg = convertScalar(arg, paramType);
+    funcArgs.push_back(arg);
   }
 
   return Builder->CreateCall(function, funcArgs, "calltmp");
 }
 
+// return types of the declared functions, calls may come before the body
+static thread_local StringMap<AstType> functionReturnTypes;
+
 Function *FunctionPrototypeAST::codegen() {
+  // declared by an earlier pass
+  if (Function *F = TheModule->getFunction(name)) {
+    if (F->arg_size() != args.size() ||
+        functionReturnTypes.lookup(name) != returnType) {
+      printf("Error: %s is declared twice with different types\n",
+             name.c_str());
+      return nullptr;
+    }
+    return F;
+  }
+  functionReturnTypes[name] = returnType;
+
   std::vector<Type *> functionArgs;
   functionArgs.reserve(args.size());
   for (auto &arg : args) {
@@ -1106,15 +910,14 @@ Function *FunctionPrototypeAST::codegen() {
       FunctionType::get(getTypeFromAstType(returnType), functionArgs, false);
   Function *F =
       Function::Create(FT, Function::ExternalLinkage, name, TheModule.get());
+  // bools cross calls as i1, zero extended like a C bool
+  if (F->getReturnType()->isIntegerTy(1))
+    F->addRetAttr(Attribute::ZExt);
   unsigned Idx = 0;
   for (auto &Arg : F->args()) {
     Arg.setName(args[Idx]->getName());
-    //    Value *Alloca =
-    //        Builder->CreateAlloca(Arg.getType(), nullptr,
-    //        Arg.getName().str());
-    //    Builder->CreateStore(&Arg, Alloca);
-    currentScope->addIndentifier(args[Idx]->getName(), args[Idx]->getType(),
-                                 &Arg);
+    if (Arg.getType()->isIntegerTy(1))
+      Arg.addAttr(Attribute::ZExt);
     ++Idx;
   }
   return F;
@@ -1142,23 +945,10 @@ Value *SentencesAST::codegen() {
 }
 
 Value *IfStatementAST::codegen() {
-  Value *condValue = condition->codegen();
+  Value *condValue =
+      emitCondition(condition->codegen(), condition->getReturnType());
   if (!condValue)
     return nullptr;
-  // int to float
-  if (condValue->getType()->isPointerTy()) {
-    condValue = Builder->CreateLoad(
-        getTypeFromAstType(condition->getReturnType()), condValue);
-  }
-  if (condValue->getType()->isIntegerTy()) {
-    condValue = Builder->CreateSIToFP(condValue, Type::getDoubleTy(*TheContext),
-                                      "intcast");
-  } else if (condValue->getType()->isFloatingPointTy()) {
-    condValue = Builder->CreateFPCast(condValue, Type::getDoubleTy(*TheContext),
-                                      "intcast");
-  }
-  condValue = Builder->CreateFCmpONE(
-      condValue, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
   BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
@@ -1167,6 +957,8 @@ Value *IfStatementAST::codegen() {
   if (else_) {
     BasicBlock *ElseBB = BasicBlock::Create(*TheContext, "else");
     Builder->CreateCondBr(condValue, ThenBB, ElseBB);
+    TheSSA->sealBlock(ThenBB);
+    TheSSA->sealBlock(ElseBB);
 
     Builder->SetInsertPoint(ThenBB);
     Value *ThenV = then->codegen();
@@ -1184,6 +976,7 @@ Value *IfStatementAST::codegen() {
     ElseBB = Builder->GetInsertBlock();
 
     TheFunction->insert(TheFunction->end(), MergeBB);
+    TheSSA->sealBlock(MergeBB);
     Builder->SetInsertPoint(MergeBB);
     PHINode *PN = Builder->CreatePHI(ThenV->getType(), 2, "iftmp");
     PN->addIncoming(ThenV, ThenBB);
@@ -1191,12 +984,14 @@ Value *IfStatementAST::codegen() {
     return PN;
   } else {
     Builder->CreateCondBr(condValue, ThenBB, MergeBB);
+    TheSSA->sealBlock(ThenBB);
     Builder->SetInsertPoint(ThenBB);
     Value *ThenV = then->codegen();
     if (!ThenV)
       return nullptr;
     Builder->CreateBr(MergeBB);
     TheFunction->insert(TheFunction->end(), MergeBB);
+    TheSSA->sealBlock(MergeBB);
     Builder->SetInsertPoint(MergeBB);
     return ThenV;
   }
@@ -1211,10 +1006,13 @@ Value *ReturnStatementAST::codegen() { // TODO: return type
     return Builder->CreateRetVoid();
   }
 
-  if (retVal->getType()->isPointerTy()) {
-    retVal = Builder->CreateLoad(getTypeFromAstType(expr->getReturnType()),
-                                 retVal, "retVal");
-  }
+  if (!retVal)
+    return nullptr;
+  retVal = getValueFromAllType(retVal, expr->getReturnType());
+  Type *returnType = Builder->GetInsertBlock()->getParent()->getReturnType();
+  if (retVal->getType() != returnType && !returnType->isVectorTy() &&
+      !retVal->getType()->isVectorTy())
+    retVal = convertScalar(retVal, returnType);
 
   return Builder->CreateRet(retVal);
 
@@ -1261,12 +1059,17 @@ Value *ForStatementAST::codegen() {
   Builder->SetInsertPoint(loopBB);
 
   // Generate LLVM code for the loop condition.
-  Value *conditionValue = condition->codegen();
+  Value *conditionValue =
+      emitCondition(condition->codegen(), condition->getReturnType());
+  if (!conditionValue)
+    return nullptr;
 
   // Create the loop body block and generate LLVM code for the body statements.
   BasicBlock *bodyBB = BasicBlock::Create(
       *TheContext, "loopbody", Builder->GetInsertBlock()->getParent(), afterBB);
   Builder->CreateCondBr(conditionValue, bodyBB, afterBB);
+  TheSSA->sealBlock(bodyBB);
+  TheSSA->sealBlock(afterBB);
   Builder->SetInsertPoint(bodyBB);
   body->codegen();
 
@@ -1274,6 +1077,8 @@ Value *ForStatementAST::codegen() {
   // condition.
   step->codegen();
   Builder->CreateBr(loopBB);
+  // the back edge is in, locals read in the condition get their phis
+  TheSSA->sealBlock(loopBB);
 
   // Set the insertion point to the after-loop block.
   Builder->SetInsertPoint(afterBB);
@@ -1282,7 +1087,7 @@ Value *ForStatementAST::codegen() {
   return Constant::getNullValue(Type::getInt32Ty(*TheContext));
 }
 
-Value *NumberExprAST::codegen() {
+static Value *emitNumber(const std::string &value, AstType type) {
   // depends on the type of the number
   double d;
   float f;
@@ -1300,79 +1105,180 @@ Value *NumberExprAST::codegen() {
   }
 }
 
-Value *GlobalVariableDefinitionAST::codegen() {
+// the initializer of a const or a global as a constant of `type`, nullptr
+// if it is not known at compile time
+static Constant *emitConstantInitializer(ExpressionAST &init, AstType type) {
+  Value *value = init.codegen();
+  if (!value)
+    return nullptr;
+  value = getValueFromAllType(value, init.getReturnType());
   Type *llvmType = getTypeFromAstType(type);
+  if (!llvmType->isVectorTy())
+    value = convertScalar(value, llvmType);
+  if (!value)
+    return nullptr;
+  if (value->getType() != llvmType) {
+    printf("Error: cannot initialize %s with %s\n",
+           astTypeToString(type).c_str(),
+           astTypeToString(init.getReturnType()).c_str());
+    return nullptr;
+  }
+  return foldConstant(value);
+}
+
+// globals are defined outside of any function, their initializer is lowered
+// in a scratch one that is thrown away with whatever did not fold
+static Constant *emitGlobalInitializer(ExpressionAST &init, AstType type) {
+  IRBuilderBase::InsertPointGuard guard(*Builder);
+  Function *scratch =
+      Function::Create(FunctionType::get(Builder->getVoidTy(), false),
+                       Function::PrivateLinkage, "", TheModule.get());
+  BasicBlock *entry = BasicBlock::Create(*TheContext, "entry", scratch);
+  Builder->SetInsertPoint(entry);
+  TheSSA = std::make_unique<SSABuilder>();
+  TheSSA->sealBlock(entry);
+  Constant *initializer = emitConstantInitializer(init, type);
+  TheSSA.reset();
+  scratch->eraseFromParent();
+  return initializer;
+}
+
+// the value of a `type` held in `bytes` like in a field of the context,
+// lane by lane in memory layout
+static Constant *emitUniformValue(StringRef bytes, AstType type) {
+  const TypeTable::Entry &entry = TheTypes->get(type);
+  Type *memoryLane = entry.memoryType->getScalarType();
+  unsigned laneBytes = memoryLane->getPrimitiveSizeInBits() / 8;
+  if (bytes.size() != entry.lanes * laneBytes)
+    return nullptr;
+  std::vector<Constant *> lanes;
+  for (unsigned i = 0; i < entry.lanes; i++) {
+    // the jit runs on the host, which wrote the bytes
+    uint64_t raw = 0;
+    memcpy(&raw, bytes.data() + i * laneBytes, laneBytes);
+    APInt bits(laneBytes * 8, raw);
+    if (entry.elementType->isIntegerTy(1))
+      lanes.push_back(Builder->getInt1(!bits.isZero()));
+    else if (memoryLane->isFloatingPointTy())
+      lanes.push_back(ConstantFP::get(
+          *TheContext, APFloat(memoryLane->getFltSemantics(), bits)));
+    else
+      lanes.push_back(ConstantInt::get(memoryLane, bits));
+  }
+  return entry.type->isVectorTy() ? ConstantVector::get(lanes) : lanes[0];
+}
+
+Value *GlobalVariableDefinitionAST::codegen() {
+  // a uniform a variant is specialized for is a const of its value
+  if (getLayoutType() == uniform && specializedUniforms) {
+    auto found = specializedUniforms->find(name);
+    if (found != specializedUniforms->end()) {
+      Constant *value = emitUniformValue(found->second, type);
+      if (!value) {
+        printf("Error: %s takes %u lanes\n", name.c_str(),
+               TheTypes->get(type).lanes);
+        return nullptr;
+      }
+      topScope->addIndentifier(name, type, value);
+      return value;
+    }
+  }
+
+  Constant *initializer = nullptr;
+  if (init != nullptr) {
+    initializer = emitGlobalInitializer(*init, type);
+    if (!initializer) {
+      printf("Error: initializer of %s is not constant\n", name.c_str());
+      return nullptr;
+    }
+    // a const global is just its value
+    if (isConst) {
+      topScope->addIndentifier(name, type, initializer);
+      return initializer;
+    }
+  }
+
+  // in the layout it has in memory, bools take 32 bits like in a buffer
+  Type *llvmType = TheTypes->get(type).memoryType;
 
   auto *gvar = TheModule->getOrInsertGlobal(name, llvmType);
+  if (initializer) {
+    if (initializer->getType() != llvmType)
+      initializer = ConstantFoldCastOperand(Instruction::ZExt, initializer,
+                                            llvmType,
+                                            TheModule->getDataLayout());
+    cast<GlobalVariable>(gvar)->setInitializer(initializer);
+  }
 
   topScope->addIndentifier(name, type, gvar);
 
   return gvar;
 }
 
-Value *VariableExprAST::codegen() {
+static Value *emitVariable(const std::string &name) {
   // Look up the variable in the symbol table
-  Value *varValue = currentScope->getIndentifier(name)->second;
-  if (!varValue) {
+  auto identifier = currentScope->getIndentifier(name);
+  if (!identifier) {
     printf("Unknown variable name %s\n", name.c_str());
     return nullptr;
   }
-  return varValue;
+  // locals without storage are read from the current definition
+  if (!identifier->second)
+    return TheSSA->readVariable(identifier.get(), Builder->GetInsertBlock());
+  return identifier->second;
 }
 
-Value *VariableIndexExprAST::codegen() {
+// column `index` of a matrix held as a value, a const. It is read lane by
+// lane and folds to a constant for a constant index
+static FlatValue emitValueColumn(Value *matrix, AstType type, Value *index,
+                                 AstType indexType) {
+  const AstTypeInfo &info = getAstTypeInfo(type);
+  AstType columnType = getVectorAstType(info.scalar, info.rows);
+  if (!info.isMatrix() || !index)
+    return {nullptr, type_error};
+  index = getValueFromAllType(index, indexType);
+  index = Builder->CreateIntCast(index, Builder->getInt32Ty(), true);
+  Value *first = Builder->CreateMul(index, Builder->getInt32(info.rows));
+  Value *column = PoisonValue::get(TheTypes->getType(columnType));
+  for (unsigned row = 0; row < info.rows; row++) {
+    Value *lane = Builder->CreateExtractElement(
+        matrix, Builder->CreateAdd(first, Builder->getInt32(row)));
+    column = Builder->CreateInsertElement(column, lane, row);
+  }
+  return {column, columnType};
+}
+
+static Value *emitVariableIndex(const std::string &name, Value *indexValue,
+                                AstType indexAstType) {
   // Look up the variable in the symbol table
-  Value *varValue = currentScope->getIndentifier(name)->second;
-  if (!varValue) {
+  auto identifier = currentScope->getIndentifier(name);
+  if (!identifier || !identifier->second) {
     printf("Unknown variable name %s\n", name.c_str());
     return nullptr;
   }
+  Value *varValue = identifier->second;
 
-  // Generate code for the index expression
-  Value *indexValue = index->codegen();
-  Type *indexType = indexValue->getType();
-
-  if (indexValue->getType()->isPointerTy()) {
-    indexValue = Builder->CreateLoad(indexType, indexValue);
-  }
+  if (!indexValue)
+    return nullptr;
+  indexValue = getValueFromAllType(indexValue, indexAstType);
 
   // Convert the index value to 64-bit integer type
   indexValue =
       Builder->CreateIntCast(indexValue, Type::getInt32Ty(*TheContext), true);
 
-  // Calculate the element pointer using GEP (GetElementPtr) instruction
-  std::vector<Value *> indices;
-  // sub one from index
-  indices.push_back(ConstantInt::get(*TheContext, APInt(32, 0, true)));
-  indices.push_back(indexValue);
-  Type *elementType;
-
   // get type
-  switch (currentScope->getIndentifier(name)->first) {
-  case type_mat2:
-    elementType = VectorType::get(Type::getFloatTy(*TheContext), 2, false);
-    break;
-  case type_mat3:
-    elementType = VectorType::get(Type::getFloatTy(*TheContext), 3, false);
-    break;
-  case type_mat4:
-    elementType = VectorType::get(Type::getFloatTy(*TheContext), 4, false);
-    break;
-  default:
-    printf("Unknown variable type %s\n", name.c_str());
-    return nullptr;
-  }
-
-  if (elementType == nullptr) {
+  AstType varType = identifier->first;
+  if (!getAstTypeInfo(varType).isMatrix()) {
     printf("Unknown variable type %s\n", name.c_str());
     return nullptr;
   }
 
-  Value *elementPtr = Builder->CreateGEP(
-      elementType, varValue,
-      indices); //  TODO: I dont understand the meaning of indices
-
-  return elementPtr;
+  // the matrix is flat, column `index` starts at lane `index * rows`
+  indexValue = Builder->CreateMul(
+      indexValue,
+      ConstantInt::get(indexValue->getType(), getAstTypeInfo(varType).rows));
+  return Builder->CreateGEP(TheTypes->get(varType).elementType, varValue,
+                            indexValue, "column");
 }
 
 Function *FunctionDefinitionAST::codegen() {
@@ -1381,20 +1287,45 @@ Function *FunctionDefinitionAST::codegen() {
   scopeSet.insert(scope);
   currentScope = scope;
 
-  // Create the function
+  // Create the function, or find the declaration
   Function *TheFunction = Proto->codegen();
 
   if (!TheFunction) {
     printf("Error: function definition failed\n");
     return nullptr;
   }
+  if (!TheFunction->empty()) {
+    printf("Error: redefinition of %s\n", Proto->getName().c_str());
+    return nullptr;
+  }
 
   // Create a new basic block to start insertion into.
   BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
   Builder->SetInsertPoint(BB);
+  TheSSA = std::make_unique<SSABuilder>();
+  TheSSA->sealBlock(BB);
+
+  // arguments can be assigned to like any other local, matrices are
+  // indexed through a pointer and get a copy in memory
+  for (auto &Arg : TheFunction->args()) {
+    std::string argName = Arg.getName().str();
+    AstType argType = Proto->getArgs()[Arg.getArgNo()]->getType();
+    if (getAstTypeInfo(argType).isMatrix()) {
+      AllocaInst *allocaInst =
+          Builder->CreateAlloca(Arg.getType(), nullptr, argName + ".addr");
+      Builder->CreateStore(&Arg, allocaInst);
+      currentScope->addIndentifier(argName, argType, allocaInst);
+      continue;
+    }
+    currentScope->addIndentifier(argName, argType, nullptr);
+    TheSSA->writeVariable(currentScope->getIndentifier(argName).get(), BB,
+                          &Arg);
+  }
   Body->codegen();
 
   checkAndInsertVoidReturn(TheFunction);
+  TheSSA->sealFunction(TheFunction);
+  TheSSA.reset();
 
   // Validate the generated code, checking for consistency.
   verifyFunction(*TheFunction);
@@ -1422,43 +1353,183 @@ void FunctionDefinitionAST::checkAndInsertVoidReturn(Function *func) {
 
 Value *
 VariableDefinitionAST::codegen() { // TODO: float i = 1; handle type conversion
-  // Create the alloca instruction for the variable
-  AllocaInst *allocaInst =
-      Builder->CreateAlloca(getTypeFromAstType(type), nullptr, name.c_str());
+  Type *llvmType = getTypeFromAstType(type);
 
-  // If the variable has an initial value, generate code for the
-  // expression and store the value in the alloca instruction
-  if (init == nullptr) {
-    return allocaInst;
+  // a const is its folded value, it needs no storage and cannot be assigned
+  if (isConst) {
+    Constant *value = init ? emitConstantInitializer(*init, type) : nullptr;
+    if (!value) {
+      printf("Error: initializer of const %s is not constant\n", name.c_str());
+      return nullptr;
+    }
+    currentScope->addIndentifier(name, type, value);
+    return value;
   }
 
-  Value *initValue = init->codegen();
-
-  if (initValue->getType()->isPointerTy()) {
-    initValue = Builder->CreateLoad(getTypeFromAstType(init->getReturnType()),
-                                    initValue);
+  // matrices are indexed through a pointer and stay in memory
+  if (getAstTypeInfo(type).isMatrix()) {
+    AllocaInst *allocaInst =
+        Builder->CreateAlloca(llvmType, nullptr, name.c_str());
+    currentScope->addIndentifier(name, type, allocaInst);
+    if (init == nullptr)
+      return allocaInst;
+    Value *initValue = init->codegen();
+    if (!initValue)
+      return nullptr;
+    initValue = getValueFromAllType(initValue, init->getReturnType());
+    Builder->CreateStore(initValue, allocaInst);
+    return allocaInst;
   }
 
-  Type *type1 = getTypeFromAstType(type);
-
-  // type is double
-  if (!type1->isDoubleTy() && initValue->getType()->isDoubleTy()) {
-    initValue = doubleTo(type1,initValue);
+  // everything else is an ssa local without storage
+  Value *initValue = UndefValue::get(llvmType);
+  if (init != nullptr) {
+    initValue = init->codegen();
+    if (!initValue)
+      return nullptr;
+    initValue = getValueFromAllType(initValue, init->getReturnType());
+    if (!llvmType->isVectorTy())
+      initValue = convertScalar(initValue, llvmType);
   }
+  if (!initValue)
+    return nullptr;
 
-  Builder->CreateStore(initValue, allocaInst);
   // Store the variable in the symbol table
-  currentScope->addIndentifier(name, type, allocaInst);
-  return allocaInst;
+  currentScope->addIndentifier(name, type, nullptr);
+  TheSSA->writeVariable(currentScope->getIndentifier(name).get(),
+                        Builder->GetInsertBlock(), initValue);
+  return initValue;
 }
 
 Value *LayoutAst::codegen() { return nullptr; }
 
+void resetModule() {
+  // the scopes hold values of the context, the context goes last
+  topScope = std::make_shared<Scope>();
+  currentScope = topScope;
+  scopeSet = {topScope};
+  Builder.reset();
+  TheTypes.reset();
+  TheModule.reset();
+  TheContext.reset();
+}
+
+// declare the used functions and emit the used globals into TheModule,
+// returns the functions whose bodies are still to be lowered. A definition
+// that fails is unmarked in `used`, its error is reported once
+static std::vector<FunctionDefinitionAST *>
+declareDefinitions(std::vector<std::unique_ptr<DefinitionAST>> &definitions,
+                   std::vector<bool> &used) {
+  std::vector<FunctionDefinitionAST *> functions;
+  for (size_t i = 0; i < definitions.size(); i++) {
+    if (!used[i])
+      continue;
+    auto *definition = definitions[i].get();
+    if (definition->isFunction()) {
+      auto *function = static_cast<FunctionDefinitionAST *>(definition);
+      if (!function->declare())
+        used[i] = false;
+      functions.push_back(function);
+    } else if (!definition->codegen()) {
+      used[i] = false;
+    }
+  }
+  return functions;
+}
+
+// lower the bodies on codegenJobs threads, each into a module of its own
+// with its own context. A job takes a contiguous run of the functions and
+// hands its module back as bitcode, the modules are linked into TheModule
+// in job order. Bodies fill the declarations TheModule already has, so the
+// output is the same as the one of a single thread. `declared` holds what
+// declared without errors in TheModule, the jobs skip the rest so they do
+// not report it again
+static void
+codegenParallel(std::vector<std::unique_ptr<DefinitionAST>> &definitions,
+                const std::vector<bool> &declared,
+                const std::vector<FunctionDefinitionAST *> &functions) {
+  unsigned jobs = std::min<size_t>(codegenJobs, functions.size());
+  std::vector<SmallVector<char, 0>> bitcode(jobs);
+  // declaring lowers the initializers of globals, their ast nodes are
+  // shared by all jobs
+  std::mutex declaring;
+  std::vector<std::thread> workers;
+  const StringMap<std::string> *uniforms = specializedUniforms;
+  for (unsigned job = 0; job < jobs; job++) {
+    workers.emplace_back([&, job] {
+      specializedUniforms = uniforms;
+      {
+        std::lock_guard<std::mutex> lock(declaring);
+        InitializeModule();
+        std::vector<bool> used = declared;
+        declareDefinitions(definitions, used);
+        // TheModule defines the globals, here they are only declared
+        for (GlobalVariable &global : TheModule->globals())
+          global.setInitializer(nullptr);
+      }
+      size_t begin = functions.size() * job / jobs;
+      size_t end = functions.size() * (job + 1) / jobs;
+      for (size_t i = begin; i < end; i++)
+        functions[i]->codegen();
+      raw_svector_ostream os(bitcode[job]);
+      WriteBitcodeToFile(*TheModule, os);
+      resetModule();
+    });
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+
+  for (unsigned job = 0; job < jobs; job++) {
+    StringRef data(bitcode[job].data(), bitcode[job].size());
+    Expected<std::unique_ptr<Module>> module =
+        parseBitcodeFile(MemoryBufferRef(data, "job"), *TheContext);
+    if (!module) {
+      printf("Error: %s\n", toString(module.takeError()).c_str());
+      return;
+    }
+    if (Linker::linkModules(*TheModule, std::move(*module)))
+      printf("Error: cannot link the module of job %u\n", job);
+  }
+}
+
+// intrinsics and library functions are declared where a body first calls
+// them, which depends on how the bodies were split into jobs. They go last
+// and by name instead. Intrinsics only folded global initializers called
+// are dropped
+static void sortDeclarations() {
+  std::vector<Function *> declarations;
+  for (Function &function : make_early_inc_range(*TheModule)) {
+    if (function.isIntrinsic() && function.use_empty())
+      function.eraseFromParent();
+    else if (function.isDeclaration())
+      declarations.push_back(&function);
+  }
+  llvm::sort(declarations, [](Function *a, Function *b) {
+    return a->getName() < b->getName();
+  });
+  for (Function *function : declarations) {
+    function->removeFromParent();
+    TheModule->getFunctionList().push_back(function);
+  }
+}
+
 Value *TopLevelAST::codegen() {
-  // Generate code for each statement in the top level
-  for (auto &stmt : *definitions) {
-    stmt->codegen();
+  if (!indexed)
+    index();
+  std::vector<bool> used(definitions->size(), true);
+  if (stripUnusedDefinitions)
+    used = findUsedDefinitions(flat, flat.root);
+  // every function is declared before any body, so calls do not depend on
+  // the order of the definitions
+  std::vector<FunctionDefinitionAST *> functions =
+      declareDefinitions(*definitions, used);
+  if (codegenJobs > 1 && functions.size() > 1) {
+    codegenParallel(*definitions, used, functions);
+  } else {
+    for (FunctionDefinitionAST *function : functions)
+      function->codegen();
   }
+  sortDeclarations();
   return nullptr;
 }
 
@@ -1467,183 +1538,547 @@ Value *EmptySentenceAST::codegen() {
   return nullptr;
 }
 
-Value *ExprListAST::codegen() { return nullptr; }
 
-Value *TypeConstructorAST::codegen() {
-  Value *Vec;
-  int index;
-  switch (type) {
-  case type_void:
+
+static Value *emitTypeConstructor(AstType type, const FlatValue *args,
+                                  uint32_t count) {
+  const TypeTable::Entry &entry = TheTypes->get(type);
+  if (type == type_void || entry.type == nullptr)
     return nullptr;
-  case type_bool:
-  case type_int:
-  case type_float:
-  case type_double:
-    return args->getExpressions()[0]->codegen();
-  case type_vec2:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 2, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
-      }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
-      index++;
+
+  // gather the scalar lanes of all arguments, vectors contribute each lane
+  std::vector<Value *> lanes;
+  for (uint32_t i = 0; i < count; i++) {
+    Value *valueCode = args[i].value;
+    if (!valueCode)
+      return nullptr;
+    valueCode = getValueFromAllType(valueCode, args[i].type);
+    if (auto *vecType = dyn_cast<FixedVectorType>(valueCode->getType())) {
+      for (unsigned i = 0; i < vecType->getNumElements(); i++)
+        lanes.push_back(Builder->CreateExtractElement(valueCode, i));
+    } else {
+      lanes.push_back(valueCode);
     }
-    return Vec;
-  case type_vec3:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 3, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
-      }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
-      index++;
+    if (lanes.size() >= entry.lanes)
+      break;
+  }
+  if (lanes.empty()) {
+    printf("Error: type constructor without arguments\n");
+    return nullptr;
+  }
+
+  if (entry.lanes == 1)
+    return convertScalar(lanes[0], entry.type);
+
+  // a single scalar fills every lane
+  if (lanes.size() == 1)
+    lanes.resize(entry.lanes, lanes[0]);
+
+  Value *Vec = ConstantAggregateZero::get(entry.type);
+  for (unsigned index = 0; index < lanes.size() && index < entry.lanes;
+       index++) {
+    Value *lane = convertScalar(lanes[index], entry.elementType);
+    if (!lane)
+      return nullptr;
+    Vec = Builder->CreateInsertElement(Vec, lane, index);
+  }
+  return Vec;
+}
+
+static AstType binaryReturnType(ExprType type, AstType leftAstType,
+                                AstType rightAstType) {
+  if (type == times_expr && isMatrixProduct(leftAstType, rightAstType))
+    return matrixProductType(leftAstType, rightAstType);
+  if (isBoolExpr(type))
+    return type_bool;
+  return leftAstType;
+}
+
+static AstType prefixReturnType(ExprType type, AstType rightAstType) {
+  switch (type) {
+  case plus_p_expr:
+  case minus_m_expr:
+  case plus_expr:
+  case minus_expr:
+  case tilde_expr:
+    return rightAstType;
+  case not_expr:
+    return type_bool;
+  default:
+    return type_error;
+  }
+}
+
+static AstType postfixReturnType(ExprType type) {
+  switch (type) {
+  case plus_p_expr:
+  case minus_m_expr:
+    return type_int;
+  default:
+    return type_error;
+  }
+}
+
+static bool isAssignment(ExprType type) {
+  switch (type) {
+  case assign_expr:
+  case plus_assign_expr:
+  case minus_assign_expr:
+  case times_assign_expr:
+  case divide_assign_expr:
+  case mod_assign_expr:
+  case bit_and_assign_expr:
+  case bit_or_assign_expr:
+  case left_shift_assign_expr:
+  case right_shift_assign_expr:
+  case or_assign_expr:
+  case and_assign_expr:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the lanes named by a swizzle like `xy`, `rgba` or `stp`, letters may not
+// mix sets or select past `width`
+static bool parseSwizzle(const std::string &identifier, unsigned width,
+                         SmallVectorImpl<int> &lanes) {
+  static const char *const sets[] = {"xyzw", "rgba", "stpq"};
+  if (identifier.empty() || identifier.size() > 4)
+    return false;
+  for (const char *set : sets) {
+    lanes.clear();
+    for (char c : identifier) {
+      const char *found = strchr(set, c);
+      if (!found || (unsigned)(found - set) >= width)
+        break;
+      lanes.push_back(found - set);
     }
-    return Vec;
-  case type_vec4:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 4, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
-      }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
-      index++;
+    if (lanes.size() == identifier.size())
+      return true;
+  }
+  return false;
+}
+
+// `v.xy` and friends. One lane is an extractelement, several are a single
+// shufflevector. The result keeps track of the lanes in the variable it
+// came from, so a swizzle of an assignable vector is assignable too
+static FlatValue emitSwizzle(const FlatValue &var,
+                             const std::string &identifier) {
+  const AstTypeInfo &info = getAstTypeInfo(var.type);
+  if (!var.value)
+    return {nullptr, type_error};
+  if (!info.isVector()) {
+    printf("Error: cannot extract element from this type\n");
+    return {nullptr, type_error};
+  }
+  SmallVector<int, 4> lanes;
+  if (!parseSwizzle(identifier, info.rows, lanes)) {
+    printf("Error: unknown swizzle %s\n", identifier.c_str());
+    return {nullptr, type_error};
+  }
+  Value *value = getValueFromAllType(var.value, var.type);
+  if (lanes.size() == 1)
+    value = Builder->CreateExtractElement(value, lanes[0]);
+  else if (!ShuffleVectorInst::isIdentityMask(lanes) ||
+           lanes.size() != info.rows)
+    value = Builder->CreateShuffleVector(value, lanes, "swizzle");
+  FlatValue result = {value, getVectorAstType(info.scalar, lanes.size())};
+  if (!var.swizzle.empty()) {
+    // a swizzle of a swizzle selects from the same variable
+    for (int &lane : lanes)
+      lane = var.swizzle[lane];
+    result.variable = var.variable;
+    result.address = var.address;
+  } else if (var.variable) {
+    result.variable = var.variable;
+  } else if (var.value->getType()->isPointerTy()) {
+    result.address = var.value;
+  } else {
+    return result; // an rvalue, nothing to write back to
+  }
+  result.swizzle = lanes;
+  return result;
+}
+
+static bool isAssignable(const FlatValue &value) {
+  return value.variable || value.address;
+}
+
+// write `value` to what `lhs` was read from. A write mask on an ssa vector
+// blends the new lanes into the current definition, one on a vector in
+// memory stores just the selected lanes
+static bool writeAssignable(const FlatValue &lhs, Value *value) {
+  const SmallVector<int, 4> &lanes = lhs.swizzle;
+  for (unsigned i = 0; i < lanes.size(); i++) {
+    if (is_contained(ArrayRef<int>(lanes).take_front(i), lanes[i])) {
+      printf("Error: swizzle assigns a component twice\n");
+      return false;
     }
-    return Vec;
-  case type_mat2:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 4, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
-      }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
+  }
+  if (lhs.address) {
+    AstType laneType = getVectorAstType(getAstTypeInfo(lhs.type).scalar, 1);
+    Type *elementType = TheTypes->get(laneType).memoryType;
+    for (unsigned i = 0; i < lanes.size(); i++) {
+      Value *lane = lanes.size() == 1
+                        ? value
+                        : Builder->CreateExtractElement(value, i);
+      Value *ptr = Builder->CreateConstInBoundsGEP1_32(elementType,
+                                                       lhs.address, lanes[i]);
+      storeValue(lane, ptr, laneType);
     }
-    index++;
-    return Vec;
-  case type_mat3:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 9, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
+    return true;
+  }
+
+  BasicBlock *block = Builder->GetInsertBlock();
+  if (lanes.size() == 1) {
+    Value *whole = TheSSA->readVariable(lhs.variable, block);
+    value = Builder->CreateInsertElement(whole, value, lanes[0]);
+  } else if (!lanes.empty()) {
+    Value *whole = TheSSA->readVariable(lhs.variable, block);
+    unsigned width = cast<FixedVectorType>(whole->getType())->getNumElements();
+    // lanes not in the mask keep the current value
+    SmallVector<int, 4> blend;
+    for (unsigned i = 0; i < width; i++)
+      blend.push_back(i);
+    if (lanes.size() == width) {
+      for (unsigned i = 0; i < lanes.size(); i++)
+        blend[lanes[i]] = width + i;
+    } else {
+      // move the new lanes to their place first, blending needs equal widths
+      SmallVector<int, 4> widen(width, -1);
+      for (unsigned i = 0; i < lanes.size(); i++) {
+        widen[lanes[i]] = i;
+        blend[lanes[i]] = width + lanes[i];
       }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
-      index++;
+      value = Builder->CreateShuffleVector(value, widen, "widen");
     }
-    return Vec;
-  case type_mat4:
-    Vec = ConstantAggregateZero::get(
-        VectorType::get(Type::getFloatTy(*TheContext), 16, false));
-    index = 0;
-    for (auto &value : args->getExpressions()) {
-      auto valueCode = value->codegen();
-      if (valueCode->getType()->isDoubleTy()) {
-        valueCode =
-            Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isIntegerTy()) {
-        valueCode = ConstantExpr::getSIToFP((ConstantInt *)valueCode,
-                                            Type::getFloatTy(*TheContext));
-      } else if (valueCode->getType()->isPointerTy()) {
-        // get the element type of the pointer
-        auto elementType = getTypeFromAstType(value->getReturnType());
-        valueCode = Builder->CreateLoad(elementType, valueCode);
-        if (elementType->isIntegerTy()) {
-          valueCode =
-              Builder->CreateSIToFP(valueCode, Type::getFloatTy(*TheContext));
-        } else if (elementType->isDoubleTy()) {
-          valueCode =
-              Builder->CreateFPTrunc(valueCode, Type::getFloatTy(*TheContext));
-        }
-      }
-      Vec = Builder->CreateInsertElement(Vec, valueCode, index);
-      index++;
+    value = Builder->CreateShuffleVector(whole, value, blend, "blend");
+  }
+  TheSSA->writeVariable(lhs.variable, block, value);
+  return true;
+}
+
+// assignment to an ssa local or a swizzle, plain variables in memory go
+// through emitBinaryExpression
+static Value *emitAssignment(ExprType type, const FlatValue &lhs,
+                             const FlatValue &rhs) {
+  if (!lhs.value || !rhs.value)
+    return nullptr;
+  Value *right = getValueFromAllType(rhs.value, rhs.type);
+  Type *leftType = getTypeFromAstType(lhs.type);
+  Value *value;
+  if (type != assign_expr) {
+    value = emitCompoundValue(type, lhs.value, lhs.type, right, rhs.type);
+  } else if (auto *vecType = dyn_cast<FixedVectorType>(leftType)) {
+    value = right;
+    if (!right->getType()->isVectorTy())
+      value = Builder->CreateVectorSplat(
+          vecType->getNumElements(),
+          convertScalar(right, vecType->getElementType()));
+  } else {
+    value = convertScalar(right, leftType);
+  }
+  if (!value || !writeAssignable(lhs, value))
+    return nullptr;
+  return value;
+}
+
+// ++ and -- on an ssa local or a single lane, yields the new value for the
+// prefix form and the old one for the postfix form
+static Value *emitIncrement(ExprType type, const FlatValue &var, bool prefix) {
+  if (!var.value)
+    return nullptr;
+  if (!var.value->getType()->isIntegerTy()) {
+    printf("Error: don't support plus plus for non-integer type\n");
+    return nullptr;
+  }
+  Value *one = ConstantInt::get(var.value->getType(), 1);
+  Value *newValue = type == plus_p_expr
+                        ? Builder->CreateAdd(var.value, one, "newvalue")
+                        : Builder->CreateSub(var.value, one, "newvalue");
+  if (!writeAssignable(var, newValue))
+    return nullptr;
+  return prefix ? newValue : var.value;
+}
+
+static FlatValue emitBuiltinFunction(const std::string &callee,
+                                     const FlatValue *args, uint32_t count) {
+  std::vector<Value *> values;
+  std::vector<AstType> types;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!args[i].value)
+      return {nullptr, type_error};
+    values.push_back(getValueFromAllType(args[i].value, args[i].type));
+    types.push_back(args[i].type);
+  }
+  AstType resultType;
+  Value *result = emitBuiltinCall(callee, values, types, resultType);
+  return {result, resultType};
+}
+
+// lower one flat node, `args` are the already lowered children
+static FlatValue emitFlatNode(const FlatAST &flat, uint32_t node,
+                              const FlatValue *args) {
+  uint32_t count = flat.childCount[node];
+  auto op = (ExprType)flat.ops[node];
+  AstType type = flat.types[node];
+  switch (flat.kinds[node]) {
+  case flat_conditional_expression:
+    return {emitConditionalExpression(args[0].value, args[0].type,
+                                      args[1].value, args[1].type,
+                                      args[2].value, args[2].type),
+            args[1].type};
+  case flat_binary_expression:
+    if (isAssignable(args[0]) && isAssignment(op))
+      return {emitAssignment(op, args[0], args[1]), args[0].type};
+    return {emitBinaryExpression(op, args[0].value, args[0].type,
+                                 args[1].value, args[1].type),
+            binaryReturnType(op, args[0].type, args[1].type)};
+  case flat_prefix_expression:
+    if (isAssignable(args[0]) && (op == plus_p_expr || op == minus_m_expr))
+      return {emitIncrement(op, args[0], true), args[0].type};
+    return {emitPrefixExpression(op, args[0].value, args[0].type),
+            prefixReturnType(op, args[0].type)};
+  case flat_postfix_expression:
+    if (op == dot_expr)
+      return emitSwizzle(args[0], flat.name(node));
+    if (isAssignable(args[0]) && (op == plus_p_expr || op == minus_m_expr))
+      return {emitIncrement(op, args[0], false), args[0].type};
+    return {emitPostfixExpression(op, args[0].value, args[0].type),
+            postfixReturnType(op)};
+  case flat_sequence_expression:
+    return {emitSequenceExpression(args, count),
+            count > 0 ? args[count - 1].type : type_error};
+  case flat_expr_list:
+    return {nullptr, count > 0 ? args[count - 1].type : type_error};
+  case flat_function_call:
+    // user functions shadow the built-in ones
+    if (!TheModule->getFunction(flat.name(node)) &&
+        isBuiltinFunction(flat.name(node)))
+      return emitBuiltinFunction(flat.name(node), args, count);
+    return {emitFunctionCall(flat.name(node), args, count),
+            functionReturnTypes.lookup(flat.name(node))};
+  case flat_type_constructor:
+    return {emitTypeConstructor(type, args, count), type};
+  case flat_number:
+    return {emitNumber(flat.literal(node), type), type};
+  case flat_variable: {
+    auto identifier = currentScope->getIndentifier(flat.name(node));
+    if (!identifier)
+      return {emitVariable(flat.name(node)), type_error};
+    return {emitVariable(flat.name(node)), identifier->first,
+            identifier->second ? nullptr : identifier.get()};
+  }
+  case flat_variable_index: {
+    auto identifier = currentScope->getIndentifier(flat.name(node));
+    if (identifier && identifier->second &&
+        !identifier->second->getType()->isPointerTy())
+      return emitValueColumn(identifier->second, identifier->first,
+                             args[0].value, args[0].type);
+    Value *column =
+        emitVariableIndex(flat.name(node), args[0].value, args[0].type);
+    if (!column)
+      return {nullptr, type_error};
+    const AstTypeInfo &info =
+        getAstTypeInfo(currentScope->getIndentifier(flat.name(node))->first);
+    // the column is only as aligned as its lanes. It is read here and
+    // written back lane by lane, like a swizzle of a vector in memory
+    AstType columnType = getVectorAstType(info.scalar, info.rows);
+    Align align = TheTypes->get(getVectorAstType(info.scalar, 1)).align;
+    Value *value = Builder->CreateAlignedLoad(TheTypes->getType(columnType),
+                                              column, align, "tmp");
+    FlatValue result = {value, columnType};
+    result.address = column;
+    for (unsigned row = 0; row < info.rows; row++)
+      result.swizzle.push_back(row);
+    return result;
+  }
+  default:
+    printf("Error: not an expression\n");
+    return {nullptr, type_error};
+  }
+}
+
+// the most nodes an operand of &&, || or ?: may have to be evaluated
+// unconditionally and combined with a select
+static const uint32_t cheapExpressionNodes = 8;
+
+// whether the subtree under `node` can be evaluated even when its value is
+// not needed: no calls, assignments or ++/--, and only a few nodes
+static bool isCheapExpression(const FlatAST &flat, uint32_t node) {
+  std::vector<uint32_t> stack = {node};
+  uint32_t nodes = 0;
+  while (!stack.empty()) {
+    uint32_t current = stack.back();
+    stack.pop_back();
+    if (++nodes > cheapExpressionNodes)
+      return false;
+    auto op = (ExprType)flat.ops[current];
+    switch (flat.kinds[current]) {
+    case flat_function_call:
+      return false;
+    case flat_binary_expression:
+      if (isAssignment(op))
+        return false;
+      break;
+    case flat_prefix_expression:
+    case flat_postfix_expression:
+      if (op == plus_p_expr || op == minus_m_expr)
+        return false;
+      break;
+    default:
+      break;
     }
-    return Vec;
-  case type_error:
-    break;
+    for (uint32_t i = 0; i < flat.childCount[current]; i++)
+      stack.push_back(flat.child(current, i));
+  }
+  return true;
+}
+
+// whether `node` is &&, || or ?: with an operand that has to be skipped
+// when it is not needed
+static bool needsBranches(const FlatAST &flat, uint32_t node) {
+  auto op = (ExprType)flat.ops[node];
+  switch (flat.kinds[node]) {
+  case flat_binary_expression:
+    return (op == and_expr || op == or_expr) &&
+           !isCheapExpression(flat, flat.child(node, 1));
+  case flat_conditional_expression:
+    return !isCheapExpression(flat, flat.child(node, 1)) ||
+           !isCheapExpression(flat, flat.child(node, 2));
+  default:
+    return false;
   }
-}
\ No newline at end of file
+}
+
+namespace {
+// a node being lowered by codegenFlat
+struct FlatFrame {
+  uint32_t node;
+  uint32_t next;    // next child to lower
+  size_t valueBase; // lowered children start here in `values`
+  bool branches;    // operands after the first get their own blocks
+  BasicBlock *skip = nullptr; // &&, ||: where the lhs ended, ?: the else arm
+  BasicBlock *merge = nullptr;
+};
+} // namespace
+
+// the first operand of a branching node is lowered, branch on it
+static void beginBranches(const FlatAST &flat, FlatFrame &frame,
+                          const FlatValue *args) {
+  Value *cond = emitCondition(args[0].value, args[0].type);
+  if (!cond) {
+    frame.branches = false; // lower the rest straight, the node fails anyway
+    return;
+  }
+  Function *function = Builder->GetInsertBlock()->getParent();
+  BasicBlock *next = BasicBlock::Create(*TheContext, "", function);
+  frame.merge = BasicBlock::Create(*TheContext, "", function);
+  if (flat.kinds[frame.node] == flat_conditional_expression) {
+    next->setName("condtrue");
+    frame.skip = BasicBlock::Create(*TheContext, "condfalse", function);
+    frame.merge->setName("condend");
+    Builder->CreateCondBr(cond, next, frame.skip);
+    TheSSA->sealBlock(frame.skip);
+  } else {
+    frame.skip = Builder->GetInsertBlock();
+    if ((ExprType)flat.ops[frame.node] == and_expr) {
+      next->setName("andrhs");
+      frame.merge->setName("andend");
+      Builder->CreateCondBr(cond, next, frame.merge);
+    } else {
+      next->setName("orrhs");
+      frame.merge->setName("orend");
+      Builder->CreateCondBr(cond, frame.merge, next);
+    }
+  }
+  TheSSA->sealBlock(next);
+  Builder->SetInsertPoint(next);
+}
+
+// ?: only, the true arm is lowered, move on to the false one
+static void emitFalseArm(FlatFrame &frame, FlatValue *args) {
+  args[1].value = emitConditionalArm(args[1].value, args[1].type,
+                                     args[1].type);
+  Builder->CreateBr(frame.merge);
+  // the arm may have ended in another block, from here on `skip` is that
+  // block for the phi
+  BasicBlock *trueEnd = Builder->GetInsertBlock();
+  Builder->SetInsertPoint(frame.skip);
+  frame.skip = trueEnd;
+}
+
+// every operand is lowered, join the paths
+static FlatValue endBranches(const FlatAST &flat, FlatFrame &frame,
+                             const FlatValue *args) {
+  if (flat.kinds[frame.node] == flat_conditional_expression) {
+    Value *falseValue =
+        emitConditionalArm(args[2].value, args[2].type, args[1].type);
+    Builder->CreateBr(frame.merge);
+    BasicBlock *falseEnd = Builder->GetInsertBlock();
+    TheSSA->sealBlock(frame.merge);
+    Builder->SetInsertPoint(frame.merge);
+    if (!args[1].value || !falseValue)
+      return {nullptr, args[1].type};
+    PHINode *phi = Builder->CreatePHI(args[1].value->getType(), 2, "ifresult");
+    phi->addIncoming(args[1].value, frame.skip);
+    phi->addIncoming(falseValue, falseEnd);
+    return {phi, args[1].type};
+  }
+
+  auto op = (ExprType)flat.ops[frame.node];
+  Value *right = emitCondition(args[1].value, args[1].type);
+  Builder->CreateBr(frame.merge);
+  BasicBlock *rightEnd = Builder->GetInsertBlock();
+  TheSSA->sealBlock(frame.merge);
+  Builder->SetInsertPoint(frame.merge);
+  if (!right)
+    return {nullptr, type_bool};
+  PHINode *phi = Builder->CreatePHI(Builder->getInt1Ty(), 2,
+                                    op == and_expr ? "andtmp" : "ortmp");
+  // skipping the rhs means false for && and true for ||
+  phi->addIncoming(Builder->getInt1(op == or_expr), frame.skip);
+  phi->addIncoming(right, rightEnd);
+  return {phi, type_bool};
+}
+
+// lower the expression under `root` without recursion, children are lowered
+// left to right before their parent. The operands of &&, || and ?: that
+// are skipped at run time get their own blocks
+static FlatValue codegenFlat(const FlatAST &flat, uint32_t root) {
+  std::vector<FlatFrame> frames = {{root, 0, 0, needsBranches(flat, root)}};
+  std::vector<FlatValue> values;
+  while (!frames.empty()) {
+    FlatFrame &frame = frames.back();
+    FlatValue *args = values.data() + frame.valueBase;
+    if (frame.next < flat.childCount[frame.node]) {
+      if (frame.branches && frame.next == 1)
+        beginBranches(flat, frame, args);
+      else if (frame.branches && frame.next == 2)
+        emitFalseArm(frame, args);
+      uint32_t child = flat.child(frame.node, frame.next++);
+      frames.push_back({child, 0, values.size(), needsBranches(flat, child)});
+      continue;
+    }
+    FlatValue value = frame.branches ? endBranches(flat, frame, args)
+                                     : emitFlatNode(flat, frame.node, args);
+    values.resize(frame.valueBase);
+    values.push_back(value);
+    frames.pop_back();
+  }
+  return values.back();
+}
+
+Value *ExpressionAST::codegen() {
+  FlatValue result;
+  if (indexedFlat) {
+    result = codegenFlat(*indexedFlat, flatId);
+  } else {
+    FlatAST flat;
+    flat.root = flattenAST(this, flat);
+    result = codegenFlat(flat, flat.root);
+  }
+  returnType = result.type;
+  return result.value;
+}
@@ -126,10 +126,42 @@ ExprType tokenToExprType(TokenType token) {
     return tilde_expr;
   case tok_dot:
     return dot_expr;
+  case tok_comma:
+    return sequence_expr;
+  case tok_or:
+    return or_expr;
+  case tok_xor:
+    return xor_expr;
+  case tok_and:
+    return and_expr;
+  case tok_bit_or:
+    return bit_or_expr;
+  case tok_bit_xor:
+    return bit_xor_expr;
+  case tok_bit_and:
+    return bit_and_expr;
   default:
     return unknown_expr;
   }
 }
+bool isBoolExpr(ExprType exprType) {
+  switch (exprType) {
+  case or_expr:
+  case xor_expr:
+  case and_expr:
+  case equal_expr:
+  case not_equal_expr:
+  case greater_expr:
+  case less_expr:
+  case greater_equal_expr:
+  case less_equal_expr:
+  case not_expr:
+    return true;
+  default:
+    return false;
+  }
+}
+
 std::string exprTypeToString(ExprType exprType) {
   switch (exprType) {
   case assign_expr:
@@ -211,34 +243,7 @@ std::string exprTypeToString(ExprType exprType) {
   }
 }
 std::string astTypeToString(AstType astType) {
-  switch (astType) {
-  case type_void:
-    return "void";
-  case type_bool:
-    return "bool";
-  case type_int:
-    return "int";
-  case type_float:
-    return "float";
-  case type_double:
-    return "double";
-  case type_vec2:
-    return "vec2";
-  case type_vec3:
-    return "vec3";
-  case type_vec4:
-    return "vec4";
-  case type_mat2:
-    return "mat2";
-  case type_mat3:
-    return "mat3";
-  case type_mat4:
-    return "mat4";
-  case type_error:
-    return "error";
-  default:
-    return "unkown";
-  }
+  return getAstTypeInfo(astType).name;
 }
 std::string printTokens(size_t index) {
   std::string str;
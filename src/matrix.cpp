@@ -0,0 +1,225 @@
+#include "matrix.h"
+#include "builtins.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+
+#include <map>
+#include <memory>
+
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
+
+namespace {
+// the lanes of one matrix value as scalars, for the cofactor expansions
+struct Elements {
+  unsigned rows;
+  SmallVector<Value *, 16> lanes;
+  std::map<std::pair<unsigned, unsigned>, Value *> minors;
+
+  Elements(Value *matrix, unsigned rows) : rows(rows) {
+    unsigned count = cast<FixedVectorType>(matrix->getType())->getNumElements();
+    for (unsigned i = 0; i < count; i++)
+      lanes.push_back(Builder->CreateExtractElement(matrix, i));
+  }
+
+  Value *at(unsigned row, unsigned column) const {
+    return lanes[column * rows + row];
+  }
+
+  // determinant of the submatrix made of the rows and columns set in the
+  // masks, expanded along its first row. Shared minors are emitted once
+  Value *determinant(unsigned rowMask, unsigned columnMask) {
+    auto found = minors.find({rowMask, columnMask});
+    if (found != minors.end())
+      return found->second;
+    unsigned row = countTrailingZeros(rowMask);
+    Value *result = nullptr;
+    if ((rowMask & (rowMask - 1)) == 0) {
+      result = at(row, countTrailingZeros(columnMask));
+    } else {
+      bool negate = false;
+      for (unsigned column = 0; column < 32; column++) {
+        if (!(columnMask & (1u << column)))
+          continue;
+        Value *term = Builder->CreateFMul(
+            at(row, column),
+            determinant(rowMask & ~(1u << row), columnMask & ~(1u << column)));
+        if (!result)
+          result = term;
+        else if (negate)
+          result = Builder->CreateFSub(result, term);
+        else
+          result = Builder->CreateFAdd(result, term);
+        negate = !negate;
+      }
+    }
+    minors[{rowMask, columnMask}] = result;
+    return result;
+  }
+};
+} // namespace
+
+// the square or rectangular float matrix type, type_error if GLSL has none
+static AstType getMatrixAstType(ScalarKind scalar, unsigned rows,
+                                unsigned columns) {
+  if (columns == 1)
+    return getVectorAstType(scalar, rows);
+  for (const AstTypeInfo &info : astTypeInfos) {
+    if (info.scalar == scalar && info.rows == rows && info.columns == columns)
+      return info.type;
+  }
+  return type_error;
+}
+
+static Value *getColumn(Value *matrix, unsigned rows, unsigned column) {
+  SmallVector<int, 4> mask;
+  for (unsigned row = 0; row < rows; row++)
+    mask.push_back(column * rows + row);
+  return Builder->CreateShuffleVector(matrix, mask, "column");
+}
+
+// join equally wide columns into one flat matrix, pairwise so every
+// shufflevector sees two operands of the same width
+static Value *concatColumns(SmallVectorImpl<Value *> &columns) {
+  while (columns.size() > 1) {
+    SmallVector<Value *, 4> joined;
+    for (unsigned i = 0; i < columns.size(); i += 2) {
+      if (i + 1 == columns.size()) {
+        joined.push_back(columns[i]);
+        continue;
+      }
+      Value *first = columns[i];
+      Value *second = columns[i + 1];
+      unsigned firstWidth =
+          cast<FixedVectorType>(first->getType())->getNumElements();
+      unsigned secondWidth =
+          cast<FixedVectorType>(second->getType())->getNumElements();
+      SmallVector<int, 16> mask;
+      if (secondWidth < firstWidth) {
+        for (unsigned lane = 0; lane < firstWidth; lane++)
+          mask.push_back(lane < secondWidth ? (int)lane : -1);
+        second = Builder->CreateShuffleVector(second, mask, "widen");
+        mask.clear();
+      }
+      for (unsigned lane = 0; lane < firstWidth + secondWidth; lane++)
+        mask.push_back(lane);
+      joined.push_back(Builder->CreateShuffleVector(first, second, mask));
+    }
+    columns.assign(joined.begin(), joined.end());
+  }
+  return columns.front();
+}
+
+// sum of the columns of `matrix` scaled by the lanes of `vector`, one
+// broadcast and one multiply-add per column
+static Value *multiplyColumn(Value *matrix, unsigned rows, unsigned columns,
+                             Value *vector) {
+  Value *result = nullptr;
+  for (unsigned column = 0; column < columns; column++) {
+    SmallVector<int, 4> broadcast(rows, column);
+    Value *scale = Builder->CreateShuffleVector(vector, broadcast, "splat");
+    Value *product = getColumn(matrix, rows, column);
+    if (!result)
+      result = Builder->CreateFMul(product, scale);
+    else
+      result = emitMulAdd(product, scale, result);
+  }
+  return result;
+}
+
+bool isMatrixProduct(AstType left, AstType right) {
+  const AstTypeInfo &leftInfo = getAstTypeInfo(left);
+  const AstTypeInfo &rightInfo = getAstTypeInfo(right);
+  if (leftInfo.isMatrix())
+    return rightInfo.isMatrix() || rightInfo.isVector();
+  return leftInfo.isVector() && rightInfo.isMatrix();
+}
+
+AstType matrixProductType(AstType left, AstType right) {
+  const AstTypeInfo &leftInfo = getAstTypeInfo(left);
+  const AstTypeInfo &rightInfo = getAstTypeInfo(right);
+  if (leftInfo.isVector()) {
+    // a row vector times the matrix
+    if (leftInfo.rows != rightInfo.rows)
+      return type_error;
+    return getVectorAstType(leftInfo.scalar, rightInfo.columns);
+  }
+  if (leftInfo.columns != rightInfo.rows)
+    return type_error;
+  return getMatrixAstType(leftInfo.scalar, leftInfo.rows, rightInfo.columns);
+}
+
+Value *emitMatrixProduct(Value *left, AstType leftType, Value *right,
+                         AstType rightType) {
+  if (matrixProductType(leftType, rightType) == type_error) {
+    printf("Error: cannot multiply %s by %s\n",
+           astTypeToString(leftType).c_str(),
+           astTypeToString(rightType).c_str());
+    return nullptr;
+  }
+  const AstTypeInfo &leftInfo = getAstTypeInfo(leftType);
+  const AstTypeInfo &rightInfo = getAstTypeInfo(rightType);
+  if (leftInfo.isVector()) {
+    // v * M is the transpose of M times v
+    Value *transposed = emitTranspose(right, rightType);
+    return multiplyColumn(transposed, rightInfo.columns, rightInfo.rows, left);
+  }
+  if (rightInfo.isVector())
+    return multiplyColumn(left, leftInfo.rows, leftInfo.columns, right);
+  SmallVector<Value *, 4> columns;
+  for (unsigned column = 0; column < rightInfo.columns; column++)
+    columns.push_back(
+        multiplyColumn(left, leftInfo.rows, leftInfo.columns,
+                       getColumn(right, rightInfo.rows, column)));
+  return concatColumns(columns);
+}
+
+Value *emitTranspose(Value *matrix, AstType type) {
+  const AstTypeInfo &info = getAstTypeInfo(type);
+  SmallVector<int, 16> mask;
+  // lane (row, column) of the result is (column, row) of the argument
+  for (unsigned column = 0; column < info.rows; column++) {
+    for (unsigned row = 0; row < info.columns; row++)
+      mask.push_back(row * info.rows + column);
+  }
+  return Builder->CreateShuffleVector(matrix, mask, "transpose");
+}
+
+Value *emitDeterminant(Value *matrix, AstType type) {
+  const AstTypeInfo &info = getAstTypeInfo(type);
+  if (info.rows != info.columns) {
+    printf("Error: determinant of a non-square matrix\n");
+    return nullptr;
+  }
+  Elements elements(matrix, info.rows);
+  unsigned all = (1u << info.rows) - 1;
+  return elements.determinant(all, all);
+}
+
+Value *emitInverse(Value *matrix, AstType type) {
+  const AstTypeInfo &info = getAstTypeInfo(type);
+  if (info.rows != info.columns) {
+    printf("Error: inverse of a non-square matrix\n");
+    return nullptr;
+  }
+  // the adjugate over the determinant, the cofactors share their minors
+  // with the determinant expansion
+  Elements elements(matrix, info.rows);
+  unsigned all = (1u << info.rows) - 1;
+  Value *determinant = elements.determinant(all, all);
+  Value *scale = Builder->CreateFDiv(
+      ConstantFP::get(determinant->getType(), 1.0), determinant, "invdet");
+  Value *result = PoisonValue::get(matrix->getType());
+  for (unsigned column = 0; column < info.columns; column++) {
+    for (unsigned row = 0; row < info.rows; row++) {
+      // inverse (row, column) is the cofactor of (column, row)
+      Value *cofactor = elements.determinant(all & ~(1u << column),
+                                             all & ~(1u << row));
+      if ((row + column) % 2)
+        cofactor = Builder->CreateFNeg(cofactor);
+      result = Builder->CreateInsertElement(
+          result, Builder->CreateFMul(cofactor, scale),
+          column * info.rows + row);
+    }
+  }
+  return result;
+}
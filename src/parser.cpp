@@ -1,24 +1,29 @@
 #include "parser.h"
 #include "ast.h"
+#include "generator.h"
 #include "global.h"
 #include "tokenizer.h"
+#include "type_table.h"
 
 std::unique_ptr<TopLevelAST> topLevelAst = nullptr;
+uint32_t maxExpressionDepth = 1 << 18;
+uint32_t maxSentenceDepth = 256;
+// set once a nesting limit is hit, fails the rest of the parse
+static bool depthExceeded = false;
+static uint32_t sentenceDepth = 0;
 uint64_t index_temp = 0;
 extern std::vector<Token> tokens;
 extern TokenType CurTok;
 extern std::string IdentifierStr; // Filled in if tok_identifier
 extern std::string NumVal;        // Filled in if tok_number
 
-extern std::unique_ptr<LLVMContext> TheContext;
-extern std::unique_ptr<Module> TheModule;
-extern std::unique_ptr<IRBuilder<>> Builder;
+extern thread_local std::unique_ptr<LLVMContext> TheContext;
+extern thread_local std::unique_ptr<Module> TheModule;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
 extern std::map<std::string, Value *> NamedValues;
 
 using namespace ast;
 
-std::unique_ptr<ExpressionAST> ParseAssignmentExpression();
-
 void InitializeModule() {
   // Open a new context and module.
   TheContext = std::make_unique<LLVMContext>();
@@ -26,6 +31,12 @@ void InitializeModule() {
 
   // Create a new builder for the module.
   Builder = std::make_unique<IRBuilder<>>(*TheContext);
+  // every floating point instruction carries the flags of the precision mode
+  Builder->setFastMathFlags(getFastMathFlags(fpMode));
+
+  // Intern the llvm types of every AstType for this context.
+  TheTypes =
+      std::make_unique<TypeTable>(*TheContext, TheModule->getDataLayout());
 }
 
 std::unique_ptr<NumberExprAST> ParseNumberExpr() {
@@ -206,40 +217,12 @@ AstType ParseType() {
   // record
   uint64_t index_record = index_temp;
   // parse
-  switch (tokens[index_temp].type) {
-  case tok_int:
-    index_temp++;
-    return type_int;
-  case tok_float:
-    index_temp++;
-    return type_float;
-  case tok_double:
-    index_temp++;
-    return type_double;
-  case tok_void:
-    index_temp++;
-    return type_void;
-  case tok_bool:
-    index_temp++;
-    return type_bool;
-  case tok_mat2:
+  AstType type = getAstTypeFromToken(tokens[index_temp].type);
+  if (type != type_error) {
     index_temp++;
-    return type_mat2;
-  case tok_mat3:
-    index_temp++;
-    return type_mat3;
-  case tok_mat4:
-    index_temp++;
-    return type_mat4;
-  case tok_vec2:
-    index_temp++;
-    return type_vec2;
-  case tok_vec3:
-    index_temp++;
-    return type_vec3;
-  case tok_vec4:
-    index_temp++;
-    return type_vec4;
+    return type;
+  }
+  switch (tokens[index_temp].type) {
   case tok_number:
     if (tokens[index_temp].value->find('.') != std::string::npos) {
       if (tokens[index_temp].value->find('f') != std::string::npos) {
@@ -300,654 +283,10 @@ std::unique_ptr<GlobalVariableDefinitionAST> ParseLayoutVariableDefinition() {
   }
 
   // record
-  index_record = index_temp;
-  // parse
-  name = ParseIdentifier();
-  if (name == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type != tok_semicolon) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-  index_temp++;
-
-  return std::make_unique<GlobalVariableDefinitionAST>(
-      type, false, std::string(name->c_str()), nullptr, std::move(layout));
-};
-
-std::unique_ptr<GlobalVariableDefinitionAST> ParseGlobalVariableDefinition() {
-  AstType type;
-  std::unique_ptr<std::string> name;
-
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<LayoutAst> layout = ParseLayout();
-
-  if (layout == nullptr) {
-    // recover
-    index_temp = index_record;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  type = ParseType();
-  if (type == type_void || type == type_error) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  name = ParseIdentifier();
-  if (name == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type == tok_semicolon) {
-    index_temp++;
-    return std::make_unique<GlobalVariableDefinitionAST>(
-        type, false, std::string(name->c_str()), nullptr, std::move(layout));
-  }
-
-  // recover
-  index_temp = index_record;
-  return nullptr;
-};
-
-std::unique_ptr<VariableDefinitionAST> ParseVariableDefinition() {
-  AstType type;
-  std::unique_ptr<std::string> name;
-  std::unique_ptr<ExpressionAST> expression;
-  bool is_const = false;
-
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type == tok_const) {
-    // set const
-    is_const = true;
-    index_temp++;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  type = ParseType();
-  if (type == type_void || type == type_error) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  name = ParseIdentifier();
-  if (name == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type != tok_assign) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-  index_temp++;
-
-  // record
-  index_record = index_temp;
-  // parse
-  expression = ParseExpression();
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type != tok_semicolon) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-  // index_temp++;
-
-  return std::make_unique<VariableDefinitionAST>(
-      type, is_const, std::string(name->c_str()), std::move(expression));
-};
-
-std::unique_ptr<ExprListAST> ParseExprList() {
-  std::vector<std::unique_ptr<ExpressionAST>> expr_list;
-
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseAssignmentExpression();
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-  expr_list.push_back(std::move(expression));
-
-  // record
-  index_record = index_temp;
-  // parse
-  while (tokens[index_temp].type == tok_comma) {
-    // record
-    index_record = index_temp;
-    // parse
-    index_temp++;
-    expression = ParseAssignmentExpression();
-    if (expression == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expr_list.push_back(std::move(expression));
-  }
-
-  //  if (expr_list.size() == 1) {
-  //    return std::make_unique<ExprListAST>(std::move(
-  //        ((SequenceExpressionAST
-  //        *)(expr_list[0].release()))->getExpressions()));
-  //  }
-
-  return std::make_unique<ExprListAST>(std::move(expr_list));
-}
-
-std::unique_ptr<ExpressionAST> ParsePrimaryExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  if (tokens[index_temp].type == tok_identifier) {
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<std::string> name = ParseIdentifier();
-    if (name == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-
-    if (tokens[index_temp].type == tok_left_paren) {
-      index_temp++;
-      // record
-      index_record = index_temp;
-      // parse
-      std::unique_ptr<ExprListAST> expr_list = ParseExprList();
-      if (expr_list == nullptr) {
-        // recover
-        expr_list = std::make_unique<ExprListAST>();
-      }
-      if (tokens[index_temp].type != tok_right_paren) {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-      index_temp++;
-      return std::make_unique<FunctionCallAST>(std::string(name->c_str()),
-                                               std::move(expr_list));
-    } else if (tokens[index_temp].type == tok_left_bracket) {
-      index_temp++;
-      // record
-      index_record = index_temp;
-      // parse
-      std::unique_ptr<ExpressionAST> expression = ParseExpression();
-      if (expression == nullptr) {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-      if (tokens[index_temp].type != tok_right_bracket) {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-      index_temp++;
-      return std::make_unique<VariableIndexExprAST>(std::string(name->c_str()),
-                                                    std::move(expression));
-    } else {
-      return std::make_unique<VariableExprAST>(std::string(name->c_str()));
-    }
-  } else if (isAstType(tokens[index_temp].type)) {
-    // record
-    index_record = index_temp;
-    // parse
-    AstType type = ParseType();
-    if (type == type_void || type == type_error) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-
-    // record
-    index_record = index_temp;
-    if (tokens[index_temp].type == tok_left_paren) {
-      index_temp++;
-      // record
-      index_record = index_temp;
-      // parse
-      std::unique_ptr<ExprListAST> expr_list = ParseExprList();
-      if (expr_list == nullptr) {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-      if (tokens[index_temp].type != tok_right_paren) {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-      index_temp++;
-      return std::make_unique<TypeConstructorAST>(type, std::move(expr_list));
-    }
-  } else if (tokens[index_temp].type == tok_number ||
-             tokens[index_temp].type == tok_float ||
-             tokens[index_temp].type == tok_double ||
-             tokens[index_temp].type == tok_int) {
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<NumberExprAST> number = ParseNumberExpr();
-    if (number == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    return std::move(number);
-  } else if (tokens[index_temp].type == tok_left_paren) {
-    // record
-    index_record = index_temp;
-    // parse
-    index_temp++;
-    std::unique_ptr<ExpressionAST> expression = ParseExpression();
-    if (expression == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    if (tokens[index_temp].type != tok_right_paren) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    index_temp++;
-    return std::move(expression);
-  } else {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // recover
-  index_temp = index_record;
-  return nullptr;
-}
-
-std::unique_ptr<ExpressionAST> ParsePostfixExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParsePrimaryExpression();
-  // LOG(expression);
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  TokenType tokenType;
-  // parse
-  while (isPostfix(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    if (tokenType == tok_dot) {
-      // record
-      index_record = index_temp;
-      // parse
-      index_temp++;
-      if (tokens[index_temp].type == tok_identifier) {
-        // record
-        index_record = index_temp;
-        // parse
-        std::unique_ptr<std::string> name = ParseIdentifier();
-        if (name == nullptr) {
-          // recover
-          index_temp = index_record;
-          return nullptr;
-        }
-        expression = std::make_unique<PostfixExpressionAST>(
-            tokenToExprType(tokenType), std::move(expression));
-        ((PostfixExpressionAST *)expression.get())
-            ->setIdentifier(std::string(name->c_str()));
-      } else {
-        // recover
-        index_temp = index_record;
-        return nullptr;
-      }
-    } else {
-      // record
-      index_record = index_temp;
-      // parse
-      index_temp++;
-      return std::make_unique<PostfixExpressionAST>(
-          tokenType == tok_plus_p ? plus_p_expr : minus_m_expr,
-          std::move(expression));
-    }
-  }
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParsePrefixExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  if (isPrefix(tokens[index_temp].type)) {
-    TokenType tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression = ParsePrefixExpression();
-    if (expression == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    return std::make_unique<PrefixExpressionAST>(tokenToExprType(tokenType),
-                                                 std::move(expression));
-  } else {
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression = ParsePostfixExpression();
-    if (expression == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    return expression;
-  }
-}
-
-std::unique_ptr<ExpressionAST> ParseMultiplicativeExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParsePrefixExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  TokenType tokenType;
-  while (isMultiplicative(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParsePrefixExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        tokenToExprType(tokenType), std::move(expression),
-        std::move(expression_));
-  }
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseAdditiveExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseMultiplicativeExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  TokenType tokenType;
-  while (isAdditive(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ =
-        ParseMultiplicativeExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        tokenToExprType(tokenType), std::move(expression),
-        std::move(expression_));
-  }
-
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseShiftExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseAdditiveExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  TokenType tokenType;
-  while (isShift(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseAdditiveExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        tokenToExprType(tokenType), std::move(expression),
-        std::move(expression_));
-  }
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseRelationalExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseShiftExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  TokenType tokenType;
-  while (isRelational(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseShiftExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        tokenToExprType(tokenType), std::move(expression),
-        std::move(expression_));
-  }
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseEqualityExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseRelationalExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  TokenType tokenType;
-  while (isEuqality(tokens[index_temp].type)) {
-    tokenType = tokens[index_temp].type;
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseRelationalExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        tokenToExprType(tokenType), std::move(expression),
-        std::move(expression_));
-  }
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseBitwiseAndExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseEqualityExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  while (tokens[index_temp].type == tok_bit_and) {
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseEqualityExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        bit_and_expr, std::move(expression), std::move(expression_));
-  }
-
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseBitwiseExclusiveOrExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseBitwiseAndExpression();
-
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
-
-  // record
-  index_record = index_temp;
-  // parse
-  while (tokens[index_temp].type == tok_bit_xor) {
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseBitwiseAndExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        bit_xor_expr, std::move(expression), std::move(expression_));
-  }
-
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseBitwiseInlusiveOrExpression() {
-  // record
-  uint64_t index_record = index_temp;
+  index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression =
-      ParseBitwiseExclusiveOrExpression();
-
-  if (expression == nullptr) {
+  name = ParseIdentifier();
+  if (name == nullptr) {
     // recover
     index_temp = index_record;
     return nullptr;
@@ -956,66 +295,45 @@ std::unique_ptr<ExpressionAST> ParseBitwiseInlusiveOrExpression() {
   // record
   index_record = index_temp;
   // parse
-  while (tokens[index_temp].type == tok_bit_or) {
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ =
-        ParseBitwiseExclusiveOrExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        bit_or_expr, std::move(expression), std::move(expression_));
+  if (tokens[index_temp].type != tok_semicolon) {
+    // recover
+    index_temp = index_record;
+    return nullptr;
   }
+  index_temp++;
 
-  return expression;
-}
+  return std::make_unique<GlobalVariableDefinitionAST>(
+      type, false, std::string(name->c_str()), nullptr, std::move(layout));
+};
+
+std::unique_ptr<GlobalVariableDefinitionAST> ParseGlobalVariableDefinition() {
+  AstType type;
+  std::unique_ptr<std::string> name;
+  std::unique_ptr<ExpressionAST> expression;
+  bool is_const = false;
 
-std::unique_ptr<ExpressionAST> ParseLogicalAndExpression() {
   // record
   uint64_t index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression =
-      ParseBitwiseInlusiveOrExpression();
+  std::unique_ptr<LayoutAst> layout = ParseLayout();
 
-  if (expression == nullptr) {
+  if (layout == nullptr) {
     // recover
     index_temp = index_record;
-    return nullptr;
   }
 
-  // record
-  index_record = index_temp;
   // parse
-  while (tokens[index_temp].type == tok_and) {
+  if (tokens[index_temp].type == tok_const) {
+    // set const
+    is_const = true;
     index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ =
-        ParseBitwiseInlusiveOrExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        and_expr, std::move(expression), std::move(expression_));
   }
 
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseLogicalExclusiveOrExpression() {
   // record
-  uint64_t index_record = index_temp;
+  index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression = ParseLogicalAndExpression();
-  if (expression == nullptr) {
+  type = ParseType();
+  if (type == type_void || type == type_error) {
     // recover
     index_temp = index_record;
     return nullptr;
@@ -1024,31 +342,8 @@ std::unique_ptr<ExpressionAST> ParseLogicalExclusiveOrExpression() {
   // record
   index_record = index_temp;
   // parse
-  while (tokens[index_temp].type == tok_xor) {
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseLogicalAndExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
-    }
-    expression = std::make_unique<BinaryExpressionAST>(
-        xor_expr, std::move(expression), std::move(expression_));
-  }
-
-  return expression;
-}
-
-std::unique_ptr<ExpressionAST> ParseLogicalInclusiveOrExpression() {
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression =
-      ParseLogicalExclusiveOrExpression();
-  if (expression == nullptr) {
+  name = ParseIdentifier();
+  if (name == nullptr) {
     // recover
     index_temp = index_record;
     return nullptr;
@@ -1057,54 +352,63 @@ std::unique_ptr<ExpressionAST> ParseLogicalInclusiveOrExpression() {
   // record
   index_record = index_temp;
   // parse
-  while (tokens[index_temp].type == tok_or) {
+  if (tokens[index_temp].type == tok_assign) {
     index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ =
-        ParseLogicalExclusiveOrExpression();
-    if (expression_ == nullptr) {
+    expression = ParseExpression();
+    if (expression == nullptr) {
       // recover
       index_temp = index_record;
       return nullptr;
     }
-    expression = std::make_unique<BinaryExpressionAST>(
-        or_expr, std::move(expression), std::move(expression_));
+  } else if (is_const) {
+    // a const needs its value
+    index_temp = index_record;
+    return nullptr;
   }
 
-  return expression;
-}
+  // parse
+  if (tokens[index_temp].type == tok_semicolon) {
+    index_temp++;
+    return std::make_unique<GlobalVariableDefinitionAST>(
+        type, is_const, std::string(name->c_str()), std::move(expression),
+        std::move(layout));
+  }
+
+  // recover
+  index_temp = index_record;
+  return nullptr;
+};
 
-std::unique_ptr<ExpressionAST> ParseAssignmentExpression();
+std::unique_ptr<VariableDefinitionAST> ParseVariableDefinition() {
+  AstType type;
+  std::unique_ptr<std::string> name;
+  std::unique_ptr<ExpressionAST> expression;
+  bool is_const = false;
 
-std::unique_ptr<ExpressionAST> ParseConditionalExpression() {
   // record
   uint64_t index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression =
-      ParseLogicalInclusiveOrExpression();
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
+  if (tokens[index_temp].type == tok_const) {
+    // set const
+    is_const = true;
+    index_temp++;
   }
 
   // record
   index_record = index_temp;
   // parse
-  if (tokens[index_temp].type != tok_unary) {
+  type = ParseType();
+  if (type == type_void || type == type_error) {
     // recover
     index_temp = index_record;
-    return expression;
+    return nullptr;
   }
 
-  index_temp++;
   // record
   index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression_ = ParseExpression();
-  if (expression_ == nullptr) {
+  name = ParseIdentifier();
+  if (name == nullptr) {
     // recover
     index_temp = index_record;
     return nullptr;
@@ -1113,7 +417,7 @@ std::unique_ptr<ExpressionAST> ParseConditionalExpression() {
   // record
   index_record = index_temp;
   // parse
-  if (tokens[index_temp].type != tok_colon) {
+  if (tokens[index_temp].type != tok_assign) {
     // recover
     index_temp = index_record;
     return nullptr;
@@ -1123,113 +427,368 @@ std::unique_ptr<ExpressionAST> ParseConditionalExpression() {
   // record
   index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression__ = ParseAssignmentExpression();
-  if (expression__ == nullptr) {
+  expression = ParseExpression();
+  if (expression == nullptr) {
     // recover
     index_temp = index_record;
     return nullptr;
   }
 
-  return std::make_unique<ConditionalExpressionAST>(
-      std::move(expression), std::move(expression_), std::move(expression__));
-};
-
-std::unique_ptr<ExpressionAST> ParseAssignmentExpression() {
   // record
-  uint64_t index_record = index_temp;
+  index_record = index_temp;
   // parse
-  std::unique_ptr<ExpressionAST> expression = ParseConditionalExpression();
-  if (expression == nullptr) {
+  if (tokens[index_temp].type != tok_semicolon) {
     // recover
     index_temp = index_record;
     return nullptr;
   }
+  // index_temp++;
 
-  TokenType tokenType = tokens[index_temp].type;
+  return std::make_unique<VariableDefinitionAST>(
+      type, is_const, std::string(name->c_str()), std::move(expression));
+};
 
-  // record
-  index_record = index_temp;
-  // parse
-  if (!isAssignment(tokens[index_temp].type)) {
-    return expression;
-  }
+namespace {
+// binding levels of the expression grammar, higher binds tighter
+enum ExprLevel {
+  level_none = 0, // not an operator, ends the current operand
+  level_sequence,
+  level_assignment,
+  level_conditional,
+  level_logical_or,
+  level_logical_xor,
+  level_logical_and,
+  level_bit_or,
+  level_bit_xor,
+  level_bit_and,
+  level_equality,
+  level_relational,
+  level_shift,
+  level_additive,
+  level_multiplicative,
+};
 
-  index_temp++;
+enum ExprFrameKind {
+  frame_binary,      // lhs op [operand]
+  frame_assignment,  // lhs op [operand], right associative
+  frame_prefix,      // op [operand]
+  frame_sequence,    // list, [operand]
+  frame_then,        // lhs ? [operand] :
+  frame_else,        // lhs ? mid : [operand]
+  frame_paren,       // ( [operand] )
+  frame_index,       // name[ [operand] ]
+  frame_call,        // name(list, [operand])
+  frame_constructor, // type(list, [operand])
+};
 
-  // record
-  index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression_ = ParseConditionalExpression();
-  if (expression_ == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
+// an expression that is still waiting for its next operand
+struct ExprFrame {
+  ExprFrameKind kind;
+  ExprType op;
+  int level;
+  std::unique_ptr<ExpressionAST> lhs;
+  std::unique_ptr<ExpressionAST> mid;
+  std::vector<std::unique_ptr<ExpressionAST>> list;
+  std::string name;
+  AstType type = type_error;
+
+  explicit ExprFrame(ExprFrameKind kind, ExprType op = unknown_expr,
+                     int level = level_none)
+      : kind(kind), op(op), level(level) {}
+};
+} // namespace
+
+static int getExprLevel(TokenType token) {
+  if (token == tok_comma)
+    return level_sequence;
+  if (isAssignment(token))
+    return level_assignment;
+  if (isEuqality(token))
+    return level_equality;
+  if (isRelational(token))
+    return level_relational;
+  if (isShift(token))
+    return level_shift;
+  if (isAdditive(token))
+    return level_additive;
+  if (isMultiplicative(token))
+    return level_multiplicative;
+  switch (token) {
+  case tok_unary:
+    return level_conditional;
+  case tok_or:
+    return level_logical_or;
+  case tok_xor:
+    return level_logical_xor;
+  case tok_and:
+    return level_logical_and;
+  case tok_bit_or:
+    return level_bit_or;
+  case tok_bit_xor:
+    return level_bit_xor;
+  case tok_bit_and:
+    return level_bit_and;
+  default:
+    return level_none;
   }
+}
 
-  return std::unique_ptr<ExpressionAST>(
-      (ExpressionAST *)new BinaryExpressionAST(tokenToExprType(tokenType),
-                                               std::move(expression),
-                                               std::move(expression_)));
+// whether the operator on top has to be closed before one of `level`
+static bool shouldReduce(const ExprFrame &frame, int level) {
+  switch (frame.kind) {
+  case frame_prefix:
+    return true;
+  case frame_binary:
+    return level <= frame.level;
+  case frame_assignment:
+  case frame_else:
+    return level < level_assignment;
+  case frame_sequence:
+    return level < level_sequence;
+  default:
+    return false;
+  }
 }
 
-std::unique_ptr<ExpressionAST> ParseSequenceExpression() {
-  std::vector<std::unique_ptr<ExpressionAST>> sequence_expr;
-  // record
-  uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseAssignmentExpression();
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
+static std::unique_ptr<ExpressionAST>
+reduceFrame(ExprFrame &frame, std::unique_ptr<ExpressionAST> operand) {
+  switch (frame.kind) {
+  case frame_binary:
+  case frame_assignment:
+    return std::make_unique<BinaryExpressionAST>(
+        frame.op, std::move(frame.lhs), std::move(operand));
+  case frame_prefix:
+    return std::make_unique<PrefixExpressionAST>(frame.op, std::move(operand));
+  case frame_else:
+    return std::make_unique<ConditionalExpressionAST>(
+        std::move(frame.lhs), std::move(frame.mid), std::move(operand));
+  case frame_sequence:
+    frame.list.push_back(std::move(operand));
+    return std::make_unique<SequenceExpressionAST>(std::move(frame.list));
+  default:
     return nullptr;
   }
+}
 
-  sequence_expr.push_back(std::move(expression));
-
-  // record
-  index_record = index_temp;
+std::unique_ptr<ExpressionAST>
+ParsePostfixExpression(std::unique_ptr<ExpressionAST> expression) {
+  TokenType tokenType;
   // parse
-  while (tokens[index_temp].type == tok_comma) {
-    index_temp++;
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<ExpressionAST> expression_ = ParseAssignmentExpression();
-    if (expression_ == nullptr) {
-      // recover
-      index_temp = index_record;
-      return nullptr;
+  while (isPostfix(tokens[index_temp].type)) {
+    tokenType = tokens[index_temp].type;
+    if (tokenType == tok_dot) {
+      index_temp++;
+      if (tokens[index_temp].type != tok_identifier)
+        return nullptr;
+      std::unique_ptr<std::string> name = ParseIdentifier();
+      if (name == nullptr)
+        return nullptr;
+      expression = std::make_unique<PostfixExpressionAST>(
+          tokenToExprType(tokenType), std::move(expression));
+      ((PostfixExpressionAST *)expression.get())
+          ->setIdentifier(std::string(name->c_str()));
+    } else {
+      index_temp++;
+      return std::make_unique<PostfixExpressionAST>(
+          tokenType == tok_plus_p ? plus_p_expr : minus_m_expr,
+          std::move(expression));
     }
-
-    // combine
-    sequence_expr.push_back(std::move(expression_));
-  }
-
-  if (sequence_expr.size() == 1) {
-    return std::move(sequence_expr[0]);
   }
-
-  return std::make_unique<SequenceExpressionAST>(std::move(sequence_expr));
+  return expression;
 }
 
+// operator precedence parser over explicit stacks, nesting only grows the
+// heap allocated `frames` and is capped by maxExpressionDepth
 std::unique_ptr<ExpressionAST> ParseExpression() {
+  if (depthExceeded)
+    return nullptr;
   // record
   uint64_t index_record = index_temp;
-  // parse
-  std::unique_ptr<ExpressionAST> expression = ParseSequenceExpression();
+  std::vector<ExprFrame> frames;
+  // operators inside a bracket must bind tighter than the bracket's floor
+  std::vector<int> floors = {level_none};
+  std::unique_ptr<ExpressionAST> operand;
+
+  auto push = [&](ExprFrame frame) {
+    if (frames.size() >= maxExpressionDepth) {
+      printf("Error: expression nested deeper than %u levels\n",
+             maxExpressionDepth);
+      depthExceeded = true;
+      return false;
+    }
+    frames.push_back(std::move(frame));
+    return true;
+  };
+  auto pushGroup = [&](ExprFrame frame, int floor) {
+    floors.push_back(floor);
+    return push(std::move(frame));
+  };
 
-  if (expression == nullptr) {
-    // recover
-    index_temp = index_record;
-    return nullptr;
-  }
+  while (true) {
+    TokenType tokenType = tokens[index_temp].type;
+    if (operand == nullptr) {
+      // prefix operators, then a primary expression
+      if (isPrefix(tokenType)) {
+        index_temp++;
+        if (!push(ExprFrame(frame_prefix, tokenToExprType(tokenType))))
+          break;
+        continue;
+      }
+      if (tokenType == tok_identifier) {
+        std::unique_ptr<std::string> name = ParseIdentifier();
+        if (name == nullptr)
+          break;
+        if (tokens[index_temp].type == tok_left_paren) {
+          index_temp++;
+          if (tokens[index_temp].type == tok_right_paren) {
+            index_temp++;
+            operand = std::make_unique<FunctionCallAST>(
+                std::string(name->c_str()), std::make_unique<ExprListAST>());
+          } else {
+            ExprFrame frame(frame_call);
+            frame.name = *name;
+            if (!pushGroup(std::move(frame), level_sequence))
+              break;
+            continue;
+          }
+        } else if (tokens[index_temp].type == tok_left_bracket) {
+          index_temp++;
+          ExprFrame frame(frame_index);
+          frame.name = *name;
+          if (!pushGroup(std::move(frame), level_none))
+            break;
+          continue;
+        } else {
+          operand =
+              std::make_unique<VariableExprAST>(std::string(name->c_str()));
+        }
+      } else if (isAstType(tokenType)) {
+        AstType type = ParseType();
+        if (type == type_void || type == type_error ||
+            tokens[index_temp].type != tok_left_paren)
+          break;
+        index_temp++;
+        ExprFrame frame(frame_constructor);
+        frame.type = type;
+        if (!pushGroup(std::move(frame), level_sequence))
+          break;
+        continue;
+      } else if (tokenType == tok_left_paren) {
+        index_temp++;
+        if (!pushGroup(ExprFrame(frame_paren), level_none))
+          break;
+        continue;
+      } else {
+        operand = ParseNumberExpr();
+        if (operand == nullptr)
+          break;
+      }
+      operand = ParsePostfixExpression(std::move(operand));
+      if (operand == nullptr)
+        break;
+      continue;
+    }
+
+    // close the operators that bind at least as tight as the next one
+    int level = getExprLevel(tokenType);
+    while (!frames.empty() && shouldReduce(frames.back(), level)) {
+      operand = reduceFrame(frames.back(), std::move(operand));
+      frames.pop_back();
+    }
 
-  // LOG(expression);
+    if (level > floors.back()) {
+      index_temp++;
+      if (level == level_sequence && !frames.empty() &&
+          frames.back().kind == frame_sequence) {
+        frames.back().list.push_back(std::move(operand));
+        continue;
+      }
+      bool pushed;
+      if (level == level_sequence) {
+        ExprFrame frame(frame_sequence, sequence_expr, level);
+        frame.list.push_back(std::move(operand));
+        pushed = push(std::move(frame));
+      } else if (level == level_conditional) {
+        ExprFrame frame(frame_then);
+        frame.lhs = std::move(operand);
+        pushed = pushGroup(std::move(frame), level_none);
+      } else {
+        ExprFrame frame(level == level_assignment ? frame_assignment
+                                                  : frame_binary,
+                        tokenToExprType(tokenType), level);
+        frame.lhs = std::move(operand);
+        pushed = push(std::move(frame));
+      }
+      if (!pushed)
+        break;
+      continue;
+    }
 
-  return expression;
+    // the operand ends here, it closes the innermost bracket or the whole
+    // expression
+    if (frames.empty())
+      return operand;
+    ExprFrame &frame = frames.back();
+    if (frame.kind == frame_then) {
+      if (tokenType != tok_colon)
+        break;
+      index_temp++;
+      frame.kind = frame_else;
+      frame.mid = std::move(operand);
+      floors.pop_back();
+      continue;
+    }
+    if ((frame.kind == frame_call || frame.kind == frame_constructor) &&
+        tokenType == tok_comma) {
+      index_temp++;
+      frame.list.push_back(std::move(operand));
+      continue;
+    }
+    TokenType closing =
+        frame.kind == frame_index ? tok_right_bracket : tok_right_paren;
+    if (tokenType != closing)
+      break;
+    index_temp++;
+    if (frame.kind == frame_index) {
+      operand = std::make_unique<VariableIndexExprAST>(frame.name,
+                                                       std::move(operand));
+    } else if (frame.kind == frame_call) {
+      frame.list.push_back(std::move(operand));
+      operand = std::make_unique<FunctionCallAST>(
+          frame.name, std::make_unique<ExprListAST>(std::move(frame.list)));
+    } else if (frame.kind == frame_constructor) {
+      frame.list.push_back(std::move(operand));
+      operand = std::make_unique<TypeConstructorAST>(
+          frame.type, std::make_unique<ExprListAST>(std::move(frame.list)));
+    }
+    frames.pop_back();
+    floors.pop_back();
+    operand = ParsePostfixExpression(std::move(operand));
+    if (operand == nullptr)
+      break;
+  }
+
+  // recover
+  index_temp = index_record;
+  return nullptr;
 }
 
+// sentences nest through native recursion, so they get their own limit
+struct SentenceDepthGuard {
+  SentenceDepthGuard() { sentenceDepth++; }
+  ~SentenceDepthGuard() { sentenceDepth--; }
+};
+
 std::unique_ptr<SentenceAST> ParseSentence() {
+  SentenceDepthGuard depthGuard;
+  if (depthExceeded)
+    return nullptr;
+  if (sentenceDepth > maxSentenceDepth) {
+    printf("Error: sentences nested deeper than %u levels\n",
+           maxSentenceDepth);
+    depthExceeded = true;
+    return nullptr;
+  }
   // record
   uint64_t index_record = index_temp;
   // parse
@@ -1590,6 +1149,33 @@ int ParseVersion() {
   return version;
 }
 
+std::unique_ptr<DefinitionAST> ParseDefinition() {
+  depthExceeded = false;
+  // record
+  uint64_t index_record = index_temp;
+  std::unique_ptr<FunctionDefinitionAST> functionAST =
+      ParseFunctionDefinition();
+  if (functionAST != nullptr) {
+    if (depthExceeded)
+      return nullptr;
+    return functionAST;
+  }
+  // recover
+  index_temp = index_record;
+
+  // parse
+  std::unique_ptr<GlobalVariableDefinitionAST> layoutVariableDefinition =
+      ParseGlobalVariableDefinition();
+  if (layoutVariableDefinition == nullptr) {
+    // recover
+    index_temp = index_record;
+    return nullptr;
+  }
+  if (depthExceeded)
+    return nullptr;
+  return layoutVariableDefinition;
+}
+
 std::unique_ptr<std::vector<std::unique_ptr<DefinitionAST>>>
 ParseDefinitions() {
   std::unique_ptr<std::vector<std::unique_ptr<DefinitionAST>>> definitionASTs =
@@ -1600,33 +1186,16 @@ ParseDefinitions() {
     if (tokens[index_temp].type == tok_eof) { // end
       return definitionASTs;
     }
-    // record
-    uint64_t index_record = index_temp;
-    std::unique_ptr<FunctionDefinitionAST> functionAST =
-        ParseFunctionDefinition();
-    if (functionAST != nullptr) {
-      definitionASTs->push_back(std::move(functionAST));
-      continue;
-    }
-    // recover
-    index_temp = index_record;
-
-    // record
-    index_record = index_temp;
-    // parse
-    std::unique_ptr<GlobalVariableDefinitionAST> layoutVariableDefinition =
-        ParseGlobalVariableDefinition();
-    if (layoutVariableDefinition == nullptr) {
-      // recover
-      index_temp = index_record;
+    std::unique_ptr<DefinitionAST> definitionAST = ParseDefinition();
+    if (definitionAST == nullptr)
       return nullptr;
-    }
-    definitionASTs->push_back(std::move(layoutVariableDefinition));
+    definitionASTs->push_back(std::move(definitionAST));
   }
 }
 
 int parseAST() {
   int version = 0;
+  depthExceeded = false;
   std::unique_ptr<std::vector<std::unique_ptr<DefinitionAST>>> definitionASTs =
       std::make_unique<std::vector<std::unique_ptr<DefinitionAST>>>();
 
@@ -1642,11 +1211,13 @@ int parseAST() {
 
   definitionASTs = ParseDefinitions();
 
-  if (definitionASTs == nullptr || definitionASTs->empty()) {
+  if (definitionASTs == nullptr || definitionASTs->empty() ||
+      depthExceeded) {
     return -1;
   }
 
   topLevelAst =
       std::make_unique<TopLevelAST>(version, std::move(definitionASTs));
+  topLevelAst->index();
   return 0;
 };
\ No newline at end of file
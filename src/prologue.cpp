@@ -0,0 +1,239 @@
+#include "prologue.h"
+#include "abi.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <vector>
+
+using namespace ast;
+
+namespace {
+class UniformValues {
+  const DataLayout &layout;
+  Argument *context;
+  // the bytes of the context holding uniforms
+  std::vector<std::pair<uint64_t, uint64_t>> fields;
+  SmallPtrSet<const Instruction *, 32> uniform;
+  // the offsets of the uniform loads
+  DenseMap<const LoadInst *, uint64_t> loads;
+  DenseMap<const Instruction *, bool> worthMoving;
+
+  bool isUniformLoad(const LoadInst &load, uint64_t &offset) const;
+  bool isUniformOperand(const Use &use) const;
+
+public:
+  UniformValues(Function &entry, StructType *contextType,
+                const std::vector<unsigned> &uniformFields);
+
+  bool isUniform(const Instruction *instruction) const {
+    return uniform.count(instruction);
+  }
+  bool isWorthMoving(const Instruction *instruction);
+  Value *clone(Value *value, IRBuilder<> &builder, Argument *copyContext,
+               DenseMap<Value *, Value *> &copies) const;
+};
+} // namespace
+
+bool isPlainConstant(const Value *value) {
+  auto *constant = dyn_cast<Constant>(value);
+  if (!constant || isa<GlobalValue>(constant))
+    return false;
+  for (const Use &operand : constant->operands()) {
+    if (!isPlainConstant(operand.get()))
+      return false;
+  }
+  return true;
+}
+
+UniformValues::UniformValues(Function &entry, StructType *contextType,
+                             const std::vector<unsigned> &uniformFields)
+    : layout(entry.getParent()->getDataLayout()), context(entry.getArg(0)) {
+  const StructLayout *structLayout = layout.getStructLayout(contextType);
+  for (unsigned field : uniformFields) {
+    uint64_t begin = structLayout->getElementOffset(field);
+    uint64_t size =
+        layout.getTypeStoreSize(contextType->getElementType(field));
+    fields.push_back({begin, begin + size});
+  }
+
+  // operands come before their users but for phis, which are not uniform
+  PostDominatorTree postDominators(entry);
+  ReversePostOrderTraversal<Function *> order(&entry);
+  for (BasicBlock *block : order) {
+    bool always = postDominators.dominates(block, &entry.getEntryBlock());
+    for (Instruction &instruction : *block) {
+      if (auto *load = dyn_cast<LoadInst>(&instruction)) {
+        uint64_t offset;
+        if (isUniformLoad(*load, offset)) {
+          uniform.insert(load);
+          loads[load] = offset;
+        }
+        continue;
+      }
+      if (isa<PHINode>(instruction) || instruction.isTerminator() ||
+          instruction.getType()->isVoidTy() ||
+          instruction.mayReadOrWriteMemory())
+        continue;
+      if (!isSafeToSpeculativelyExecute(&instruction) &&
+          !(always && !instruction.mayHaveSideEffects()))
+        continue;
+      if (all_of(instruction.operands(),
+                 [&](const Use &use) { return isUniformOperand(use); }))
+        uniform.insert(&instruction);
+    }
+  }
+}
+
+bool movesLanes(const Instruction &instruction) {
+  return isa<CastInst>(instruction) || isa<ExtractElementInst>(instruction) ||
+         isa<InsertElementInst>(instruction) ||
+         isa<ShuffleVectorInst>(instruction) ||
+         isa<ExtractValueInst>(instruction) ||
+         isa<InsertValueInst>(instruction);
+}
+
+bool UniformValues::isUniformLoad(const LoadInst &load,
+                                  uint64_t &offset) const {
+  if (!load.isSimple())
+    return false;
+  APInt bytes(layout.getIndexTypeSizeInBits(load.getPointerOperandType()),
+              0);
+  const Value *base =
+      load.getPointerOperand()->stripAndAccumulateConstantOffsets(
+          layout, bytes, /*AllowNonInbounds=*/true);
+  if (base != context || bytes.isNegative())
+    return false;
+  offset = bytes.getZExtValue();
+  uint64_t end = offset + layout.getTypeStoreSize(load.getType());
+  for (auto &field : fields) {
+    if (offset >= field.first && end <= field.second)
+      return true;
+  }
+  return false;
+}
+
+bool UniformValues::isUniformOperand(const Use &use) const {
+  if (auto *call = dyn_cast<CallBase>(use.getUser())) {
+    if (call->isCallee(&use))
+      return isa<Function>(use.get());
+  }
+  if (auto *instruction = dyn_cast<Instruction>(use.get()))
+    return uniform.count(instruction);
+  return isPlainConstant(use.get());
+}
+
+// whether the value does more than load uniforms and move their lanes
+bool UniformValues::isWorthMoving(const Instruction *instruction) {
+  if (isa<LoadInst>(instruction))
+    return false;
+  auto found = worthMoving.find(instruction);
+  if (found != worthMoving.end())
+    return found->second;
+  bool worth = !movesLanes(*instruction);
+  for (const Use &operand : instruction->operands()) {
+    if (worth)
+      break;
+    if (auto *uniformOperand = dyn_cast<Instruction>(operand.get()))
+      worth = isWorthMoving(uniformOperand);
+  }
+  worthMoving[instruction] = worth;
+  return worth;
+}
+
+// the uniform `value` computed again at `builder`, loading from
+// `copyContext`
+Value *UniformValues::clone(Value *value, IRBuilder<> &builder,
+                            Argument *copyContext,
+                            DenseMap<Value *, Value *> &copies) const {
+  if (isa<Constant>(value))
+    return value;
+  auto found = copies.find(value);
+  if (found != copies.end())
+    return found->second;
+  auto *instruction = cast<Instruction>(value);
+  Value *copy;
+  if (auto *load = dyn_cast<LoadInst>(instruction)) {
+    Value *field = builder.CreateConstInBoundsGEP1_64(
+        builder.getInt8Ty(), copyContext, loads.lookup(load));
+    copy = builder.CreateAlignedLoad(load->getType(), field, load->getAlign(),
+                                     load->getName());
+  } else {
+    Instruction *cloned = instruction->clone();
+    for (unsigned i = 0; i < cloned->getNumOperands(); i++)
+      cloned->setOperand(i, clone(instruction->getOperand(i), builder,
+                                  copyContext, copies));
+    copy = builder.Insert(cloned, instruction->getName());
+  }
+  copies[value] = copy;
+  return copy;
+}
+
+unsigned hoistUniformWork(const TopLevelAST &program, Module &module,
+                          const std::string &entry) {
+  Function *function = module.getFunction(entry);
+  Function *prologue = module.getFunction(entry + "_prologue");
+  GlobalVariable *drawSize = module.getNamedGlobal(entry + "_draw_size");
+  StructType *contextType =
+      StructType::getTypeByName(module.getContext(), entry + "_context");
+  if (!function || function->isDeclaration() || !prologue || !drawSize ||
+      !contextType)
+    return 0;
+  UniformValues values(*function, contextType, getUniformFields(program));
+
+  // the uniform values the invocation uses, in the order they are defined
+  std::vector<Instruction *> hoisted;
+  for (BasicBlock *block : ReversePostOrderTraversal<Function *>(function)) {
+    for (Instruction &instruction : *block) {
+      if (!values.isUniform(&instruction) ||
+          !values.isWorthMoving(&instruction))
+        continue;
+      if (any_of(instruction.users(), [&](const User *user) {
+            return !values.isUniform(cast<Instruction>(user));
+          }))
+        hoisted.push_back(&instruction);
+    }
+  }
+
+  // the prologue stores them in the draw buffer, aligned to at most the
+  // 16 bytes malloc guarantees
+  const DataLayout &layout = module.getDataLayout();
+  IRBuilder<> builder(prologue->getEntryBlock().getTerminator());
+  DenseMap<Value *, Value *> copies;
+  std::vector<std::pair<uint64_t, Align>> slots;
+  uint64_t size = 0;
+  for (Instruction *instruction : hoisted) {
+    Type *type = instruction->getType();
+    Align align = std::min(layout.getABITypeAlign(type), Align(16));
+    uint64_t offset = alignTo(size, align);
+    size = offset + layout.getTypeStoreSize(type);
+    Value *copy =
+        values.clone(instruction, builder, prologue->getArg(0), copies);
+    builder.CreateAlignedStore(
+        copy,
+        builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(),
+                                           prologue->getArg(1), offset),
+        align);
+    slots.push_back({offset, align});
+  }
+
+  // and the entry point loads them back, its own computation goes dead
+  builder.SetInsertPoint(&*function->getEntryBlock().getFirstInsertionPt());
+  for (size_t i = 0; i < hoisted.size(); i++) {
+    Value *slot = builder.CreateConstInBoundsGEP1_64(
+        builder.getInt8Ty(), function->getArg(1), slots[i].first);
+    Value *value = builder.CreateAlignedLoad(hoisted[i]->getType(), slot,
+                                             slots[i].second,
+                                             hoisted[i]->getName());
+    hoisted[i]->replaceAllUsesWith(value);
+  }
+  for (Instruction *instruction : hoisted)
+    RecursivelyDeleteTriviallyDeadInstructions(instruction);
+  drawSize->setInitializer(
+      ConstantInt::get(drawSize->getValueType(), alignTo(size, Align(16))));
+  return hoisted.size();
+}
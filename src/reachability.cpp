@@ -0,0 +1,58 @@
+#include "reachability.h"
+#include "llvm/ADT/StringMap.h"
+
+using namespace ast;
+
+std::vector<bool> ast::findUsedDefinitions(const FlatAST &flat,
+                                           uint32_t top) {
+  uint32_t count = flat.childCount[top];
+  std::vector<bool> used(count, false);
+  // definitions by name, functions and globals apart since a call only
+  // names a function and a variable only a global
+  StringMap<std::vector<uint32_t>> functions;
+  StringMap<std::vector<uint32_t>> globals;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t definition = flat.child(top, i);
+    if (flat.kinds[definition] == flat_function_definition)
+      functions[flat.name(definition)].push_back(i);
+    else if (flat.kinds[definition] == flat_global_variable_definition)
+      globals[flat.name(definition)].push_back(i);
+  }
+  auto main = functions.find("main");
+  if (main == functions.end())
+    return std::vector<bool>(count, true);
+
+  std::vector<uint32_t> worklist;
+  auto use = [&](const std::vector<uint32_t> &definitions) {
+    for (uint32_t i : definitions) {
+      if (!used[i]) {
+        used[i] = true;
+        worklist.push_back(i);
+      }
+    }
+  };
+  use(main->second);
+  std::vector<uint32_t> stack;
+  while (!worklist.empty()) {
+    stack.push_back(flat.child(top, worklist.back()));
+    worklist.pop_back();
+    while (!stack.empty()) {
+      uint32_t node = stack.back();
+      stack.pop_back();
+      const StringMap<std::vector<uint32_t>> *names = nullptr;
+      if (flat.kinds[node] == flat_function_call)
+        names = &functions;
+      else if (flat.kinds[node] == flat_variable ||
+               flat.kinds[node] == flat_variable_index)
+        names = &globals;
+      if (names) {
+        auto found = names->find(flat.name(node));
+        if (found != names->end())
+          use(found->second);
+      }
+      for (uint32_t i = 0; i < flat.childCount[node]; i++)
+        stack.push_back(flat.child(node, i));
+    }
+  }
+  return used;
+}
@@ -0,0 +1,281 @@
+#include "server.h"
+#include "parser.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+#ifndef _WIN32
+
+static bool readAll(int fd, void *data, size_t size) {
+  char *bytes = (char *)data;
+  while (size > 0) {
+    ssize_t count = read(fd, bytes, size);
+    if (count <= 0)
+      return false;
+    bytes += count;
+    size -= count;
+  }
+  return true;
+}
+
+static bool readString(int fd, std::string &string) {
+  uint32_t size;
+  if (!readAll(fd, &size, sizeof(size)))
+    return false;
+  string.resize(size);
+  return readAll(fd, &string[0], size);
+}
+
+// one buffer for the whole message, a single write for small ones
+class Message {
+  std::string bytes;
+
+public:
+  void addU32(uint32_t value) { bytes.append((const char *)&value, 4); }
+  void addString(StringRef string) {
+    addU32(string.size());
+    bytes += string;
+  }
+  bool send(int fd) const {
+    const char *data = bytes.data();
+    size_t size = bytes.size();
+    while (size > 0) {
+      ssize_t count = write(fd, data, size);
+      if (count <= 0)
+        return false;
+      data += count;
+      size -= count;
+    }
+    return true;
+  }
+};
+
+static std::string readFile(StringRef path) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(path);
+  return file ? (*file)->getBuffer().str() : std::string();
+}
+
+static int connectTo(const std::string &path) {
+  sockaddr_un address = {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    printf("Error: socket path %s is too long\n", path.c_str());
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) < 0) {
+    printf("Error: cannot connect to %s\n", path.c_str());
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// a file the compile can open by name. In memory where there is
+// memfd_create, it goes away with the process
+static bool createScratchFile(const char *name, SmallString<128> &path) {
+#ifdef __linux__
+  int fd = memfd_create(name, 0);
+  if (fd < 0)
+    return false;
+  path = "/proc/self/fd/" + std::to_string(fd);
+  return true;
+#else
+  return !sys::fs::createTemporaryFile("glsl", name, path);
+#endif
+}
+
+// runs in the child, the compile reads and writes files and its printf
+// output goes to one as well
+static void handleConnection(int fd, CompileFunction compile) {
+  uint32_t count;
+  if (!readAll(fd, &count, sizeof(count)))
+    return;
+  std::vector<std::string> options(count);
+  for (std::string &option : options) {
+    if (!readString(fd, option))
+      return;
+  }
+  std::string source;
+  if (!readString(fd, source))
+    return;
+
+  // the output goes to a real file, the backend may hand its path to the
+  // linker
+  SmallString<128> sourcePath, outputPath, printedPath;
+  if (!createScratchFile("source", sourcePath) ||
+      sys::fs::createTemporaryFile("glsl", "out", outputPath) ||
+      !createScratchFile("printed", printedPath))
+    return;
+  {
+    std::error_code error;
+    raw_fd_ostream os(sourcePath, error);
+    os << source;
+  }
+  fflush(stdout);
+  FILE *printed = freopen(printedPath.c_str(), "w", stdout);
+
+  std::string input = sourcePath.str().str();
+  std::string output = outputPath.str().str();
+  std::vector<char *> argv = {(char *)"glsl", &input[0], (char *)"x",
+                              &output[0]};
+  for (std::string &option : options)
+    argv.push_back(&option[0]);
+  argv.push_back(nullptr);
+  int status = compile(argv.size() - 1, argv.data());
+  outs().flush();
+  fflush(stdout);
+
+  Message response;
+  response.addU32(status);
+  response.addString(printed ? readFile(printedPath) : "");
+  response.addString(readFile(outputPath));
+  response.send(fd);
+  sys::fs::remove(outputPath);
+#ifndef __linux__
+  sys::fs::remove(sourcePath);
+  sys::fs::remove(printedPath);
+#endif
+}
+
+int serve(const std::string &path, CompileFunction compile) {
+  // what every compile would otherwise initialize again
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  sockaddr_un address = {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    printf("Error: socket path %s is too long\n", path.c_str());
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  unlink(path.c_str());
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) ||
+      listen(listener, 64)) {
+    printf("Error: cannot listen on %s\n", path.c_str());
+    return -1;
+  }
+  // children are reaped by the system
+  signal(SIGCHLD, SIG_IGN);
+  // a child writes to `taken` when it accepted a connection
+  int taken[2];
+  if (pipe(taken)) {
+    printf("Error: cannot create a pipe\n");
+    return -1;
+  }
+  auto spawnWorker = [&] {
+    if (fork() != 0)
+      return;
+    close(taken[0]);
+    // the compile waits for the programs it runs
+    signal(SIGCHLD, SIG_DFL);
+    // ready before the request comes, the compile reuses it
+    InitializeModule();
+    int fd;
+    do
+      fd = accept(listener, nullptr, nullptr);
+    while (fd < 0);
+    char byte = 0;
+    write(taken[1], &byte, 1);
+    handleConnection(fd, compile);
+    // nothing of this process needs to be torn down
+    _exit(0);
+  };
+  // forked ahead, so forking is not part of the latency of a request
+  unsigned workers = std::max(2u, std::thread::hardware_concurrency());
+  for (unsigned i = 0; i < workers; i++)
+    spawnWorker();
+  while (true) {
+    char byte;
+    if (read(taken[0], &byte, 1) == 1)
+      spawnWorker();
+  }
+}
+
+int compileRemotely(const std::string &path, int argc, char *argv[]) {
+  std::vector<std::string> options;
+  for (int i = 4; i < argc; i++) {
+    std::string option(argv[i]);
+    if (option.rfind("-connect=", 0) == 0)
+      continue;
+    // the server resolves paths from its own directory
+    for (const char *prefix : {"-header=", "-cache-dir=", "-run="}) {
+      size_t length = strlen(prefix);
+      if (option.compare(0, length, prefix) == 0) {
+        SmallString<128> absolute(StringRef(option).drop_front(length));
+        sys::fs::make_absolute(absolute);
+        option = prefix + absolute.str().str();
+      }
+    }
+    options.push_back(option);
+  }
+  ErrorOr<std::unique_ptr<MemoryBuffer>> source =
+      MemoryBuffer::getFile(argv[1]);
+  if (!source) {
+    printf("Error: cannot read %s\n", argv[1]);
+    return -1;
+  }
+  Message request;
+  request.addU32(options.size());
+  for (const std::string &option : options)
+    request.addString(option);
+  request.addString((*source)->getBuffer());
+
+  int fd = connectTo(path);
+  if (fd < 0)
+    return -1;
+  uint32_t status;
+  std::string printed, output;
+  bool answered = request.send(fd) && readAll(fd, &status, sizeof(status)) &&
+                  readString(fd, printed) && readString(fd, output);
+  close(fd);
+  if (!answered) {
+    printf("Error: no response from %s\n", path.c_str());
+    return -1;
+  }
+  fwrite(printed.data(), 1, printed.size(), stdout);
+  if (!output.empty()) {
+    std::error_code error;
+    raw_fd_ostream os(argv[3], error, sys::fs::OF_None);
+    os << output;
+  }
+  return (int)status;
+}
+
+#else
+
+int serve(const std::string &path, CompileFunction compile) {
+  printf("Error: the compile server needs Unix domain sockets\n");
+  return -1;
+}
+
+int compileRemotely(const std::string &path, int argc, char *argv[]) {
+  printf("Error: the compile server needs Unix domain sockets\n");
+  return -1;
+}
+
+#endif
@@ -0,0 +1,354 @@
+#include "specialize.h"
+#include "abi.h"
+#include "backend.h"
+#include "generator.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+using namespace ast;
+
+extern thread_local std::unique_ptr<LLVMContext> TheContext;
+extern thread_local std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<TopLevelAST> topLevelAst;
+
+// runs with the same uniforms before a variant is asked for
+static const uint64_t requestAfter = 1024;
+
+std::unique_ptr<UniformSpecializer>
+UniformSpecializer::create(TopLevelAST &program, const std::string &entry,
+                           size_t capacity) {
+  std::unique_ptr<UniformSpecializer> specializer(
+      new UniformSpecializer(program, entry, capacity));
+  // position independent like the objects of watch mode, see watch.h
+  Expected<JITTargetMachineBuilder> builder =
+      JITTargetMachineBuilder::detectHost();
+  if (!builder) {
+    printf("Error: %s\n", toString(builder.takeError()).c_str());
+    return nullptr;
+  }
+  builder->setRelocationModel(Reloc::PIC_);
+  builder->setCodeModel(CodeModel::Small);
+  Expected<std::unique_ptr<TargetMachine>> machine =
+      builder->createTargetMachine();
+  if (!machine) {
+    printf("Error: %s\n", toString(machine.takeError()).c_str());
+    return nullptr;
+  }
+  specializer->machine = std::move(*machine);
+  Expected<std::unique_ptr<LLJIT>> jit =
+      LLJITBuilder().setJITTargetMachineBuilder(*builder).create();
+  if (!jit) {
+    printf("Error: %s\n", toString(jit.takeError()).c_str());
+    return nullptr;
+  }
+  specializer->jit = std::move(*jit);
+  // the library functions the built-ins call
+  auto process = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      specializer->jit->getDataLayout().getGlobalPrefix());
+  if (!process) {
+    printf("Error: %s\n", toString(process.takeError()).c_str());
+    return nullptr;
+  }
+  specializer->jit->getMainJITDylib().addGenerator(std::move(*process));
+
+  // read only, the program stays indexed
+  for (auto &definition : std::as_const(program).getDefinitions()) {
+    if (definition->isFunction())
+      continue;
+    auto *global =
+        static_cast<const GlobalVariableDefinitionAST *>(definition.get());
+    if (!global->getIsConst() && global->getLayoutType() == uniform)
+      specializer->uniforms.push_back({global->getName(), 0, 0});
+  }
+  Variant generic;
+  generic.key.assign(specializer->uniforms.size(), '\0');
+  if (!specializer->compileVariant(generic))
+    return nullptr;
+  specializer->generic = specializer->current = generic.function;
+  specializer->currentKey = generic.key;
+  if (capacity && !specializer->uniforms.empty())
+    specializer->compiler =
+        std::thread([raw = specializer.get()] { raw->compileQueued(); });
+  return specializer;
+}
+
+UniformSpecializer::~UniformSpecializer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  if (compiler.joinable())
+    compiler.join();
+}
+
+// lower the program again with the uniforms the key fixes as consts and
+// link its entry point under a name of its own. On one thread at a time
+bool UniformSpecializer::compileVariant(Variant &variant) {
+  StringMap<std::string> fixed;
+  size_t at = 0;
+  for (const Uniform &uniform : uniforms) {
+    if (variant.key[at++]) {
+      fixed[uniform.name] = variant.key.substr(at, uniform.size);
+      at += uniform.size;
+    }
+  }
+  resetModule();
+  InitializeModule();
+  specializedUniforms = &fixed;
+  program.codegen();
+  specializedUniforms = nullptr;
+  TheModule->setDataLayout(jit->getDataLayout());
+  TheModule->setTargetTriple(jit->getTargetTriple().str());
+  if (!emitEntryPoint(program, *TheModule, entry) ||
+      verifyModule(*TheModule, &outs())) {
+    resetModule();
+    return false;
+  }
+
+  // the first compile, of the generic entry point, finds the fields
+  if (!contextSize) {
+    StructType *contextType =
+        StructType::getTypeByName(*TheContext, entry + "_context");
+    const DataLayout &layout = TheModule->getDataLayout();
+    const StructLayout *structLayout = layout.getStructLayout(contextType);
+    std::vector<unsigned> fields = getUniformFields(program);
+    for (size_t i = 0; i < uniforms.size(); i++) {
+      uniforms[i].offset = structLayout->getElementOffset(fields[i]);
+      uniforms[i].size =
+          layout.getTypeStoreSize(contextType->getElementType(fields[i]));
+    }
+    contextSize = layout.getTypeAllocSize(contextType);
+  }
+  // every variant has the same symbols. The entry point runs on one thread
+  // at a time, the jit has no thread local storage for its globals
+  std::string symbol = entry + "." + utostr(compiledCount++);
+  TheModule->getFunction(entry)->setName(symbol);
+  TheModule->getNamedGlobal(entry + "_context_size")
+      ->setLinkage(GlobalValue::InternalLinkage);
+  for (GlobalVariable &global : TheModule->globals())
+    global.setThreadLocal(false);
+  optimizeModule(*TheModule, *machine);
+  SimpleCompiler compiler(*machine);
+  Expected<std::unique_ptr<MemoryBuffer>> object = compiler(*TheModule);
+  resetModule();
+  if (!object) {
+    printf("Error: %s\n", toString(object.takeError()).c_str());
+    return false;
+  }
+
+  variant.tracker = jit->getMainJITDylib().createResourceTracker();
+  if (Error error = jit->addObjectFile(variant.tracker, std::move(*object))) {
+    printf("Error: %s\n", toString(std::move(error)).c_str());
+    return false;
+  }
+  Expected<ExecutorAddr> address = jit->lookup(symbol);
+  if (!address) {
+    printf("Error: %s\n", toString(address.takeError()).c_str());
+    consumeError(variant.tracker->remove());
+    return false;
+  }
+  variant.function = address->toPtr<EntryFunction>();
+  return true;
+}
+
+// the compiling thread, one variant after the other
+void UniformSpecializer::compileQueued() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [&] { return stopping || !queued.empty(); });
+    if (stopping)
+      return;
+    compiling = std::move(queued);
+    queued.clear();
+    Variant variant;
+    variant.key = compiling;
+    lock.unlock();
+    bool compiled = compileVariant(variant);
+    lock.lock();
+    compiling.clear();
+    if (compiled) {
+      finished.push_back(std::move(variant));
+      hasFinished.store(true, std::memory_order_release);
+    }
+  }
+}
+
+// find the variant for the uniforms of `context` if they changed since the
+// last run
+void UniformSpecializer::noteUniforms(const char *context) {
+  std::vector<bool> changed(uniforms.size());
+  bool any = values.empty();
+  if (any)
+    values.resize(uniforms.size());
+  for (size_t i = 0; i < uniforms.size(); i++) {
+    StringRef value(context + uniforms[i].offset, uniforms[i].size);
+    if (values[i] == value)
+      continue;
+    changed[i] = !values[i].empty();
+    values[i] = value.str();
+    any = true;
+  }
+  if (!any)
+    return;
+  if (find(changed, true) != changed.end())
+    lastChanged = changed;
+  else if (lastChanged.empty())
+    lastChanged = changed;
+
+  std::string key;
+  for (size_t i = 0; i < uniforms.size(); i++) {
+    key.push_back(!lastChanged[i]);
+    if (!lastChanged[i])
+      key += values[i];
+  }
+  if (key == currentKey)
+    return;
+  currentKey = std::move(key);
+  runLength = 0;
+  auto found = byKey.find(currentKey);
+  if (found == byKey.end()) {
+    current = generic;
+    return;
+  }
+  variants.splice(variants.begin(), variants, found->second);
+  current = found->second->function;
+}
+
+// compile a variant for the current uniforms, unless one is on its way or
+// no uniform would be fixed
+void UniformSpecializer::request() {
+  bool fixesAny = false;
+  size_t at = 0;
+  for (const Uniform &uniform : uniforms) {
+    if (currentKey[at++]) {
+      fixesAny = true;
+      at += uniform.size;
+    }
+  }
+  if (!fixesAny)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (compiling == currentKey || queued == currentKey)
+      return;
+    // values that were asked for before are not the current ones any more
+    queued = currentKey;
+  }
+  wake.notify_one();
+}
+
+// cache the variants the compiling thread finished. The one running is
+// never evicted, the others by how long ago they ran
+void UniformSpecializer::takeFinished() {
+  std::vector<Variant> taken;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.swap(finished);
+    hasFinished.store(false, std::memory_order_relaxed);
+  }
+  for (Variant &variant : taken) {
+    if (byKey.count(variant.key)) {
+      consumeError(variant.tracker->remove());
+      continue;
+    }
+    if (variant.key == currentKey)
+      current = variant.function;
+    variants.push_front(std::move(variant));
+    byKey[variants.front().key] = variants.begin();
+    statistics.compiled++;
+  }
+  while (variants.size() > capacity) {
+    auto last = std::prev(variants.end());
+    if (last->function == current) {
+      variants.splice(variants.begin(), variants, last);
+      continue;
+    }
+    consumeError(last->tracker->remove());
+    byKey.erase(last->key);
+    variants.erase(last);
+    statistics.evicted++;
+  }
+}
+
+void UniformSpecializer::run(void *context) {
+  noteUniforms(static_cast<const char *>(context));
+  if (hasFinished.load(std::memory_order_acquire))
+    takeFinished();
+  if (++runLength == requestAfter && current == generic &&
+      compiler.joinable())
+    request();
+  current(context);
+  statistics.runs++;
+  statistics.specializedRuns += current != generic;
+}
+
+int runShader(const std::string &path, const std::string &input,
+              const std::string &output, const std::string &entry,
+              size_t capacity) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  initBinopPrecedence();
+  redirectInput(path);
+  Tokenize();
+  InitializeModule();
+  if (parseAST() < 0) {
+    printf("reject");
+    return -1;
+  }
+  std::unique_ptr<UniformSpecializer> shader =
+      UniformSpecializer::create(*topLevelAst, entry, capacity);
+  if (!shader)
+    return -1;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(input);
+  if (!file) {
+    printf("Error: cannot read %s\n", input.c_str());
+    return -1;
+  }
+  uint64_t size = (*file)->getBufferSize();
+  uint64_t contextSize = shader->getContextSize();
+  if (size % contextSize) {
+    printf("Error: %s is not a whole number of %llu byte contexts\n",
+           input.c_str(), (unsigned long long)contextSize);
+    return -1;
+  }
+  // aligned for the widest lane, a double
+  std::vector<uint64_t> contexts((size + 7) / 8);
+  char *data = reinterpret_cast<char *>(contexts.data());
+  memcpy(data, (*file)->getBufferStart(), size);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t offset = 0; offset < size; offset += contextSize)
+    shader->run(data + offset);
+  double milliseconds = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+  std::error_code error;
+  raw_fd_ostream os(output, error);
+  if (error) {
+    printf("Error: cannot write %s\n", output.c_str());
+    return -1;
+  }
+  os.write(data, size);
+  const UniformSpecializer::Statistics &statistics = shader->getStatistics();
+  printf("accept %llu contexts in %.1f ms, %llu on %llu specialized "
+         "variants, %llu evicted\n",
+         (unsigned long long)statistics.runs, milliseconds,
+         (unsigned long long)statistics.specializedRuns,
+         (unsigned long long)statistics.compiled,
+         (unsigned long long)statistics.evicted);
+  return 0;
+}
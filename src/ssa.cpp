@@ -0,0 +1,105 @@
+#include "ssa.h"
+#include "type_table.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+
+thread_local std::unique_ptr<SSABuilder> TheSSA;
+
+void SSABuilder::writeVariable(SSAVariable *variable, BasicBlock *block,
+                               Value *value) {
+  currentDef[block][variable] = value;
+}
+
+Value *SSABuilder::readVariable(SSAVariable *variable, BasicBlock *block) {
+  auto blockDefs = currentDef.find(block);
+  if (blockDefs != currentDef.end()) {
+    auto def = blockDefs->second.find(variable);
+    if (def != blockDefs->second.end() && def->second != nullptr)
+      return def->second;
+  }
+  return readVariableRecursive(variable, block);
+}
+
+PHINode *SSABuilder::createPhi(SSAVariable *variable, BasicBlock *block) {
+  Type *type = TheTypes->getType(variable->first);
+  // phis go in front of everything else in the block
+  if (block->empty())
+    return PHINode::Create(type, 2, "phi", block);
+  return PHINode::Create(type, 2, "phi", &block->front());
+}
+
+Value *SSABuilder::readVariableRecursive(SSAVariable *variable,
+                                         BasicBlock *block) {
+  Value *value;
+  if (!sealedBlocks.count(block)) {
+    // predecessors are still missing, fill the phi in when sealing
+    PHINode *phi = createPhi(variable, block);
+    incompletePhis[block].push_back({variable, phi});
+    value = phi;
+  } else if (BasicBlock *pred = block->getSinglePredecessor()) {
+    value = readVariable(variable, pred);
+  } else if (pred_empty(block)) {
+    value = UndefValue::get(TheTypes->getType(variable->first));
+  } else {
+    // break cycles with an operandless phi
+    PHINode *phi = createPhi(variable, block);
+    writeVariable(variable, block, phi);
+    value = addPhiOperands(variable, phi);
+  }
+  writeVariable(variable, block, value);
+  return value;
+}
+
+Value *SSABuilder::addPhiOperands(SSAVariable *variable, PHINode *phi) {
+  BasicBlock *block = phi->getParent();
+  for (BasicBlock *pred : predecessors(block))
+    phi->addIncoming(readVariable(variable, pred), pred);
+  return tryRemoveTrivialPhi(phi);
+}
+
+Value *SSABuilder::tryRemoveTrivialPhi(PHINode *phi) {
+  Value *same = nullptr;
+  for (Value *op : phi->incoming_values()) {
+    if (op == same || op == phi)
+      continue;
+    if (same != nullptr)
+      return phi; // merges at least two values
+    same = op;
+  }
+  if (same == nullptr)
+    same = UndefValue::get(phi->getType()); // unreachable or in the entry
+
+  // phis using this one may become trivial too, they can be erased while
+  // the list is walked so hold them weakly
+  std::vector<WeakVH> users;
+  for (User *user : phi->users()) {
+    if (user != phi && isa<PHINode>(user))
+      users.emplace_back(user);
+  }
+  // definitions held in currentDef follow the replacement
+  phi->replaceAllUsesWith(same);
+  phi->eraseFromParent();
+  for (auto &user : users) {
+    if (auto *userPhi = dyn_cast_or_null<PHINode>(user))
+      tryRemoveTrivialPhi(userPhi);
+  }
+  return same;
+}
+
+void SSABuilder::sealBlock(BasicBlock *block) {
+  if (!sealedBlocks.insert(block).second)
+    return;
+  auto pending = incompletePhis.find(block);
+  if (pending == incompletePhis.end())
+    return;
+  std::vector<std::pair<SSAVariable *, PHINode *>> phis =
+      std::move(pending->second);
+  incompletePhis.erase(pending);
+  for (auto &entry : phis)
+    addPhiOperands(entry.first, entry.second);
+}
+
+void SSABuilder::sealFunction(Function *function) {
+  for (BasicBlock &block : *function)
+    sealBlock(&block);
+}
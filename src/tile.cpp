@@ -0,0 +1,619 @@
+#include "tile.h"
+#include "abi.h"
+#include "prologue.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <vector>
+
+using namespace ast;
+
+// the columns of a strip, whose values share the buffer on the stack
+static const unsigned stripWidth = 64;
+
+namespace {
+// what a lane varies with over the pixels of a tile. Uniforms and the
+// draw buffer are the same for all of them
+enum Dependence : uint8_t {
+  dep_column = 1 << 0, // the x of the coordinate
+  dep_row = 1 << 1,    // the y
+  dep_pixel = 1 << 2,  // anything else of the invocation
+};
+
+// a place in the tile loop that values are computed at
+struct Level {
+  // what its values may depend on
+  uint8_t varies;
+  Value *contexts;
+  Value *draw;
+  // the lanes of the coordinate it knows, else null
+  Value *x;
+  Value *y;
+  DenseMap<Value *, Value *> copies;
+};
+
+class TileValues {
+  const DataLayout &layout;
+  Argument *context;
+  Argument *draw;
+  // the bytes of the context holding uniforms, and the coordinate
+  std::vector<std::pair<uint64_t, uint64_t>> fields;
+  uint64_t coordinateBegin;
+  uint64_t coordinateEnd;
+  DenseMap<const Value *, SmallVector<uint8_t, 4>> lanes;
+  // where the loads of uniforms, the draw buffer and the coordinate read
+  DenseMap<const LoadInst *, std::pair<const Argument *, uint64_t>> loads;
+  std::vector<LoadInst *> coordinateLoads;
+  DenseMap<const Instruction *, bool> worthMoving;
+
+  void classifyLoad(LoadInst &load, SmallVectorImpl<uint8_t> &result);
+  void classifyOperation(const Instruction &instruction, bool always,
+                         SmallVectorImpl<uint8_t> &result) const;
+  uint8_t getLane(const Use &use, unsigned lane) const;
+  uint8_t getOperand(const Use &use) const;
+
+public:
+  TileValues(Function &entry, StructType *contextType,
+             const std::vector<unsigned> &uniformFields,
+             unsigned coordinateField);
+
+  uint8_t getDependence(const Value *value) const;
+  const std::vector<LoadInst *> &getCoordinateLoads() const {
+    return coordinateLoads;
+  }
+  bool isWorthMoving(const Instruction *instruction);
+  Value *buildCoordinate(LoadInst *load, Value *x, Value *y, Value *rest,
+                         IRBuilder<> &builder) const;
+  Value *clone(Value *value, Level &level, IRBuilder<> &builder) const;
+};
+} // namespace
+
+static unsigned getLaneCount(const Type *type) {
+  auto *vector = dyn_cast<FixedVectorType>(type);
+  return vector ? vector->getNumElements() : 1;
+}
+
+// an operation on vectors that works lane by lane
+static bool isElementwise(const Instruction &instruction) {
+  unsigned count = getLaneCount(instruction.getType());
+  if (count == 1)
+    return false;
+  if (auto *cast = dyn_cast<CastInst>(&instruction))
+    return getLaneCount(cast->getSrcTy()) == count;
+  if (auto *intrinsic = dyn_cast<IntrinsicInst>(&instruction))
+    return isTriviallyVectorizable(intrinsic->getIntrinsicID());
+  return isa<BinaryOperator>(instruction) ||
+         isa<UnaryOperator>(instruction) || isa<CmpInst>(instruction) ||
+         isa<SelectInst>(instruction);
+}
+
+TileValues::TileValues(Function &entry, StructType *contextType,
+                       const std::vector<unsigned> &uniformFields,
+                       unsigned coordinateField)
+    : layout(entry.getParent()->getDataLayout()), context(entry.getArg(0)),
+      draw(entry.arg_size() > 1 ? entry.getArg(1) : nullptr) {
+  const StructLayout *structLayout = layout.getStructLayout(contextType);
+  for (unsigned field : uniformFields) {
+    uint64_t begin = structLayout->getElementOffset(field);
+    uint64_t size =
+        layout.getTypeStoreSize(contextType->getElementType(field));
+    fields.push_back({begin, begin + size});
+  }
+  coordinateBegin = structLayout->getElementOffset(coordinateField);
+  coordinateEnd =
+      coordinateBegin +
+      layout.getTypeStoreSize(contextType->getElementType(coordinateField));
+
+  // operands come before their users but for phis, which vary per pixel
+  PostDominatorTree postDominators(entry);
+  ReversePostOrderTraversal<Function *> order(&entry);
+  for (BasicBlock *block : order) {
+    bool always = postDominators.dominates(block, &entry.getEntryBlock());
+    for (Instruction &instruction : *block) {
+      SmallVector<uint8_t, 4> result(getLaneCount(instruction.getType()),
+                                     dep_pixel);
+      if (auto *load = dyn_cast<LoadInst>(&instruction))
+        classifyLoad(*load, result);
+      else
+        classifyOperation(instruction, always, result);
+      lanes[&instruction] = std::move(result);
+    }
+  }
+}
+
+void TileValues::classifyLoad(LoadInst &load,
+                              SmallVectorImpl<uint8_t> &result) {
+  if (!load.isSimple())
+    return;
+  APInt bytes(layout.getIndexTypeSizeInBits(load.getPointerOperandType()),
+              0);
+  const Value *base =
+      load.getPointerOperand()->stripAndAccumulateConstantOffsets(
+          layout, bytes, /*AllowNonInbounds=*/true);
+  if ((base != context && base != draw) || bytes.isNegative())
+    return;
+  uint64_t offset = bytes.getZExtValue();
+  uint64_t end = offset + layout.getTypeStoreSize(load.getType());
+  bool uniform = base == draw;
+  for (auto &field : fields)
+    uniform |= offset >= field.first && end <= field.second;
+  if (uniform) {
+    loads[&load] = {cast<Argument>(base), offset};
+    std::fill(result.begin(), result.end(), 0);
+    return;
+  }
+
+  // the first two lanes of the coordinate are the tile's, the others are
+  // still read from the context
+  if (base != context || offset < coordinateBegin || end > coordinateEnd ||
+      !load.getType()->getScalarType()->isFloatTy())
+    return;
+  loads[&load] = {context, offset};
+  coordinateLoads.push_back(&load);
+  for (unsigned i = 0; i < result.size(); i++) {
+    uint64_t lane = offset - coordinateBegin + i * sizeof(float);
+    if (lane == 0)
+      result[i] = dep_column;
+    else if (lane == sizeof(float))
+      result[i] = dep_row;
+  }
+}
+
+void TileValues::classifyOperation(const Instruction &instruction,
+                                   bool always,
+                                   SmallVectorImpl<uint8_t> &result) const {
+  if (isa<PHINode>(instruction) || instruction.isTerminator() ||
+      instruction.getType()->isVoidTy() ||
+      instruction.mayReadOrWriteMemory())
+    return;
+  bool speculatable = isSafeToSpeculativelyExecute(&instruction);
+  if (!speculatable && !(always && !instruction.mayHaveSideEffects()))
+    return;
+
+  if (auto *extract = dyn_cast<ExtractElementInst>(&instruction)) {
+    auto *index = dyn_cast<ConstantInt>(extract->getIndexOperand());
+    if (index && index->getZExtValue() <
+                     getLaneCount(extract->getVectorOperandType())) {
+      result[0] = getLane(extract->getOperandUse(0), index->getZExtValue());
+      return;
+    }
+  } else if (auto *insert = dyn_cast<InsertElementInst>(&instruction)) {
+    auto *index = dyn_cast<ConstantInt>(insert->getOperand(2));
+    if (index && index->getZExtValue() < result.size()) {
+      for (unsigned i = 0; i < result.size(); i++)
+        result[i] = i == index->getZExtValue()
+                        ? getOperand(insert->getOperandUse(1))
+                        : getLane(insert->getOperandUse(0), i);
+      return;
+    }
+  } else if (auto *shuffle = dyn_cast<ShuffleVectorInst>(&instruction)) {
+    int first = getLaneCount(shuffle->getOperand(0)->getType());
+    for (unsigned i = 0; i < result.size(); i++) {
+      int lane = shuffle->getMaskValue(i);
+      result[i] = lane < 0       ? 0
+                  : lane < first ? getLane(shuffle->getOperandUse(0), lane)
+                                 : getLane(shuffle->getOperandUse(1),
+                                           lane - first);
+    }
+    return;
+  } else if (isElementwise(instruction)) {
+    for (unsigned i = 0; i < result.size(); i++) {
+      result[i] = 0;
+      for (const Use &use : instruction.operands())
+        result[i] |= getLane(use, i);
+    }
+    // a level computes the lanes it does not know from poison, which must
+    // not be undefined behavior
+    if (speculatable || all_of(result, [&](uint8_t lane) {
+          return lane == result[0];
+        }))
+      return;
+  }
+  uint8_t all = 0;
+  for (const Use &use : instruction.operands())
+    all |= getOperand(use);
+  std::fill(result.begin(), result.end(), all);
+}
+
+uint8_t TileValues::getLane(const Use &use, unsigned lane) const {
+  if (auto *call = dyn_cast<CallBase>(use.getUser())) {
+    if (call->isCallee(&use))
+      return isa<Function>(use.get()) ? 0 : dep_pixel;
+  }
+  auto found = lanes.find(use.get());
+  if (found == lanes.end())
+    return isPlainConstant(use.get()) ? 0 : dep_pixel;
+  if (found->second.size() == 1)
+    return found->second[0];
+  return lane < found->second.size() ? found->second[lane]
+                                     : getDependence(use.get());
+}
+
+uint8_t TileValues::getOperand(const Use &use) const {
+  uint8_t dependence = 0;
+  for (unsigned i = 0; i < getLaneCount(use.get()->getType()); i++)
+    dependence |= getLane(use, i);
+  return dependence;
+}
+
+uint8_t TileValues::getDependence(const Value *value) const {
+  auto found = lanes.find(value);
+  if (found == lanes.end())
+    return isPlainConstant(value) ? 0 : dep_pixel;
+  uint8_t dependence = 0;
+  for (uint8_t lane : found->second)
+    dependence |= lane;
+  return dependence;
+}
+
+// whether the value does more than load and move lanes
+bool TileValues::isWorthMoving(const Instruction *instruction) {
+  if (isa<LoadInst>(instruction))
+    return false;
+  auto found = worthMoving.find(instruction);
+  if (found != worthMoving.end())
+    return found->second;
+  bool worth = !movesLanes(*instruction);
+  for (const Use &operand : instruction->operands()) {
+    if (worth)
+      break;
+    if (auto *movedOperand = dyn_cast<Instruction>(operand.get()))
+      worth = isWorthMoving(movedOperand);
+  }
+  worthMoving[instruction] = worth;
+  return worth;
+}
+
+// the lanes of coordinate load `load`, `x` and `y` for the first two where
+// not null and the lanes of `rest` for the others
+Value *TileValues::buildCoordinate(LoadInst *load, Value *x, Value *y,
+                                   Value *rest, IRBuilder<> &builder) const {
+  const SmallVector<uint8_t, 4> &loadLanes = lanes.find(load)->second;
+  Value *coordinate = rest;
+  for (unsigned i = 0; i < loadLanes.size(); i++) {
+    Value *lane = loadLanes[i] == dep_column ? x
+                  : loadLanes[i] == dep_row  ? y
+                                             : nullptr;
+    if (!lane)
+      continue;
+    coordinate = load->getType()->isVectorTy()
+                     ? builder.CreateInsertElement(coordinate, lane, i)
+                     : lane;
+  }
+  return coordinate;
+}
+
+// `value` computed again for `level`. Lanes depending on more than the
+// level knows are poison, they only go to lanes its values leave out
+Value *TileValues::clone(Value *value, Level &level,
+                         IRBuilder<> &builder) const {
+  if (isa<Constant>(value))
+    return value;
+  auto found = level.copies.find(value);
+  if (found != level.copies.end())
+    return found->second;
+  auto known = lanes.find(value);
+  Value *copy;
+  if (known == lanes.end() || none_of(known->second, [&](uint8_t lane) {
+        return !(lane & ~level.varies);
+      })) {
+    copy = PoisonValue::get(value->getType());
+  } else if (auto *load = dyn_cast<LoadInst>(value)) {
+    auto source = loads.lookup(load);
+    if (source.first == context && source.second >= coordinateBegin &&
+        source.second < coordinateEnd) {
+      copy = buildCoordinate(load, level.x, level.y,
+                             PoisonValue::get(load->getType()), builder);
+    } else {
+      Value *field = builder.CreateConstInBoundsGEP1_64(
+          builder.getInt8Ty(),
+          source.first == draw ? level.draw : level.contexts, source.second);
+      copy = builder.CreateAlignedLoad(load->getType(), field,
+                                       load->getAlign(), load->getName());
+    }
+  } else {
+    auto *instruction = cast<Instruction>(value);
+    Instruction *cloned = instruction->clone();
+    for (unsigned i = 0; i < cloned->getNumOperands(); i++)
+      cloned->setOperand(i, clone(instruction->getOperand(i), level, builder));
+    copy = builder.Insert(cloned, instruction->getName());
+  }
+  level.copies[value] = copy;
+  return copy;
+}
+
+bool checkTileCoordinate(const TopLevelAST &program,
+                         const std::string &coordinate) {
+  for (auto &definition : program.getDefinitions()) {
+    if (definition->isFunction())
+      continue;
+    auto *global =
+        static_cast<const GlobalVariableDefinitionAST *>(definition.get());
+    if (global->getIsConst() || global->getLayoutType() != in ||
+        global->getName() != coordinate)
+      continue;
+    const AstTypeInfo &info = getAstTypeInfo(global->getType());
+    if (info.scalar == scalar_float && info.columns == 1 && info.rows >= 2)
+      return true;
+    printf("Error: the window coordinate %s is not a float vector\n",
+           coordinate.c_str());
+    return false;
+  }
+  printf("Error: there is no input %s for the window coordinate\n",
+         coordinate.c_str());
+  return false;
+}
+
+unsigned emitTileKernel(const TopLevelAST &program, Module &module,
+                        const std::string &entry,
+                        const std::string &coordinate) {
+  Function *function = module.getFunction(entry);
+  StructType *contextType =
+      StructType::getTypeByName(module.getContext(), entry + "_context");
+  int coordinateField = getInputField(program, coordinate);
+  if (!function || function->isDeclaration() || !contextType ||
+      coordinateField < 0)
+    return 0;
+  TileValues values(*function, contextType, getUniformFields(program),
+                    coordinateField);
+
+  // the values the pixels take from outside the pixel loop, by what they
+  // depend on, which is also the level computing them
+  std::vector<Instruction *> moved[dep_row + 1];
+  for (BasicBlock *block : ReversePostOrderTraversal<Function *>(function)) {
+    for (Instruction &instruction : *block) {
+      uint8_t dependence = values.getDependence(&instruction);
+      if (dependence > dep_row || !values.isWorthMoving(&instruction))
+        continue;
+      if (any_of(instruction.users(), [&](const User *user) {
+            return values.getDependence(user) & ~dependence;
+          }))
+        moved[dependence].push_back(&instruction);
+    }
+  }
+
+  LLVMContext &context = module.getContext();
+  Type *int8 = Type::getInt8Ty(context);
+  Type *int32 = Type::getInt32Ty(context);
+  Type *int64 = Type::getInt64Ty(context);
+  std::vector<Type *> params(function->getFunctionType()->param_begin(),
+                             function->getFunctionType()->param_end());
+  params.insert(params.end(), 4, int32);
+  Function *tile = Function::Create(
+      FunctionType::get(Type::getVoidTy(context), params, false),
+      GlobalValue::ExternalLinkage, entry + "_tile", module);
+  tile->addFnAttrs(
+      AttrBuilder(context, function->getAttributes().getFnAttrs()));
+  Argument *contexts = tile->getArg(0);
+  contexts->setName("contexts");
+  Argument *draw = nullptr;
+  if (function->arg_size() > 1) {
+    draw = tile->getArg(1);
+    draw->setName("draw");
+  }
+  Argument *x = tile->getArg(tile->arg_size() - 4);
+  Argument *y = tile->getArg(tile->arg_size() - 3);
+  Argument *width = tile->getArg(tile->arg_size() - 2);
+  Argument *height = tile->getArg(tile->arg_size() - 1);
+  x->setName("x");
+  y->setName("y");
+  width->setName("width");
+  height->setName("height");
+
+  // the column values of a strip are laid out column by column, aligned
+  // like those of the draw buffer
+  const DataLayout &layout = module.getDataLayout();
+  std::vector<std::pair<uint64_t, Align>> slots;
+  uint64_t stride = 0;
+  Align strideAlign(1);
+  for (Instruction *instruction : moved[dep_column]) {
+    Type *type = instruction->getType();
+    Align align = std::min(layout.getABITypeAlign(type), Align(16));
+    uint64_t offset = alignTo(stride, align);
+    stride = offset + layout.getTypeStoreSize(type);
+    strideAlign = std::max(strideAlign, align);
+    slots.push_back({offset, align});
+  }
+  stride = alignTo(stride, strideAlign);
+
+  BasicBlock *entryBlock = BasicBlock::Create(context, "entry", tile);
+  BasicBlock *tileBlock = BasicBlock::Create(context, "tile", tile);
+  BasicBlock *stripBlock = BasicBlock::Create(context, "strip", tile);
+  BasicBlock *columnBlock =
+      moved[dep_column].empty()
+          ? nullptr
+          : BasicBlock::Create(context, "column", tile);
+  BasicBlock *rowBlock = BasicBlock::Create(context, "row", tile);
+  BasicBlock *pixelBlock = BasicBlock::Create(context, "pixel", tile);
+  BasicBlock *exitBlock = BasicBlock::Create(context, "exit");
+  IRBuilder<> builder(entryBlock);
+  Value *columns = nullptr;
+  if (columnBlock) {
+    AllocaInst *buffer = builder.CreateAlloca(
+        ArrayType::get(int8, stripWidth * stride), nullptr, "columns");
+    buffer->setAlignment(strideAlign);
+    columns = buffer;
+  }
+  builder.CreateCondBr(
+      builder.CreateOr(builder.CreateICmpEQ(width, builder.getInt32(0)),
+                       builder.CreateICmpEQ(height, builder.getInt32(0))),
+      exitBlock, tileBlock);
+  // the center of pixel `offset` from `origin`
+  auto center = [&](Value *origin, Value *offset) {
+    Value *position = builder.CreateUIToFP(builder.CreateAdd(origin, offset),
+                                           builder.getFloatTy());
+    return builder.CreateFAdd(position,
+                              ConstantFP::get(builder.getFloatTy(), 0.5));
+  };
+
+  builder.SetInsertPoint(tileBlock);
+  Level tileLevel{0, contexts, draw, nullptr, nullptr,
+                  DenseMap<Value *, Value *>()};
+  for (Instruction *instruction : moved[0])
+    values.clone(instruction, tileLevel, builder);
+  // the other levels take the tile's values rather than compute them again
+  auto makeLevel = [&](uint8_t varies, Value *levelX, Value *levelY) {
+    Level level{varies, contexts, draw, levelX, levelY,
+                DenseMap<Value *, Value *>()};
+    for (Instruction *instruction : moved[0])
+      level.copies[instruction] = tileLevel.copies[instruction];
+    return level;
+  };
+  builder.CreateBr(stripBlock);
+
+  builder.SetInsertPoint(stripBlock);
+  PHINode *stripStart = builder.CreatePHI(int32, 2, "strip");
+  stripStart->addIncoming(builder.getInt32(0), tileBlock);
+  Value *columnCount = builder.CreateSub(width, stripStart);
+  if (columnBlock) {
+    columnCount = builder.CreateBinaryIntrinsic(
+        Intrinsic::umin, columnCount, builder.getInt32(stripWidth));
+    builder.CreateBr(columnBlock);
+
+    builder.SetInsertPoint(columnBlock);
+    PHINode *column = builder.CreatePHI(int32, 2, "column");
+    column->addIncoming(builder.getInt32(0), stripBlock);
+    Level columnLevel = makeLevel(
+        dep_column, center(x, builder.CreateAdd(stripStart, column)),
+        nullptr);
+    Value *slot = builder.CreateInBoundsGEP(
+        int8, columns,
+        builder.CreateMul(builder.CreateZExt(column, int64),
+                          builder.getInt64(stride)));
+    for (size_t i = 0; i < slots.size(); i++) {
+      Value *copy = values.clone(moved[dep_column][i], columnLevel, builder);
+      builder.CreateAlignedStore(
+          copy,
+          builder.CreateConstInBoundsGEP1_64(int8, slot, slots[i].first),
+          slots[i].second);
+    }
+    Value *nextColumn = builder.CreateAdd(column, builder.getInt32(1));
+    column->addIncoming(nextColumn, columnBlock);
+    builder.CreateCondBr(builder.CreateICmpULT(nextColumn, columnCount),
+                         columnBlock, rowBlock);
+  } else {
+    builder.CreateBr(rowBlock);
+  }
+  BasicBlock *rowEntry = builder.GetInsertBlock();
+
+  builder.SetInsertPoint(rowBlock);
+  PHINode *row = builder.CreatePHI(int32, 2, "row");
+  row->addIncoming(builder.getInt32(0), rowEntry);
+  Level rowLevel = makeLevel(dep_row, nullptr, center(y, row));
+  for (Instruction *instruction : moved[dep_row])
+    values.clone(instruction, rowLevel, builder);
+  // the contexts of the pixels, row by row over the whole tile
+  Value *rowStart = builder.CreateAdd(
+      builder.CreateMul(builder.CreateZExt(row, int64),
+                        builder.CreateZExt(width, int64)),
+      builder.CreateZExt(stripStart, int64));
+  builder.CreateBr(pixelBlock);
+
+  builder.SetInsertPoint(pixelBlock);
+  PHINode *column = builder.CreatePHI(int32, 2, "column");
+  column->addIncoming(builder.getInt32(0), rowBlock);
+  Value *pixelContext = builder.CreateInBoundsGEP(
+      contextType, contexts,
+      builder.CreateAdd(rowStart, builder.CreateZExt(column, int64)),
+      "context");
+  Value *pixelX = center(x, builder.CreateAdd(stripStart, column));
+  std::vector<Value *> columnValues;
+  if (columnBlock) {
+    Value *slot = builder.CreateInBoundsGEP(
+        int8, columns,
+        builder.CreateMul(builder.CreateZExt(column, int64),
+                          builder.getInt64(stride)));
+    for (size_t i = 0; i < slots.size(); i++) {
+      Type *type = moved[dep_column][i]->getType();
+      columnValues.push_back(builder.CreateAlignedLoad(
+          type,
+          builder.CreateConstInBoundsGEP1_64(int8, slot, slots[i].first),
+          slots[i].second, moved[dep_column][i]->getName()));
+    }
+  }
+
+  // the entry point runs in the pixel loop on the context of the pixel
+  ValueToValueMapTy map;
+  map[function->getArg(0)] = pixelContext;
+  if (draw)
+    map[function->getArg(1)] = draw;
+  std::vector<BasicBlock *> body;
+  for (BasicBlock &block : *function) {
+    BasicBlock *copy = CloneBasicBlock(&block, map, "", tile);
+    map[&block] = copy;
+    body.push_back(copy);
+  }
+  for (BasicBlock *block : body) {
+    for (Instruction &instruction : *block)
+      RemapInstruction(&instruction, map,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+  }
+  builder.CreateBr(body.front());
+  BasicBlock *pixelLatch = BasicBlock::Create(context, "pixel.next", tile);
+  for (BasicBlock *block : body) {
+    if (auto *ret = dyn_cast<ReturnInst>(block->getTerminator())) {
+      BranchInst::Create(pixelLatch, ret);
+      ret->eraseFromParent();
+    }
+  }
+  // its stack is allocated once for the tile
+  for (Instruction &instruction : function->getEntryBlock()) {
+    auto *alloca = dyn_cast<AllocaInst>(&instruction);
+    if (alloca && alloca->isStaticAlloca())
+      cast<Instruction>(map[alloca])->moveBefore(&entryBlock->front());
+  }
+
+  // and takes the values of the levels instead of its own
+  std::vector<Instruction *> replaced;
+  auto replace = [&](Instruction *instruction, Value *value) {
+    auto *copy = cast<Instruction>(map[instruction]);
+    copy->replaceAllUsesWith(value);
+    replaced.push_back(copy);
+  };
+  for (Instruction *instruction : moved[0])
+    replace(instruction, tileLevel.copies[instruction]);
+  for (size_t i = 0; i < columnValues.size(); i++)
+    replace(moved[dep_column][i], columnValues[i]);
+  for (Instruction *instruction : moved[dep_row])
+    replace(instruction, rowLevel.copies[instruction]);
+  for (LoadInst *load : values.getCoordinateLoads()) {
+    auto *copy = cast<LoadInst>(map[load]);
+    builder.SetInsertPoint(copy);
+    Value *rest = PoisonValue::get(load->getType());
+    if (values.getDependence(load) & dep_pixel)
+      rest = builder.Insert(copy->clone(), load->getName());
+    replace(load, values.buildCoordinate(load, pixelX, rowLevel.y, rest,
+                                         builder));
+  }
+  for (Instruction *instruction : replaced)
+    RecursivelyDeleteTriviallyDeadInstructions(instruction);
+
+  builder.SetInsertPoint(pixelLatch);
+  Value *nextColumn = builder.CreateAdd(column, builder.getInt32(1));
+  column->addIncoming(nextColumn, pixelLatch);
+  BasicBlock *rowLatch = BasicBlock::Create(context, "row.next", tile);
+  builder.CreateCondBr(builder.CreateICmpULT(nextColumn, columnCount),
+                       pixelBlock, rowLatch);
+  builder.SetInsertPoint(rowLatch);
+  Value *nextRow = builder.CreateAdd(row, builder.getInt32(1));
+  row->addIncoming(nextRow, rowLatch);
+  BasicBlock *stripLatch = BasicBlock::Create(context, "strip.next", tile);
+  builder.CreateCondBr(builder.CreateICmpULT(nextRow, height), rowBlock,
+                       stripLatch);
+  builder.SetInsertPoint(stripLatch);
+  Value *nextStrip = builder.CreateAdd(stripStart, columnCount);
+  stripStart->addIncoming(nextStrip, stripLatch);
+  builder.CreateCondBr(builder.CreateICmpULT(nextStrip, width), stripBlock,
+                       exitBlock);
+  exitBlock->insertInto(tile);
+  ReturnInst::Create(context, exitBlock);
+  return moved[0].size() + moved[dep_column].size() + moved[dep_row].size();
+}
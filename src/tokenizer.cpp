@@ -13,8 +13,23 @@ struct SourceLocation {
 extern SourceLocation CurLoc;
 extern SourceLocation LexLoc;
 
+// set while lexing from memory instead of stdin
+static const char *InputCursor = nullptr;
+static const char *InputEnd = nullptr;
+// characters read so far, and where the last token started
+static uint32_t LexOffset = 0;
+static uint32_t TokenStart = 0;
+
 int advance() {
-  int LastChar = getchar();
+  int LastChar;
+  if (!InputCursor)
+    LastChar = getchar();
+  else if (InputCursor == InputEnd)
+    LastChar = EOF;
+  else
+    LastChar = (unsigned char)*InputCursor++;
+  if (LastChar != EOF)
+    LexOffset++;
 
   if (LastChar == '\n' || LastChar == '\r') {
     LexLoc.Line++;
@@ -24,14 +39,15 @@ int advance() {
   return LastChar;
 }
 
-int gettok() {
-  static char LastChar = ' ';
+static char LastChar = ' ';
 
+int gettok() {
   // Skip any whitespace.
   while (isspace(LastChar))
     LastChar = advance();
 
   CurLoc = LexLoc;
+  TokenStart = LastChar == EOF ? LexOffset : LexOffset - 1;
 
   // keywords and identifiers
   if (isalpha(LastChar)) { // identifier: [a-zA-Z_][a-zA-Z0-9_]*
@@ -61,28 +77,10 @@ int gettok() {
       return tok_location;
     if (IdentifierStr == "binding")
       return tok_binding;
-    if (IdentifierStr == "void")
-      return tok_void;
-    if (IdentifierStr == "int")
-      return tok_int;
-    if (IdentifierStr == "bool")
-      return tok_bool;
-    if (IdentifierStr == "float")
-      return tok_float;
-    if (IdentifierStr == "double")
-      return tok_double;
-    if (IdentifierStr == "vec2")
-      return tok_vec2;
-    if (IdentifierStr == "vec3")
-      return tok_vec3;
-    if (IdentifierStr == "vec4")
-      return tok_vec4;
-    if (IdentifierStr == "mat2")
-      return tok_mat2;
-    if (IdentifierStr == "mat3")
-      return tok_mat3;
-    if (IdentifierStr == "mat4")
-      return tok_mat4;
+    for (const AstTypeInfo &info : astTypeInfos) {
+      if (info.type != type_error && IdentifierStr == info.name)
+        return info.token;
+    }
     if (IdentifierStr == "layout")
       return tok_layout;
     if (IdentifierStr == "in")
@@ -218,6 +216,24 @@ int gettok() {
 
   if (LastChar == '/') {
     LastChar = advance();
+    // comments until the end of the line or */
+    if (LastChar == '/') {
+      do
+        LastChar = advance();
+      while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+      return gettok();
+    }
+    if (LastChar == '*') {
+      char previous = ' ';
+      LastChar = advance();
+      while (LastChar != EOF && !(previous == '*' && LastChar == '/')) {
+        previous = LastChar;
+        LastChar = advance();
+      }
+      if (LastChar != EOF)
+        LastChar = advance();
+      return gettok();
+    }
     if (LastChar == '=') {
       LastChar = advance();
       return tok_divide_assign;
@@ -354,6 +370,14 @@ int getNextToken() { return CurTok = gettok(); }
 void redirectInput(std::string filePath) {
   //  freopen("filePath","r",stdin);
   freopen(filePath.c_str(), "r", stdin);
+  InputCursor = nullptr;
+}
+
+void setInputText(const char *begin, const char *end, uint32_t offset) {
+  InputCursor = begin;
+  InputEnd = end;
+  LexOffset = offset;
+  LastChar = ' ';
 }
 
 void redirectOutput(std::string filePath) {
@@ -368,229 +392,226 @@ void rediectOutput(std::string filePath) {
 
 std::vector<Token> tokens;
 
-void Tokenize() {
-  while ((CurTok = getNextToken())) {
-    switch (CurTok) {
-    case tok_layout:
-      tokens.emplace_back(tok_layout, "layout");
-      break;
-    case tok_uniform:
-      tokens.emplace_back(tok_uniform, "uniform");
-      break;
-    case tok_layout_in:
-      tokens.emplace_back(tok_layout_in, "in");
-      break;
-    case tok_layout_out:
-      tokens.emplace_back(tok_layout_out, "out");
-      break;
-    case tok_location:
-      tokens.emplace_back(tok_location, "location");
-      break;
-    case tok_binding:
-      tokens.emplace_back(tok_binding, "binding");
-      break;
-    case tok_version:
-      tokens.emplace_back(tok_version, "#version");
-      break;
-    case tok_const:
-      tokens.emplace_back(tok_const, "const");
-      break;
-    case tok_if:
-      tokens.emplace_back(tok_if, "if");
-      break;
-    case tok_for:
-      tokens.emplace_back(tok_for, "for");
-      break;
-    case tok_return:
-      tokens.emplace_back(tok_return, "return");
-      break;
-    case tok_else:
-      tokens.emplace_back(tok_else, "else");
-      break;
-    case tok_identifier:
-      tokens.emplace_back(tok_identifier, IdentifierStr.c_str());
-      break;
-    case tok_number:
-      tokens.emplace_back(tok_number, NumVal.c_str());
-      break;
-    case tok_void:
-      tokens.emplace_back(tok_void, "void");
-      break;
-    case tok_int:
-      tokens.emplace_back(tok_int, "int");
-      break;
-    case tok_bool:
-      tokens.emplace_back(tok_bool, "bool");
-      break;
-    case tok_float:
-      tokens.emplace_back(tok_float, "float");
-      break;
-    case tok_double:
-      tokens.emplace_back(tok_double, "double");
-      break;
-    case tok_vec2:
-      tokens.emplace_back(tok_vec2, "vec2");
-      break;
-    case tok_vec3:
-      tokens.emplace_back(tok_vec3, "vec3");
-      break;
-    case tok_vec4:
-      tokens.emplace_back(tok_vec4, "vec4");
-      break;
-    case tok_mat2:
-      tokens.emplace_back(tok_mat2, "mat2");
-      break;
-    case tok_mat3:
-      tokens.emplace_back(tok_mat3, "mat3");
-      break;
-    case tok_mat4:
-      tokens.emplace_back(tok_mat4, "mat4");
-      break;
-      // binary operator
-    case tok_plus:
-      tokens.emplace_back(tok_plus, "+");
-      break;
-    case tok_minus:
-      tokens.emplace_back(tok_minus, "-");
-      break;
-    case tok_times:
-      tokens.emplace_back(tok_times, "*");
-      break;
-    case tok_divide:
-      tokens.emplace_back(tok_divide, "/");
-      break;
-    case tok_mod:
-      tokens.emplace_back(tok_mod, "%");
-      break;
-    case tok_assign:
-      tokens.emplace_back(tok_assign, "=");
-      break;
-    case tok_equal:
-      tokens.emplace_back(tok_equal, "==");
-      break;
-    case tok_not_equal:
-      tokens.emplace_back(tok_not_equal, "!=");
-      break;
-    case tok_less:
-      tokens.emplace_back(tok_less, "<");
-      break;
-    case tok_less_equal:
-      tokens.emplace_back(tok_less_equal, "<=");
-      break;
-    case tok_greater:
-      tokens.emplace_back(tok_greater, ">");
-      break;
-    case tok_greater_equal:
-      tokens.emplace_back(tok_greater_equal, ">=");
-      break;
-    case tok_and:
-      tokens.emplace_back(tok_and, "&&");
-      break;
-    case tok_or:
-      tokens.emplace_back(tok_or, "||");
-      break;
-    case tok_xor:
-      tokens.emplace_back(tok_xor, "^^");
-      break;
-    case tok_left_paren:
-      tokens.emplace_back(tok_left_paren, "(");
-      break;
-    case tok_right_paren:
-      tokens.emplace_back(tok_right_paren, ")");
-      break;
-    case tok_left_brace:
-      tokens.emplace_back(tok_left_brace, "{");
-      break;
-    case tok_right_brace:
-      tokens.emplace_back(tok_right_brace, "}");
-      break;
-    case tok_left_bracket:
-      tokens.emplace_back(tok_left_bracket, "[");
-      break;
-    case tok_right_bracket:
-      tokens.emplace_back(tok_right_bracket, "]");
-      break;
-    case tok_tilde:
-      tokens.emplace_back(tok_tilde, "~");
-      break;
-    case tok_exclamation:
-      tokens.emplace_back(tok_exclamation, "!");
-      break;
-    case tok_plus_p:
-      tokens.emplace_back(tok_plus_p, "++");
-      break;
-    case tok_minus_m:
-      tokens.emplace_back(tok_minus_m, "--");
-      break;
-    case tok_bit_and:
-      tokens.emplace_back(tok_bit_and, "&");
-      break;
-    case tok_bit_or:
-      tokens.emplace_back(tok_bit_or, "|");
-      break;
-    case tok_bit_xor:
-      tokens.emplace_back(tok_bit_xor, "^");
-      break;
-    case tok_left_shift:
-      tokens.emplace_back(tok_left_shift, "<<");
-      break;
-    case tok_right_shift:
-      tokens.emplace_back(tok_right_shift, ">>");
-      break;
-    case tok_plus_assign:
-      tokens.emplace_back(tok_plus_assign, "+=");
-      break;
-    case tok_minus_assign:
-      tokens.emplace_back(tok_minus_assign, "-=");
-      break;
-    case tok_times_assign:
-      tokens.emplace_back(tok_times_assign, "*=");
-      break;
-    case tok_divide_assign:
-      tokens.emplace_back(tok_divide_assign, "/=");
-      break;
-    case tok_unary:
-      tokens.emplace_back(tok_unary, "?");
-      break;
-    case tok_mod_assign:
-      tokens.emplace_back(tok_mod_assign, "%=");
-      break;
-    case tok_and_assign:
-      tokens.emplace_back(tok_and_assign, "&=");
-      break;
-    case tok_or_assign:
-      tokens.emplace_back(tok_or_assign, "|=");
-      break;
-    case tok_xor_assign:
-      tokens.emplace_back(tok_xor_assign, "^=");
-      break;
-    case tok_left_shift_assign:
-      tokens.emplace_back(tok_left_shift_assign, "<<=");
-      break;
-    case tok_right_shift_assign:
-      tokens.emplace_back(tok_right_shift_assign, ">>=");
-      break;
-    case tok_semicolon:
-      tokens.emplace_back(tok_semicolon, ";");
-      break;
-    case tok_comma:
-      tokens.emplace_back(tok_comma, ",");
-      break;
-    case tok_colon:
-      tokens.emplace_back(tok_colon, ":");
-      break;
-    case tok_dot:
-      tokens.emplace_back(tok_dot, ".");
-      break;
-    case tok_eof:
-      tokens.emplace_back(tok_eof, "EOF");
-      return;
-    case tok_unkown:
-      // change char CurTok into string
-      tokens.emplace_back(tok_unkown, std::string(1, CurTok).c_str());
-      return;
+void resetTokenizer() {
+  LastChar = ' ';
+  LexLoc = {1, 0};
+  LexOffset = 0;
+  tokens.clear();
+}
+
+bool lexToken(std::vector<Token> &into) {
+  if (!(CurTok = getNextToken()))
+    return false;
+  size_t count = into.size();
+  bool more = true;
+  switch (CurTok) {
+  case tok_layout:
+    into.emplace_back(tok_layout, "layout");
+    break;
+  case tok_uniform:
+    into.emplace_back(tok_uniform, "uniform");
+    break;
+  case tok_layout_in:
+    into.emplace_back(tok_layout_in, "in");
+    break;
+  case tok_layout_out:
+    into.emplace_back(tok_layout_out, "out");
+    break;
+  case tok_location:
+    into.emplace_back(tok_location, "location");
+    break;
+  case tok_binding:
+    into.emplace_back(tok_binding, "binding");
+    break;
+  case tok_version:
+    into.emplace_back(tok_version, "#version");
+    break;
+  case tok_const:
+    into.emplace_back(tok_const, "const");
+    break;
+  case tok_if:
+    into.emplace_back(tok_if, "if");
+    break;
+  case tok_for:
+    into.emplace_back(tok_for, "for");
+    break;
+  case tok_return:
+    into.emplace_back(tok_return, "return");
+    break;
+  case tok_else:
+    into.emplace_back(tok_else, "else");
+    break;
+  case tok_identifier:
+    into.emplace_back(tok_identifier, IdentifierStr.c_str());
+    break;
+  case tok_number:
+    into.emplace_back(tok_number, NumVal.c_str());
+    break;
+    // binary operator
+  case tok_plus:
+    into.emplace_back(tok_plus, "+");
+    break;
+  case tok_minus:
+    into.emplace_back(tok_minus, "-");
+    break;
+  case tok_times:
+    into.emplace_back(tok_times, "*");
+    break;
+  case tok_divide:
+    into.emplace_back(tok_divide, "/");
+    break;
+  case tok_mod:
+    into.emplace_back(tok_mod, "%");
+    break;
+  case tok_assign:
+    into.emplace_back(tok_assign, "=");
+    break;
+  case tok_equal:
+    into.emplace_back(tok_equal, "==");
+    break;
+  case tok_not_equal:
+    into.emplace_back(tok_not_equal, "!=");
+    break;
+  case tok_less:
+    into.emplace_back(tok_less, "<");
+    break;
+  case tok_less_equal:
+    into.emplace_back(tok_less_equal, "<=");
+    break;
+  case tok_greater:
+    into.emplace_back(tok_greater, ">");
+    break;
+  case tok_greater_equal:
+    into.emplace_back(tok_greater_equal, ">=");
+    break;
+  case tok_and:
+    into.emplace_back(tok_and, "&&");
+    break;
+  case tok_or:
+    into.emplace_back(tok_or, "||");
+    break;
+  case tok_xor:
+    into.emplace_back(tok_xor, "^^");
+    break;
+  case tok_left_paren:
+    into.emplace_back(tok_left_paren, "(");
+    break;
+  case tok_right_paren:
+    into.emplace_back(tok_right_paren, ")");
+    break;
+  case tok_left_brace:
+    into.emplace_back(tok_left_brace, "{");
+    break;
+  case tok_right_brace:
+    into.emplace_back(tok_right_brace, "}");
+    break;
+  case tok_left_bracket:
+    into.emplace_back(tok_left_bracket, "[");
+    break;
+  case tok_right_bracket:
+    into.emplace_back(tok_right_bracket, "]");
+    break;
+  case tok_tilde:
+    into.emplace_back(tok_tilde, "~");
+    break;
+  case tok_exclamation:
+    into.emplace_back(tok_exclamation, "!");
+    break;
+  case tok_plus_p:
+    into.emplace_back(tok_plus_p, "++");
+    break;
+  case tok_minus_m:
+    into.emplace_back(tok_minus_m, "--");
+    break;
+  case tok_bit_and:
+    into.emplace_back(tok_bit_and, "&");
+    break;
+  case tok_bit_or:
+    into.emplace_back(tok_bit_or, "|");
+    break;
+  case tok_bit_xor:
+    into.emplace_back(tok_bit_xor, "^");
+    break;
+  case tok_left_shift:
+    into.emplace_back(tok_left_shift, "<<");
+    break;
+  case tok_right_shift:
+    into.emplace_back(tok_right_shift, ">>");
+    break;
+  case tok_plus_assign:
+    into.emplace_back(tok_plus_assign, "+=");
+    break;
+  case tok_minus_assign:
+    into.emplace_back(tok_minus_assign, "-=");
+    break;
+  case tok_times_assign:
+    into.emplace_back(tok_times_assign, "*=");
+    break;
+  case tok_divide_assign:
+    into.emplace_back(tok_divide_assign, "/=");
+    break;
+  case tok_unary:
+    into.emplace_back(tok_unary, "?");
+    break;
+  case tok_mod_assign:
+    into.emplace_back(tok_mod_assign, "%=");
+    break;
+  case tok_and_assign:
+    into.emplace_back(tok_and_assign, "&=");
+    break;
+  case tok_or_assign:
+    into.emplace_back(tok_or_assign, "|=");
+    break;
+  case tok_xor_assign:
+    into.emplace_back(tok_xor_assign, "^=");
+    break;
+  case tok_left_shift_assign:
+    into.emplace_back(tok_left_shift_assign, "<<=");
+    break;
+  case tok_right_shift_assign:
+    into.emplace_back(tok_right_shift_assign, ">>=");
+    break;
+  case tok_semicolon:
+    into.emplace_back(tok_semicolon, ";");
+    break;
+  case tok_comma:
+    into.emplace_back(tok_comma, ",");
+    break;
+  case tok_colon:
+    into.emplace_back(tok_colon, ":");
+    break;
+  case tok_dot:
+    into.emplace_back(tok_dot, ".");
+    break;
+  case tok_eof:
+    into.emplace_back(tok_eof, "EOF");
+    more = false;
+    break;
+  case tok_unkown:
+    // change char CurTok into string
+    into.emplace_back(tok_unkown, std::string(1, CurTok).c_str());
+    more = false;
+    break;
+  default:
+    // type keywords
+    if (isAstType((TokenType)CurTok)) {
+      into.emplace_back(
+          (TokenType)CurTok,
+          astTypeToString(getAstTypeFromToken((TokenType)CurTok)).c_str());
     }
+    break;
+  }
+  if (into.size() > count) {
+    uint32_t end = LastChar == EOF ? LexOffset : LexOffset - 1;
+    into.back().offset = TokenStart;
+    into.back().length = end - TokenStart;
   }
+  return more;
+}
+
+void Tokenize() {
+  while (lexToken(tokens))
+    ;
 }
 
 std::string Token::toString() {
@@ -0,0 +1,56 @@
+#include "type_table.h"
+
+thread_local std::unique_ptr<TypeTable> TheTypes;
+
+static Type *getScalarType(LLVMContext &context, ScalarKind scalar) {
+  switch (scalar) {
+  case scalar_void:
+    return Type::getVoidTy(context);
+  case scalar_bool:
+    return Type::getInt1Ty(context);
+  case scalar_int:
+  case scalar_uint:
+    return Type::getInt32Ty(context);
+  case scalar_float:
+    return Type::getFloatTy(context);
+  case scalar_double:
+    return Type::getDoubleTy(context);
+  }
+  return nullptr;
+}
+
+TypeTable::TypeTable(LLVMContext &context, const DataLayout &layout) {
+  for (const AstTypeInfo &info : astTypeInfos) {
+    Entry &entry = entries[astTypeSlot(info.type)];
+    if (info.type == type_error)
+      continue;
+    entry.elementType = getScalarType(context, info.scalar);
+    entry.lanes = info.lanes();
+    if (info.lanes() > 1) {
+      entry.type = FixedVectorType::get(entry.elementType, info.lanes());
+      entry.columnType =
+          info.isMatrix() ? FixedVectorType::get(entry.elementType, info.rows)
+                          : entry.type;
+    } else {
+      entry.type = entry.elementType;
+      entry.columnType = entry.type;
+    }
+    entry.memoryType = entry.type;
+    if (info.scalar == scalar_bool) {
+      entry.memoryType = Type::getInt32Ty(context);
+      if (info.lanes() > 1)
+        entry.memoryType = FixedVectorType::get(entry.memoryType, info.lanes());
+    }
+    if (entry.memoryType->isSized())
+      entry.align = layout.getABITypeAlign(entry.memoryType);
+  }
+}
+
+Type *TypeTable::getVectorType(ScalarKind scalar, unsigned lanes) const {
+  AstType type = getVectorAstType(scalar, lanes);
+  if (type != type_error)
+    return getType(type);
+  // wider than any GLSL vector, e.g. a flattened matrix
+  Type *elementType = get(getVectorAstType(scalar, 1)).type;
+  return FixedVectorType::get(elementType, lanes);
+}
@@ -0,0 +1,491 @@
+#include "watch.h"
+#include "abi.h"
+#include "backend.h"
+#include "document.h"
+#include "generator.h"
+#include "parser.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace llvm::orc;
+
+extern thread_local std::unique_ptr<Module> TheModule;
+
+namespace {
+// the tokens of a top level definition and the names in them
+struct DefinitionInfo {
+  std::string name;
+  uint64_t hash = 0;
+  // the tokens before the body, all of them for a global
+  uint64_t signature = 0;
+  bool isFunction = false;
+  // a const global is folded into its users and has no object
+  bool hasObject = false;
+  std::vector<std::string> references;
+};
+
+// an object in the dylib and the key it was compiled for
+struct LiveObject {
+  uint64_t key = 0;
+  ResourceTrackerSP tracker;
+};
+
+// an object added for a candidate version, not linked yet
+struct NewObject {
+  std::string name;
+  std::string symbol;
+  uint64_t key;
+  bool isFunction;
+  bool isEntryPoint = false;
+  ResourceTrackerSP tracker = nullptr;
+};
+
+using EntryFunction = void (*)(void *context);
+
+class ShaderWatcher {
+  LLJIT &jit;
+  TargetMachine &machine;
+  JITDylib &dylib;
+  // callers reach the functions and the entry point through stubs, a new
+  // version is swapped in by pointing the stub at it
+  std::unique_ptr<IndirectStubsManager> stubs;
+  std::string path;
+  std::string entry;
+
+  // the file as last read, parsed again as far as it changed
+  std::unique_ptr<Document> document;
+  // the running version, functions and globals by their names in the
+  // source
+  StringMap<LiveObject> live;
+  LiveObject entryPoint;
+  uint64_t contextSize = 0;
+
+  bool compile(TopLevelAST &candidate,
+               const std::vector<DefinitionInfo> &candidateInfos,
+               const std::vector<uint64_t> &keys,
+               const std::vector<size_t> &stale, bool entryStale,
+               uint64_t entryKey, std::vector<NewObject> &added);
+  bool swap(std::vector<NewObject> &added);
+
+public:
+  ShaderWatcher(LLJIT &jit, TargetMachine &machine, JITDylib &dylib,
+                std::unique_ptr<IndirectStubsManager> stubs, std::string path,
+                std::string entry)
+      : jit(jit), machine(machine), dylib(dylib), stubs(std::move(stubs)),
+        path(std::move(path)), entry(std::move(entry)) {}
+
+  // bring the running version up to date with the file, false if it stays
+  bool reload();
+};
+} // namespace
+
+static DefinitionInfo describeDefinition(const std::vector<Token> &tokens,
+                                         uint32_t begin, uint32_t end) {
+  DefinitionInfo info;
+  hash_code hash = hash_value(0);
+  bool inBody = false;
+  for (uint32_t i = begin; i < end; i++) {
+    if (tokens[i].type == tok_left_brace && !inBody) {
+      info.signature = hash;
+      inBody = true;
+    }
+    hash = hash_combine(hash, tokens[i].type, StringRef(*tokens[i].value));
+    if (tokens[i].type == tok_identifier)
+      info.references.push_back(*tokens[i].value);
+  }
+  info.hash = hash;
+  if (!inBody)
+    info.signature = hash;
+  llvm::sort(info.references);
+  info.references.erase(
+      std::unique(info.references.begin(), info.references.end()),
+      info.references.end());
+  return info;
+}
+
+// versions of a definition live side by side in the dylib, each under the
+// name of its key
+static std::string getSymbolName(StringRef name, uint64_t key) {
+  return (name + "." + utohexstr(key)).str();
+}
+
+static void removeObjects(std::vector<NewObject> &objects) {
+  for (NewObject &object : objects)
+    consumeError(object.tracker->remove());
+  objects.clear();
+}
+
+bool ShaderWatcher::compile(TopLevelAST &candidate,
+                            const std::vector<DefinitionInfo> &candidateInfos,
+                            const std::vector<uint64_t> &keys,
+                            const std::vector<size_t> &stale, bool entryStale,
+                            uint64_t entryKey,
+                            std::vector<NewObject> &added) {
+  // every definition is declared, only the stale bodies are lowered
+  resetModule();
+  InitializeModule();
+  auto &definitions = candidate.getDefinitions();
+  // expressions are lowered from the flat form of the whole program
+  candidate.index();
+  for (auto &definition : definitions) {
+    if (definition->isFunction()) {
+      auto *function = static_cast<FunctionDefinitionAST *>(definition.get());
+      if (!function->declare())
+        return false;
+    } else if (!definition->codegen()) {
+      // keeps the global of the previous version
+      return false;
+    }
+  }
+  for (size_t i : stale) {
+    if (candidateInfos[i].isFunction && !definitions[i]->codegen())
+      return false;
+  }
+  TheModule->setDataLayout(jit.getDataLayout());
+  TheModule->setTargetTriple(jit.getTargetTriple().str());
+  if (entryStale &&
+      !emitEntryPoint(candidate, *TheModule, entry, /*internalize=*/false))
+    return false;
+  if (verifyModule(*TheModule, &outs()))
+    return false;
+
+  // functions are called by their source names, which are the stubs.
+  // Globals are used directly, so by the names of their keys
+  for (size_t i = 0; i < candidateInfos.size(); i++) {
+    GlobalVariable *global =
+        TheModule->getNamedGlobal(candidateInfos[i].name);
+    if (!global)
+      continue;
+    global->setName(getSymbolName(candidateInfos[i].name, keys[i]));
+    if (!global->hasInitializer())
+      global->setInitializer(Constant::getNullValue(global->getValueType()));
+  }
+
+  // an object is cut out of the module with everything else declared
+  SimpleCompiler compiler(machine);
+  auto emit = [&](ArrayRef<GlobalValue *> values, bool rename,
+                  NewObject object) {
+    ValueToValueMapTy map;
+    std::unique_ptr<Module> part =
+        CloneModule(*TheModule, map, [&](const GlobalValue *value) {
+          return is_contained(values, value);
+        });
+    for (GlobalValue *value : values) {
+      Value *copy = map[value];
+      if (rename)
+        copy->setName(getSymbolName(value->getName(), object.key));
+    }
+    optimizeModule(*part, machine);
+    Expected<std::unique_ptr<MemoryBuffer>> buffer = compiler(*part);
+    if (!buffer) {
+      printf("Error: %s\n", toString(buffer.takeError()).c_str());
+      return false;
+    }
+    object.tracker = dylib.createResourceTracker();
+    Error error = jit.addObjectFile(object.tracker, std::move(*buffer));
+    added.push_back(std::move(object));
+    if (error) {
+      printf("Error: %s\n", toString(std::move(error)).c_str());
+      return false;
+    }
+    return true;
+  };
+  for (size_t i : stale) {
+    const DefinitionInfo &info = candidateInfos[i];
+    std::string symbol = getSymbolName(info.name, keys[i]);
+    GlobalValue *value = TheModule->getNamedValue(
+        info.isFunction ? StringRef(info.name) : StringRef(symbol));
+    if (!value ||
+        !emit({value}, info.isFunction,
+              {info.name, symbol, keys[i], info.isFunction}))
+      return false;
+  }
+  if (entryStale) {
+    Function *function = TheModule->getFunction(entry);
+    GlobalVariable *size = TheModule->getNamedGlobal(entry + "_context_size");
+    if (!emit({function, size}, true,
+              {entry, getSymbolName(entry, entryKey), entryKey, true, true}))
+      return false;
+  }
+  return true;
+}
+
+bool ShaderWatcher::swap(std::vector<NewObject> &added) {
+  // a stub for every new function, callers link against it
+  for (NewObject &object : added) {
+    if (!object.isFunction || stubs->findStub(object.name, true))
+      continue;
+    Error error = stubs->createStub(
+        object.name, 0, JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+    if (!error)
+      error = dylib.define(
+          absoluteSymbols({{jit.mangleAndIntern(object.name),
+                            stubs->findStub(object.name, true)}}));
+    if (error) {
+      printf("Error: %s\n", toString(std::move(error)).c_str());
+      return false;
+    }
+  }
+
+  // objects are linked by the first lookup, none is swapped in unless
+  // they all link
+  std::vector<uint64_t> addresses;
+  uint64_t size = contextSize;
+  for (NewObject &object : added) {
+    Expected<ExecutorAddr> address = jit.lookup(dylib, object.symbol);
+    if (!address) {
+      printf("Error: %s\n", toString(address.takeError()).c_str());
+      return false;
+    }
+    addresses.push_back(address->getValue());
+    if (!object.isEntryPoint)
+      continue;
+    Expected<ExecutorAddr> sizeAddress = jit.lookup(
+        dylib, getSymbolName(entry + "_context_size", object.key));
+    if (!sizeAddress) {
+      printf("Error: %s\n", toString(sizeAddress.takeError()).c_str());
+      return false;
+    }
+    size = *sizeAddress->toPtr<const uint64_t *>();
+  }
+
+  contextSize = size;
+  for (size_t i = 0; i < added.size(); i++) {
+    NewObject &object = added[i];
+    if (object.isFunction)
+      cantFail(stubs->updatePointer(object.name, addresses[i]));
+    LiveObject &replaced =
+        object.isEntryPoint ? entryPoint : live[object.name];
+    if (replaced.tracker)
+      consumeError(replaced.tracker->remove());
+    replaced = {object.key, std::move(object.tracker)};
+  }
+  added.clear();
+  return true;
+}
+
+bool ShaderWatcher::reload() {
+  auto start = std::chrono::steady_clock::now();
+  ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(path);
+  if (!file) {
+    printf("Error: cannot read %s\n", path.c_str());
+    return false;
+  }
+  StringRef contents = (*file)->getBuffer();
+  size_t reparsed;
+  if (!document) {
+    document = std::make_unique<Document>(contents.str());
+    reparsed = document->getProgram().getDefinitions().size() - 1;
+  } else {
+    // the file changed as one edit, between what it starts and ends with
+    // as before
+    StringRef text = document->getText();
+    size_t prefix = 0;
+    size_t common = std::min(text.size(), contents.size());
+    while (prefix < common && text[prefix] == contents[prefix])
+      prefix++;
+    size_t suffix = 0;
+    while (suffix < common - prefix &&
+           text[text.size() - 1 - suffix] ==
+               contents[contents.size() - 1 - suffix])
+      suffix++;
+    TextEdit edit;
+    edit.offset = prefix;
+    edit.removed = text.size() - prefix - suffix;
+    edit.inserted = contents.slice(prefix, contents.size() - suffix).str();
+    reparsed = document->edit(edit).parsed;
+  }
+  auto reject = [] {
+    printf("reject\n");
+    return false;
+  };
+  if (!document->isValid())
+    return reject();
+
+  TopLevelAST &candidate = document->getProgram();
+  std::vector<DefinitionInfo> candidateInfos(1);
+  candidateInfos[0].hash = hash_value(StringRef("gl_Position"));
+  candidateInfos[0].signature = candidateInfos[0].hash;
+  for (size_t i = 1; i < candidate.getDefinitions().size(); i++) {
+    auto span = document->getDefinitionTokens(i);
+    candidateInfos.push_back(
+        describeDefinition(document->getTokens(), span.first, span.second));
+  }
+
+  StringMap<size_t> byName;
+  for (size_t i = 0; i < candidateInfos.size(); i++) {
+    DefinitionInfo &info = candidateInfos[i];
+    const DefinitionAST *definition = candidate.getDefinitions()[i].get();
+    if (definition->isFunction()) {
+      auto *function = static_cast<const FunctionDefinitionAST *>(definition);
+      info.name = function->getName();
+      info.isFunction = true;
+      info.hasObject = true;
+    } else {
+      auto *global =
+          static_cast<const GlobalVariableDefinitionAST *>(definition);
+      info.name = global->getName();
+      info.hasObject = !global->getIsConst();
+    }
+    if (!byName.insert({info.name, i}).second) {
+      printf("Error: %s is defined twice\n", info.name.c_str());
+      return reject();
+    }
+  }
+
+  // a global's key covers the globals it names, which const ones are
+  // folded from. A function's covers the signatures of the functions and
+  // the keys of the globals it names. The entry point's covers every
+  // global and the signature of main
+  std::vector<uint64_t> keys(candidateInfos.size());
+  uint64_t entryKey = hash_value(entry);
+  for (size_t i = 0; i < candidateInfos.size(); i++) {
+    const DefinitionInfo &info = candidateInfos[i];
+    hash_code key = hash_value(info.hash);
+    for (const std::string &reference : info.references) {
+      auto found = byName.find(reference);
+      if (found == byName.end() || found->second == i)
+        continue;
+      const DefinitionInfo &named = candidateInfos[found->second];
+      if (named.isFunction)
+        key = hash_combine(key, named.signature);
+      else if (found->second < i)
+        key = hash_combine(key, keys[found->second]);
+      else
+        key = hash_combine(key, named.hash);
+    }
+    keys[i] = key;
+    if (!info.isFunction)
+      entryKey = hash_combine(entryKey, keys[i]);
+    else if (info.name == "main")
+      entryKey = hash_combine(entryKey, info.signature);
+  }
+
+  std::vector<size_t> stale;
+  size_t functionCount = 0;
+  size_t recompiled = 0;
+  for (size_t i = 0; i < candidateInfos.size(); i++) {
+    const DefinitionInfo &info = candidateInfos[i];
+    functionCount += info.isFunction;
+    auto found = live.find(info.name);
+    if (info.hasObject &&
+        (found == live.end() || found->second.key != keys[i])) {
+      stale.push_back(i);
+      recompiled += info.isFunction;
+    }
+  }
+  bool entryStale = !entryPoint.tracker || entryPoint.key != entryKey;
+
+  std::vector<NewObject> added;
+  if ((!stale.empty() || entryStale) &&
+      (!compile(candidate, candidateInfos, keys, stale, entryStale, entryKey,
+                added) ||
+       !swap(added))) {
+    removeObjects(added);
+    return reject();
+  }
+
+  // what the new version does not define any more
+  for (auto it = live.begin(); it != live.end();) {
+    auto current = it++;
+    auto found = byName.find(current->getKey());
+    if (found == byName.end() || !candidateInfos[found->second].hasObject) {
+      consumeError(current->second.tracker->remove());
+      live.erase(current);
+    }
+  }
+
+  Expected<ExecutorAddr> function = jit.lookup(dylib, entry);
+  if (!function) {
+    printf("Error: %s\n", toString(function.takeError()).c_str());
+    return false;
+  }
+  std::vector<char> context(contextSize);
+  function->toPtr<EntryFunction>()(context.data());
+  double milliseconds = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  printf("accept %.1f ms, parsed %zu of %zu definitions, compiled %zu of "
+         "%zu functions\n",
+         milliseconds, reparsed, candidateInfos.size() - 1, recompiled,
+         functionCount);
+  return true;
+}
+
+int watchShader(const std::string &path, const std::string &entry) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  // position independent, objects reach each other through the GOT
+  // wherever the JIT places them
+  Expected<JITTargetMachineBuilder> builder =
+      JITTargetMachineBuilder::detectHost();
+  if (!builder) {
+    printf("Error: %s\n", toString(builder.takeError()).c_str());
+    return -1;
+  }
+  builder->setRelocationModel(Reloc::PIC_);
+  builder->setCodeModel(CodeModel::Small);
+  Expected<std::unique_ptr<TargetMachine>> machine =
+      builder->createTargetMachine();
+  if (!machine) {
+    printf("Error: %s\n", toString(machine.takeError()).c_str());
+    return -1;
+  }
+  Expected<std::unique_ptr<LLJIT>> jit =
+      LLJITBuilder().setJITTargetMachineBuilder(*builder).create();
+  if (!jit) {
+    printf("Error: %s\n", toString(jit.takeError()).c_str());
+    return -1;
+  }
+  auto createStubs =
+      createLocalIndirectStubsManagerBuilder((*jit)->getTargetTriple());
+  if (!createStubs) {
+    printf("Error: no stubs for %s\n",
+           (*jit)->getTargetTriple().str().c_str());
+    return -1;
+  }
+  // the library functions the built-ins call
+  JITDylib &dylib = (*jit)->getMainJITDylib();
+  auto process = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      (*jit)->getDataLayout().getGlobalPrefix());
+  if (!process) {
+    printf("Error: %s\n", toString(process.takeError()).c_str());
+    return -1;
+  }
+  dylib.addGenerator(std::move(*process));
+  initBinopPrecedence();
+
+  ShaderWatcher watcher(**jit, **machine, dylib, createStubs(), path, entry);
+  sys::TimePoint<> modified;
+  uint64_t size = 0;
+  bool first = true;
+  while (true) {
+    sys::fs::file_status status;
+    if (!sys::fs::status(path, status) &&
+        (first || status.getLastModificationTime() != modified ||
+         status.getSize() != size)) {
+      first = false;
+      modified = status.getLastModificationTime();
+      size = status.getSize();
+      watcher.reload();
+      fflush(stdout);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+}
@@ -0,0 +1,34 @@
+#version 540
+
+bool flag;
+bvec2 mask;
+
+bool isBig(float x) {
+    return x > 2.0;
+}
+
+int pick(bool b, int x) {
+    int r = 0;
+    if (b) {
+        r = x;
+    }
+    return r;
+}
+
+int main() {
+    int a = 3;
+    float f = 2.5;
+    bool big = isBig(f);
+    bool small = !big;
+    bool either = big ^^ small;
+    int r = pick(big, 1) + pick(small, 2) * 2 + int(either) * 4;
+    bool fromInt = bool(a);
+    bool fromZero = bool(0.0);
+    r = r + int(fromInt) * 8 + int(fromZero) * 16;
+    flag = f > 0.5;
+    mask.y = flag;
+    if (mask.x || flag) {
+        r = r + 32;
+    }
+    return r;
+}
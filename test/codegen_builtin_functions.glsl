@@ -0,0 +1,28 @@
+#version 540
+
+layout (binding) uniform vec2 resolution;
+float time;
+
+vec4 shade(vec3 normal, vec3 light, vec2 uv) {
+    vec3 n = normalize(normal);
+    float diffuse = clamp(dot(n, normalize(light)), 0.0, 1.0);
+    vec3 r = reflect(-light, n);
+    float spec = pow(max(r.z, 0.0), 16.0);
+    float wave = sin(uv.x * 10.0 + time) * cos(uv.y * 10.0 - time);
+    vec3 base = mix(vec3(0.2, 0.3, 0.8), vec3(1.0, 0.9, 0.6), smoothstep(-1.0, 1.0, wave));
+    float edge = step(0.95, length(uv / resolution));
+    return vec4(base * diffuse + spec + fract(time) * abs(-edge), 1.0);
+}
+
+layout (binding) uniform uint count;
+layout (binding) uniform uint limit;
+
+// umax and umin, and a uint result
+uint steps() {
+    return clamp(max(count, limit), 1, limit);
+}
+
+// true is 1.0
+float lit(bool on) {
+    return min(on, 0.5);
+}
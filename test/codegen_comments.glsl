@@ -0,0 +1,16 @@
+#version 440
+
+// a line comment
+layout (location = 0) in vec3 aPos; // after a declaration
+
+/* a block comment
+   over several lines */
+float half(float x) {
+    return x / 2.0; /* between */ // and after
+}
+
+void main()
+{
+    float y = half(aPos.y) /**/ / 1.0;
+    gl_Position = vec4(aPos.x, y, aPos.z, 1.0);
+}
@@ -0,0 +1,20 @@
+#version 540
+
+const float scale = 2.0 * 1.5;
+const vec2 offset = vec2(1.0, scale);
+const bool on = scale > 1.0;
+float weight = sqrt(16.0);
+
+int main() {
+    const float half = 1.0 / 2.0 * 2.0;
+    const float s = sin(0.0) + cos(0.0);
+    const mat2 m = mat2(1.0, 2.0, 3.0, 4.0);
+    vec2 c = m[1];
+    int i = 0;
+    vec2 d = m[i];
+    float y = scale * half + s + offset.y;
+    if (on) {
+        y = y + c.y + d.x;
+    }
+    return int(y);
+}
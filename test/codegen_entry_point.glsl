@@ -0,0 +1,20 @@
+#version 440
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in bool flip;
+layout (binding = 0) uniform mat4 transform;
+layout (binding = 1) uniform float scale;
+layout (location = 0) out vec3 color;
+
+int calls = 0;
+
+void main()
+{
+    calls = calls + 1;
+    vec4 position = transform * vec4(aPos, 1.0);
+    if (flip) {
+        position = -position;
+    }
+    gl_Position = position * scale;
+    color = vec3(float(calls), aPos.y, scale);
+}
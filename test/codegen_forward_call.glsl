@@ -0,0 +1,25 @@
+#version 540
+
+int main() {
+    return isEven(10) * 10 + int(twice(vec2(1.0, 2.0)).y);
+}
+
+int isEven(int n) {
+    int result = 1;
+    if (n > 0) {
+        result = isOdd(n - 1);
+    }
+    return result;
+}
+
+int isOdd(int n) {
+    int result = 0;
+    if (n > 0) {
+        result = isEven(n - 1);
+    }
+    return result;
+}
+
+vec2 twice(vec2 v) {
+    return v * 2.0;
+}
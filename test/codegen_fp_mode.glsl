@@ -0,0 +1,19 @@
+#version 440
+
+layout (location = 0) in vec3 normal;
+layout (binding = 0) uniform vec3 lightDir;
+layout (binding = 1) uniform float ambient;
+layout (binding = 2) uniform vec3 albedo;
+layout (location = 0) out vec4 fragColor;
+
+void main()
+{
+    // compile with -fp-mode=strict, relaxed and fast. Strict keeps a
+    // separate fmul and fadd for every multiply-add and sums dot() lane by
+    // lane. Relaxed marks them contract, so mix() becomes llvm.fmuladd.
+    // Fast also reduces dot() with llvm.vector.reduce.fadd
+    float diffuse = max(dot(normal, lightDir), 0.0);
+    float light = diffuse * 0.8 + ambient * 0.2 + 0.05;
+    vec3 color = mix(albedo * ambient, albedo, diffuse);
+    fragColor = vec4(color * light, 1.0);
+}
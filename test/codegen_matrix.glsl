@@ -0,0 +1,15 @@
+#version 540
+
+vec4 transform(mat4 model, mat4 view, vec4 p, vec4 n) {
+    mat4 mv = view * model;
+    mat4 normal = transpose(inverse(mv));
+    vec4 q = mv * p;
+    q += n * normal;
+    mv *= model;
+    return q * determinant(mv);
+}
+
+vec2 rotate(mat2 r, vec2 p) {
+    mat2 inv = inverse(r);
+    return inv * p;
+}
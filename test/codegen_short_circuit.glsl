@@ -0,0 +1,19 @@
+#version 540
+
+int counter;
+
+int bump(int x) {
+    counter = counter + 1;
+    return x;
+}
+
+int main() {
+    int a = 3;
+    int b = 0;
+    int c = a > 1 && b < 2;
+    int d = b != 0 && bump(a) > 2;
+    int e = a > 0 || bump(b) > 0;
+    int f = a > 2 ? a * 2 : b;
+    int g = b != 0 ? bump(1) : a++;
+    return c * 1 + d * 2 + e * 4 + f * 8 + g * 16 + counter * 64 + a;
+}
@@ -0,0 +1,29 @@
+#version 440
+
+layout (location = 0) in vec2 fragCoord;
+layout (binding = 0) uniform float time;
+layout (binding = 1) uniform vec2 resolution;
+layout (binding = 2) uniform int octaves;
+layout (binding = 3) uniform bool banded;
+layout (binding = 4) uniform vec3 baseColor;
+layout (location = 0) out vec4 fragColor;
+
+void main()
+{
+    // time changes every frame, the material stays the same for long
+    // runs of them. Run with -run=FILE to fold the material in
+    vec2 uv = fragCoord / resolution;
+    float value = 0.0;
+    float amplitude = 0.5;
+    float frequency = 2.0;
+    for (int i = 0; i < octaves; i++) {
+        value += amplitude * sin(uv.x * frequency + time) *
+                 cos(uv.y * frequency - time);
+        frequency *= 2.0;
+        amplitude *= 0.5;
+    }
+    if (banded) {
+        value = floor(value * 4.0) / 4.0;
+    }
+    fragColor = vec4(baseColor * (0.5 + 0.5 * value), 1.0);
+}
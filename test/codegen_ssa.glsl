@@ -0,0 +1,17 @@
+#version 540
+
+int loop(int n) {
+    int sum = 0;
+    vec2 acc = vec2(0.0);
+    for (int i = 0; i < n; i++) {
+        sum += i;
+        acc.x = acc.x + 1.0;
+        if (sum > 10) {
+            sum = sum - 1;
+        } else {
+            acc.y += 2.0;
+        }
+    }
+    n = n * 2;
+    return sum + n;
+}
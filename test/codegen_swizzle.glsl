@@ -0,0 +1,16 @@
+#version 540
+
+vec4 gl_FragCoord;
+layout (binding) uniform vec2 resolution;
+
+vec4 shade(vec4 c, vec3 n) {
+    vec2 pos = gl_FragCoord.xy / resolution.xy;
+    c.xz = pos;
+    c.rgb = c.bgr;
+    c.w += n.x;
+    n.zy = n.xx * 2.0;
+    gl_Position.xy = pos.yx;
+    vec3 t = c.xyz.zyx;
+    c.a = t.s + n.p;
+    return c;
+}
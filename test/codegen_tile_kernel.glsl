@@ -0,0 +1,31 @@
+#version 440
+
+layout (location = 0) in vec2 fragCoord;
+layout (binding = 0) uniform float time;
+layout (binding = 1) uniform vec2 resolution;
+layout (location = 0) out vec4 fragColor;
+
+float hash(float n)
+{
+    return fract(sin(n) * 43758.5453);
+}
+
+float noise(float x)
+{
+    float i = floor(x);
+    float f = fract(x);
+    return mix(hash(i), hash(i + 1.0), f * f * (3.0 - 2.0 * f));
+}
+
+void main()
+{
+    // sky and bands vary along y alone and stripes along x alone, a tile
+    // kernel works them out once per row or column. The grain takes both
+    vec2 uv = fragCoord / resolution;
+    float sky = 0.5 + 0.5 * cos(time - uv.y * 6.0);
+    float bands = noise(uv.y * 40.0 + time) * 0.25;
+    float stripes = sin(uv.x * 30.0 + time) * 0.5 + 0.5;
+    float grain = hash(fragCoord.x * 12.9898 + fragCoord.y * 78.233);
+    fragColor = vec4(sky * stripes, bands + sky * 0.5, grain * 0.1 + uv.x,
+                     1.0);
+}
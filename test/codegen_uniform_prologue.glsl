@@ -0,0 +1,27 @@
+#version 440
+
+layout (location = 0) in vec2 fragCoord;
+layout (binding = 0) uniform float time;
+layout (binding = 1) uniform vec2 resolution;
+layout (binding = 2) uniform vec2 mouse;
+layout (location = 0) out vec4 fragColor;
+
+void main()
+{
+    // everything but uv, p and what follows from them is the same for
+    // every pixel of a draw
+    vec2 uv = fragCoord / resolution;
+    vec2 center = mouse / resolution;
+    float angle = time * 0.5;
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float pulse = sin(time * 3.0) * 0.5 + 0.5;
+    vec3 tint = vec3(0.5 + 0.5 * cos(time), 0.5 + 0.5 * sin(time * 0.7),
+                     pulse);
+    vec2 p = rotation * (uv - center);
+    float d = length(p) * (8.0 + 4.0 * pulse);
+    if (d > 6.0 * (1.0 + pulse)) {
+        d = d * 0.5;
+    }
+    fragColor = vec4(tint * sin(d - time * 2.0), 1.0);
+    gl_Position = vec4(p, 0.0, 1.0);
+}
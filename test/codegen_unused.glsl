@@ -0,0 +1,21 @@
+#version 540
+
+float gain;
+float unusedGain;
+const float scale = 2.0;
+
+float square(float x) {
+    return x * x;
+}
+
+float scaled(float x) {
+    return square(x) * scale * gain;
+}
+
+float unusedHelper(float x) {
+    return unusedGain * scaled(x);
+}
+
+int main() {
+    return int(scaled(3.0));
+}
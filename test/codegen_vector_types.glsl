@@ -0,0 +1,18 @@
+#version 540
+
+uint u;
+ivec2 iv2;
+uvec3 uv3;
+bvec4 bv4;
+dvec2 dv2;
+
+int main() {
+    ivec3 iv = ivec3(1, 2, 3);
+    dvec4 dv = dvec4(1.0, 2.0, 3.0, 4.0);
+    uvec2 uv = uvec2(1, 2);
+    bvec2 bv = bvec2(1, 0);
+    vec4 v = vec4(2.0);
+    vec4 w = vec4(vec2(1.0, 2.0), 3.0, 4.0);
+    mat2 m = mat2(1.0, 2.0, 3.0, 4.0);
+    return 0;
+}